@@ -5,6 +5,7 @@ pkgs.mkShell {
     pkgs.gcc
     pkgs.cmake
     pkgs.ninja
+    pkgs.zlib
     pkgs.nodejs_20
     pkgs.nodePackages.vercel
   ];
@@ -1,10 +1,16 @@
 #include "Config.h"
 
+#include <algorithm>
 #include <iostream>
+#include <thread>
 
 #include "absl/strings/str_cat.h"
 #include <toml++/toml.h>
 
+#include "GTFSCsv.h"
+#include "Parallel.h"
+#include "WorldSnapshot.h"
+
 std::optional<std::string> readConfig(
   absl::string_view config_file, const ReadConfigOptions& options, Config& config
 ) {
@@ -22,49 +28,274 @@ std::optional<std::string> readConfig(
     }
   }
 
-  absl::CivilDay date;
-  const std::string& date_str = config_table.at("date").as_string()->get();
-  if (!absl::ParseCivilTime(date_str, &date)) {
-    return absl::StrCat("Error parsing date ", date_str);
+  // Either a single `date`, or several `dates` to read at once.
+  std::vector<std::string> date_strs;
+  if (config_table.get("dates") != nullptr) {
+    const toml::array* dates_arr = config_table.at("dates").as_array();
+    for (size_t i = 0; i < dates_arr->size(); ++i) {
+      date_strs.push_back(dates_arr->at(i).as_string()->get());
+    }
+  } else {
+    date_strs.push_back(config_table.at("date").as_string()->get());
+  }
+  if (date_strs.empty()) {
+    return "Config has no dates";
+  }
+  for (const std::string& date_str : date_strs) {
+    absl::CivilDay date;
+    if (!absl::ParseCivilTime(date_str, &date)) {
+      return absl::StrCat("Error parsing date ", date_str);
+    }
+    config.dates.push_back(date);
+  }
+
+  if (config_table.get("walking") != nullptr) {
+    const toml::table* walking_table = config_table.at("walking").as_table();
+    if (walking_table == nullptr) {
+      return "walking must be a table";
+    }
+    for (const auto& [key, field] : {
+      std::pair<const char*, double*>{"max_meters", &config.walking.max_meters},
+      std::pair<const char*, double*>{"meters_per_second", &config.walking.meters_per_second},
+    }) {
+      if (walking_table->get(key) == nullptr) {
+        continue;
+      }
+      const toml::node& node = walking_table->at(key);
+      std::optional<double> value;
+      if (node.as_floating_point() != nullptr) {
+        value = node.as_floating_point()->get();
+      } else if (node.as_integer() != nullptr) {
+        value = node.as_integer()->get();
+      }
+      if (!value.has_value() || *value <= 0) {
+        return absl::StrCat("walking.", key, " must be a positive number");
+      }
+      *field = *value;
+    }
+  }
+
+  if (config_table.get("unify_stations") != nullptr) {
+    const toml::table* unify_table = config_table.at("unify_stations").as_table();
+    if (unify_table == nullptr) {
+      return "unify_stations must be a table";
+    }
+    StationUnificationOptions& unify = config.unify_stations.emplace();
+    for (const auto& [key, field] : {
+      std::pair<const char*, double*>{"max_meters", &unify.max_meters},
+      std::pair<const char*, double*>{"min_name_similarity", &unify.min_name_similarity},
+    }) {
+      if (unify_table->get(key) == nullptr) {
+        continue;
+      }
+      const toml::node& node = unify_table->at(key);
+      std::optional<double> value;
+      if (node.as_floating_point() != nullptr) {
+        value = node.as_floating_point()->get();
+      } else if (node.as_integer() != nullptr) {
+        value = node.as_integer()->get();
+      }
+      if (!value.has_value() || *value < 0) {
+        return absl::StrCat("unify_stations.", key, " must be a non-negative number");
+      }
+      *field = *value;
+    }
+    // Both are arrays of arrays of stop ids, with the feed prefix.
+    std::vector<std::vector<std::string>> separate;
+    for (const auto& [key, groups] : {
+      std::pair<const char*, std::vector<std::vector<std::string>>*>{"merge", &unify.merge},
+      std::pair<const char*, std::vector<std::vector<std::string>>*>{"separate", &separate},
+    }) {
+      if (unify_table->get(key) == nullptr) {
+        continue;
+      }
+      const toml::array* groups_arr = unify_table->at(key).as_array();
+      for (size_t i = 0; groups_arr != nullptr && i < groups_arr->size(); ++i) {
+        const toml::array* ids = groups_arr->at(i).as_array();
+        if (ids == nullptr) {
+          groups_arr = nullptr;
+          break;
+        }
+        std::vector<std::string>& group = groups->emplace_back();
+        for (size_t j = 0; j < ids->size(); ++j) {
+          group.push_back(ids->at(j).as_string()->get());
+        }
+      }
+      if (groups_arr == nullptr) {
+        return absl::StrCat("unify_stations.", key, " must be an array of arrays of stop ids");
+      }
+    }
+    for (const std::vector<std::string>& pair : separate) {
+      if (pair.size() != 2) {
+        return "unify_stations.separate must have pairs of stop ids";
+      }
+      unify.separate.emplace_back(pair[0], pair[1]);
+    }
+  }
+
+  // Applied to every feed as it is read, with ids that include the feed prefix.
+  if (config_table.get("filter") != nullptr) {
+    const toml::table* filter_table = config_table.at("filter").as_table();
+    if (filter_table == nullptr) {
+      return "filter must be a table";
+    }
+    for (const auto& [key, field] : {
+      std::pair<const char*, std::optional<WorldTime>*>{"earliest", &config.filter.earliest},
+      std::pair<const char*, std::optional<WorldTime>*>{"latest", &config.filter.latest},
+    }) {
+      if (filter_table->get(key) == nullptr) {
+        continue;
+      }
+      const toml::node& node = filter_table->at(key);
+      unsigned int seconds = 0;
+      if (node.as_string() == nullptr || !parseGTFSTimeSeconds(node.as_string()->get(), seconds)) {
+        return absl::StrCat("filter.", key, " must be a time like \"05:30:00\"");
+      }
+      *field = WorldTime(seconds);
+    }
+    for (const auto& [key, field] : {
+      std::pair<const char*, std::unordered_set<std::string>*>{"include_routes", &config.filter.include_routes},
+      std::pair<const char*, std::unordered_set<std::string>*>{"exclude_routes", &config.filter.exclude_routes},
+      std::pair<const char*, std::unordered_set<std::string>*>{"include_agencies", &config.filter.include_agencies},
+      std::pair<const char*, std::unordered_set<std::string>*>{"exclude_agencies", &config.filter.exclude_agencies},
+    }) {
+      if (filter_table->get(key) == nullptr) {
+        continue;
+      }
+      const toml::array* ids = filter_table->at(key).as_array();
+      if (ids == nullptr) {
+        return absl::StrCat("filter.", key, " must be an array of ids");
+      }
+      for (size_t i = 0; i < ids->size(); ++i) {
+        field->insert(ids->at(i).as_string()->get());
+      }
+    }
+    // [min_lat, min_lon, max_lat, max_lon]
+    if (filter_table->get("bounding_box") != nullptr) {
+      const toml::array* box_arr = filter_table->at("bounding_box").as_array();
+      std::vector<double> box;
+      for (size_t i = 0; box_arr != nullptr && i < box_arr->size(); ++i) {
+        const toml::node& node = box_arr->at(i);
+        if (node.as_floating_point() != nullptr) {
+          box.push_back(node.as_floating_point()->get());
+        } else if (node.as_integer() != nullptr) {
+          box.push_back(node.as_integer()->get());
+        }
+      }
+      if (box.size() != 4 || box_arr->size() != 4 || box[0] > box[2] || box[1] > box[3]) {
+        return "filter.bounding_box must be [min_lat, min_lon, max_lat, max_lon]";
+      }
+      config.filter.bounding_box = WorldFilter::BoundingBox{box[0], box[1], box[2], box[3]};
+    }
   }
 
+  // If set, feeds are loaded through compiled snapshots in this directory.
+  std::optional<std::string> cache_dir;
+  if (config_table.get("cache_dir") != nullptr) {
+    cache_dir = config_table.at("cache_dir").as_string()->get();
+  }
+
+  struct FeedSpec {
+    std::string dir;
+    std::string prefix;
+    std::unordered_set<std::string> segment_stop_ids;
+  };
+  std::vector<FeedSpec> feeds;
+  std::unordered_set<std::string> prefixes;
   const toml::array* gtfs_arr = config_table.at("gtfs").as_array();
   for (size_t i = 0; i < gtfs_arr->size(); ++i) {
     const toml::table* gtfs_el = gtfs_arr->at(i).as_table();
-    const std::string& dir = gtfs_el->at("dir").as_string()->get();
-    const std::string& prefix = gtfs_el->at("prefix").as_string()->get();
+    FeedSpec& feed = feeds.emplace_back();
+    feed.dir = gtfs_el->at("dir").as_string()->get();
+    feed.prefix = gtfs_el->at("prefix").as_string()->get();
+    if (!prefixes.insert(feed.prefix).second) {
+      // Feeds are merged assuming that their ids are disjoint.
+      return absl::StrCat("Duplicate gtfs prefix ", feed.prefix);
+    }
 
-    std::unordered_set<std::string> segment_stop_ids;
     if (gtfs_el->get("segment_stop_ids") != nullptr) {
       const toml::array* segment_stop_ids_array = gtfs_el->at("segment_stop_ids").as_array();
       for (size_t j = 0; j < segment_stop_ids_array->size(); ++j) {
-        segment_stop_ids.insert(segment_stop_ids_array->at(j).as_string()->get());
+        feed.segment_stop_ids.insert(segment_stop_ids_array->at(j).as_string()->get());
       }
     }
+  }
 
-    const auto err_opt = readGTFSToWorld(
-      dir, prefix, date, options.IgnoreSegmentStopIds ? nullptr : &segment_stop_ids, config.world
-    );
+  // Each feed is read into its own World on a worker thread, and then they are all merged. The cores
+  // are split between the feeds, which each read and segment on their share of them.
+  const size_t num_cores = std::max(1u, std::thread::hardware_concurrency());
+  const unsigned int threads_per_feed = std::max<size_t>(1, num_cores / std::max<size_t>(1, feeds.size()));
+  std::vector<World> feed_worlds(feeds.size());
+  std::vector<std::optional<std::string>> feed_errs(feeds.size());
+  ParallelFor(feeds.size(), [&](size_t i) {
+    const FeedSpec& feed = feeds[i];
+    const std::unordered_set<std::string>* segment_stop_ids_or_all =
+      options.IgnoreSegmentStopIds ? nullptr : &feed.segment_stop_ids;
+    feed_errs[i] = cache_dir.has_value()
+      ? readGTFSToWorldCached(*cache_dir, feed.dir, feed.prefix, config.dates, segment_stop_ids_or_all, config.filter, feed_worlds[i], nullptr, threads_per_feed)
+      : readGTFSToWorldForDates(feed.dir, feed.prefix, config.dates, segment_stop_ids_or_all, config.filter, feed_worlds[i], threads_per_feed);
+    // Each feed is segmented on its own, and MergeWorlds splices the feeds' sorted segments
+    // together.
+    if (!feed_errs[i].has_value() && config.dates.size() == 1 && !options.DeferSegments) {
+      SegmentWorld(config.dates[0], feed_worlds[i], threads_per_feed);
+    }
+  });
+
+  for (const std::optional<std::string>& err_opt : feed_errs) {
     if (err_opt.has_value()) {
       return err_opt.value();
     }
   }
+  MergeWorlds(std::move(feed_worlds), config.world);
 
   if (config_table.get("anytime_connections") != nullptr) {
     const toml::array* anytime_arr = config_table.at("anytime_connections").as_array();
     for (size_t i = 0; i < anytime_arr->size(); ++i) {
       const toml::table* anytime_el = anytime_arr->at(i).as_table();
+      const std::string& origin_stop_id = anytime_el->at("origin").as_string()->get();
+      const std::string& destination_stop_id = anytime_el->at("destination").as_string()->get();
+      std::optional<WorldStopIndex> origin_stop = config.world.stops.ids.Find(origin_stop_id);
+      if (!origin_stop.has_value()) {
+        return "Anytime connection origin not found: " + origin_stop_id;
+      }
+      std::optional<WorldStopIndex> destination_stop = config.world.stops.ids.Find(destination_stop_id);
+      if (!destination_stop.has_value()) {
+        return "Anytime connection destination not found: " + destination_stop_id;
+      }
       WorldAnytimeConnection connection;
-      connection.origin_stop_id = anytime_el->at("origin").as_string()->get();
-      connection.destination_stop_id = anytime_el->at("destination").as_string()->get();
+      connection.origin_stop = *origin_stop;
+      connection.destination_stop = *destination_stop;
       connection.duration = WorldDuration(anytime_el->at("duration_min").as_integer()->get() * 60);
       config.world.anytime_connections.push_back(connection);
 
       // Also add the reverse connection!!
-      std::swap(connection.origin_stop_id, connection.destination_stop_id);
+      std::swap(connection.origin_stop, connection.destination_stop);
       config.world.anytime_connections.push_back(connection);
     }
   }
 
+  if (config.unify_stations.has_value()) {
+    std::vector<std::string> feed_prefixes;
+    for (const FeedSpec& feed : feeds) {
+      feed_prefixes.push_back(feed.prefix);
+    }
+    std::unordered_map<std::string, std::string> unified;
+    auto err = UnifyStations(feed_prefixes, *config.unify_stations, config.world, unified);
+    if (err.has_value()) {
+      return err;
+    }
+    // Problems only have the stations that are left, so targets are renamed to those.
+    std::vector<std::string> target_stop_ids;
+    std::unordered_set<std::string> seen;
+    for (const std::string& stop_id : config.target_stop_ids) {
+      auto it = unified.find(stop_id);
+      const std::string& target = it == unified.end() ? stop_id : it->second;
+      if (seen.insert(target).second) {
+        target_stop_ids.push_back(target);
+      }
+    }
+    config.target_stop_ids = std::move(target_stop_ids);
+  }
+
   return std::nullopt;
 }
@@ -1,16 +1,32 @@
 #pragma once
 
 #include <optional>
+#include <vector>
+
+#include "absl/time/civil_time.h"
 
 #include "World.h"
 
 struct ReadConfigOptions {
   bool IgnoreSegmentStopIds;
+  // Leave `world.segments` empty even if there is just one date, for callers that go straight to a
+  // Problem with `BuildProblemForDate`.
+  bool DeferSegments = false;
 };
 
 struct Config {
+  // Has the trips that run on any of `dates`. If there is just one date (and segments are not
+  // deferred), `world.segments` are that date's; otherwise call `SegmentWorld` for the date of
+  // interest.
   World world;
+  std::vector<absl::CivilDay> dates;
   std::vector<std::string> target_stop_ids;
+  // From the optional [walking] table. Pass to `AddWalkingSegments`.
+  WalkingOptions walking;
+  // From the optional [filter] table. Already applied to `world`.
+  WorldFilter filter;
+  // From the optional [unify_stations] table. Already applied to `world` and `target_stop_ids`.
+  std::optional<StationUnificationOptions> unify_stations;
 };
 
 // Returns an error message on failure.
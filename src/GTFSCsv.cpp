@@ -0,0 +1,312 @@
+#include "GTFSCsv.h"
+
+#include <cstring>
+#include <filesystem>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "absl/strings/str_cat.h"
+
+namespace {
+
+bool isFieldEnd(char c) {
+  return c == ',' || c == '\n' || c == '\r';
+}
+
+// Returns the first ',', '\r' or '\n' in [p, end), or `end` if there is none.
+const char* findFieldEnd(const char* p, const char* end) {
+#if defined(__SSE2__)
+  // Most fields are short, so check a few bytes one at a time before paying for a vector load.
+  for (int i = 0; i < 4 && p < end; ++i, ++p) {
+    if (isFieldEnd(*p)) {
+      return p;
+    }
+  }
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  while (end - p >= 16) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i matches = _mm_or_si128(
+      _mm_cmpeq_epi8(chunk, comma),
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf))
+    );
+    const int mask = _mm_movemask_epi8(matches);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#endif
+  while (p < end && !isFieldEnd(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+// Deflated zip members are inflated this many bytes at a time.
+constexpr size_t kInflateChunk = 1 << 20;
+
+// If `path` is a member of a zip archive, like "feed.zip/stop_times.txt", splits it into the archive
+// and the member name.
+bool splitArchivePath(const std::string& path, std::string& archive, std::string& member) {
+  const std::filesystem::path fs_path(path);
+  if (!isGTFSArchive(fs_path.parent_path().string())) {
+    return false;
+  }
+  archive = fs_path.parent_path().string();
+  member = fs_path.filename().string();
+  return true;
+}
+
+// Parses exactly `n` decimal digits.
+bool parseDigits(const char* p, int n, unsigned int& result) {
+  result = 0;
+  for (int i = 0; i < n; ++i) {
+    const unsigned int digit = static_cast<unsigned char>(p[i]) - '0';
+    if (digit > 9) {
+      return false;
+    }
+    result = result * 10 + digit;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::optional<std::string> GTFSCsvReader::Open(const std::string& path) {
+  path_ = path;
+  columns_.clear();
+  fields_.clear();
+  error_.reset();
+  inflater_.reset();
+  at_end_of_file_ = true;
+  std::string archive_path, member_name;
+  if (splitArchivePath(path, archive_path, member_name)) {
+    auto err = archive_.Open(archive_path);
+    if (err.has_value()) {
+      return err;
+    }
+    const ZipArchive::Member* member = archive_.Find(member_name);
+    if (member == nullptr) {
+      return absl::StrCat(archive_path, " has no ", member_name);
+    }
+    p_ = member->data.data();
+    end_ = member->data.data() + member->data.size();
+    if (member->deflated) {
+      inflater_ = std::make_unique<ZipInflater>(member->data);
+      end_ = p_;
+      at_end_of_file_ = false;
+      Refill();
+      if (error_.has_value()) {
+        return absl::StrCat(path, ": ", *error_);
+      }
+    }
+  } else {
+    auto err = file_.Open(path);
+    if (err.has_value()) {
+      return err;
+    }
+    p_ = file_.data();
+    end_ = file_.data() + file_.size();
+  }
+  if (end_ - p_ >= 3 && std::memcmp(p_, "\xEF\xBB\xBF", 3) == 0) {
+    p_ += 3;
+  }
+  if (!Next()) {
+    return absl::StrCat(path, " has no header");
+  }
+  for (const absl::string_view field : fields_) {
+    columns_.emplace_back(field);
+  }
+  return std::nullopt;
+}
+
+std::optional<size_t> GTFSCsvReader::FindColumn(absl::string_view name) const {
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    if (columns_[i] == name) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<std::string> GTFSCsvReader::RequireColumn(absl::string_view name, size_t& column) const {
+  std::optional<size_t> found = FindColumn(name);
+  if (!found.has_value()) {
+    return absl::StrCat(path_, " has no ", name, " column");
+  }
+  column = *found;
+  return std::nullopt;
+}
+
+bool GTFSCsvReader::Next() {
+  for (;;) {
+    fields_.clear();
+    // Skip blank lines, including the one that a trailing newline would otherwise produce.
+    while (p_ < end_ && (*p_ == '\n' || *p_ == '\r')) {
+      ++p_;
+    }
+    if (p_ >= end_) {
+      if (Refill()) {
+        continue;
+      }
+      return false;
+    }
+    const char* row_start = p_;
+    ReadRow();
+    if (p_ < end_ || at_end_of_file_) {
+      return true;
+    }
+    // The row runs into the end of what has been inflated so far, so it might go on after that.
+    // Read it again once there is more.
+    p_ = row_start;
+    Refill();
+  }
+}
+
+bool GTFSCsvReader::Refill() {
+  if (at_end_of_file_) {
+    return false;
+  }
+  const size_t kept = end_ - p_;
+  if (kept > 0 && p_ != buffer_.data()) {
+    std::memmove(buffer_.data(), p_, kept);
+  }
+  // Rows longer than a chunk make the buffer grow.
+  if (buffer_.size() < kept + kInflateChunk) {
+    buffer_.resize(kept + kInflateChunk);
+  }
+  size_t written = 0;
+  auto err = inflater_->Read(buffer_.data() + kept, buffer_.size() - kept, written);
+  if (err.has_value()) {
+    error_ = err;
+  }
+  if (err.has_value() || written == 0) {
+    at_end_of_file_ = true;
+  }
+  p_ = buffer_.data();
+  end_ = buffer_.data() + kept + written;
+  return written > 0;
+}
+
+void GTFSCsvReader::ReadRow() {
+  size_t num_unescaped = 0;
+  for (;;) {
+    const char* field_end;
+    if (p_ < end_ && *p_ == '"') {
+      // Quoted field: runs to the next quote that is not part of a "" escape.
+      const char* start = p_ + 1;
+      const char* q = start;
+      bool escaped = false;
+      for (;;) {
+        q = static_cast<const char*>(std::memchr(q, '"', end_ - q));
+        if (q == nullptr) {
+          // Unterminated quote. Take the rest of the file rather than failing.
+          q = end_;
+          break;
+        }
+        if (q + 1 < end_ && q[1] == '"') {
+          escaped = true;
+          q += 2;
+          continue;
+        }
+        break;
+      }
+      absl::string_view field(start, q - start);
+      if (escaped) {
+        if (num_unescaped == unescaped_.size()) {
+          unescaped_.emplace_back();
+        }
+        std::string& unescaped = unescaped_[num_unescaped++];
+        unescaped.clear();
+        for (size_t i = 0; i < field.size(); ++i) {
+          unescaped.push_back(field[i]);
+          if (field[i] == '"') {
+            ++i;
+          }
+        }
+        field = unescaped;
+      }
+      fields_.push_back(field);
+      // Anything between the closing quote and the delimiter is malformed; skip it.
+      field_end = findFieldEnd(q == end_ ? end_ : q + 1, end_);
+    } else {
+      field_end = findFieldEnd(p_, end_);
+      fields_.push_back(absl::string_view(p_, field_end - p_));
+    }
+
+    if (field_end == end_) {
+      p_ = end_;
+      return;
+    }
+    p_ = field_end + 1;
+    if (*field_end == ',') {
+      continue;
+    }
+    if (*field_end == '\r' && p_ < end_ && *p_ == '\n') {
+      ++p_;
+    }
+    return;
+  }
+}
+
+std::optional<std::string> openGTFSCsv(
+  const std::string& path,
+  std::initializer_list<std::pair<absl::string_view, size_t*>> columns,
+  GTFSCsvReader& reader
+) {
+  auto err = reader.Open(path);
+  if (err.has_value()) {
+    return err;
+  }
+  for (const auto& [name, column] : columns) {
+    err = reader.RequireColumn(name, *column);
+    if (err.has_value()) {
+      return err;
+    }
+  }
+  return std::nullopt;
+}
+
+bool gtfsFileExists(const std::string& path) {
+  std::string archive_path, member_name;
+  if (!splitArchivePath(path, archive_path, member_name)) {
+    return std::filesystem::exists(path);
+  }
+  ZipArchive archive;
+  return !archive.Open(archive_path).has_value() && archive.Find(member_name) != nullptr;
+}
+
+bool isGTFSArchive(const std::string& directory) {
+  std::error_code ec;
+  return std::filesystem::path(directory).extension() == ".zip" &&
+    std::filesystem::is_regular_file(directory, ec);
+}
+
+bool parseGTFSTimeSeconds(absl::string_view time, unsigned int& seconds) {
+  // Some feeds pad times with spaces.
+  while (!time.empty() && time.front() == ' ') {
+    time.remove_prefix(1);
+  }
+  while (!time.empty() && time.back() == ' ') {
+    time.remove_suffix(1);
+  }
+  // The hours are everything before ":MM:SS".
+  if (time.size() < 7 || time[time.size() - 3] != ':' || time[time.size() - 6] != ':') {
+    return false;
+  }
+  const int hours_digits = time.size() - 6;
+  unsigned int hours, minutes, secs;
+  if (hours_digits > 3 ||
+      !parseDigits(time.data(), hours_digits, hours) ||
+      !parseDigits(time.data() + hours_digits + 1, 2, minutes) ||
+      !parseDigits(time.data() + hours_digits + 4, 2, secs) ||
+      minutes >= 60 || secs >= 60) {
+    return false;
+  }
+  seconds = hours * 3600 + minutes * 60 + secs;
+  return true;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+#include "MappedFile.h"
+#include "ZipArchive.h"
+
+// A reader for GTFS CSV files that hands out fields as views into a memory mapping of the file, so
+// that reading a row does not copy or allocate.
+//
+// Handles the parts of RFC 4180 that GTFS feeds actually use: quoted fields (including "" escapes
+// and embedded delimiters), CRLF or LF line endings, a UTF-8 BOM, and blank lines. Rows shorter than
+// the header read as empty in the missing columns.
+//
+// Files can also be read straight out of a zip archive of the feed, by opening a path of the form
+// "feed.zip/stop_times.txt". Stored members are read from a mapping of the archive like any other
+// file, and deflated ones are inflated into a buffer a piece at a time as the rows are read, so no
+// more than a few rows' worth of the file is ever unpacked at once.
+//
+//   GTFSCsvReader reader;
+//   auto err = reader.Open(directory + "/stop_times.txt");
+//   size_t trip_id;
+//   err = reader.RequireColumn("trip_id", trip_id);
+//   while (reader.Next()) {
+//     absl::string_view id = reader.Field(trip_id);
+//   }
+class GTFSCsvReader {
+public:
+  // Maps the file at `path` and reads its header row.
+  //
+  // Returns an error message if something went wrong, otherwise returns nullopt.
+  std::optional<std::string> Open(const std::string& path);
+
+  // Returns the index of the column named `name`, or nullopt if there is no such column.
+  std::optional<size_t> FindColumn(absl::string_view name) const;
+
+  // Like `FindColumn`, but a missing column is an error.
+  std::optional<std::string> RequireColumn(absl::string_view name, size_t& column) const;
+
+  // Advances to the next row. Returns false at the end of the file, or if the file turns out to be
+  // corrupt; see `Error`.
+  bool Next();
+
+  // If `Next` stopped early because a zip member is corrupt, says what went wrong. Plain files can
+  // not be corrupt in this way.
+  const std::optional<std::string>& Error() const { return error_; }
+
+  // Field `column` of the current row. Only valid until the next call to `Next`.
+  absl::string_view Field(size_t column) const {
+    return column < fields_.size() ? fields_[column] : absl::string_view();
+  }
+
+private:
+  // Reads one row into `fields_`, starting at `p_`.
+  void ReadRow();
+
+  // Moves the unread part of `buffer_` to the front and inflates more of the member after it.
+  // Returns false if there was nothing more.
+  bool Refill();
+
+  MappedFile file_;
+  std::string path_;
+  const char* p_ = nullptr;
+  const char* end_ = nullptr;
+  // Whether [p_, end_) goes to the end of the file, which is only false while inflating.
+  bool at_end_of_file_ = true;
+  std::optional<std::string> error_;
+
+  // Zip archive members are read through these.
+  ZipArchive archive_;
+  std::unique_ptr<ZipInflater> inflater_;
+  std::vector<char> buffer_;
+
+  std::vector<std::string> columns_;
+  std::vector<absl::string_view> fields_;
+  // Backing storage for quoted fields with "" escapes, which are the only fields that cannot be
+  // views into the file. A deque, so that growing it does not move the strings already handed out.
+  std::deque<std::string> unescaped_;
+};
+
+// Opens the GTFS file at `path` with `reader` and finds the index of each of `columns`, which are
+// all required.
+//
+// Returns an error message if something went wrong, otherwise returns nullopt.
+std::optional<std::string> openGTFSCsv(
+  const std::string& path,
+  std::initializer_list<std::pair<absl::string_view, size_t*>> columns,
+  GTFSCsvReader& reader
+);
+
+// Whether the GTFS file at `path` exists, where `path` can be a member of a zip archive as in
+// `GTFSCsvReader::Open`.
+bool gtfsFileExists(const std::string& path);
+
+// Whether `directory` is a zip archive of a feed rather than a directory.
+bool isGTFSArchive(const std::string& directory);
+
+// Parses a GTFS time of the form "H:MM:SS" or "HH:MM:SS" (hours may exceed 24) into seconds since
+// the beginning of the service day.
+//
+// Returns false if `time` is malformed, including minutes or seconds of 60 or more.
+bool parseGTFSTimeSeconds(absl::string_view time, unsigned int& seconds);
@@ -0,0 +1,235 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+
+#include <zlib.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "GTFSCsv.h"
+
+namespace {
+
+// Writes `contents` to a temporary file and returns its path.
+std::string WriteTempFile(const std::string& name, const std::string& contents) {
+  const std::string path = (std::filesystem::temp_directory_path() / name).string();
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << contents;
+  return path;
+}
+
+struct ZipMember {
+  std::string name;
+  std::string contents;
+  bool deflate;
+};
+
+// Writes a zip archive of `members` to a temporary file and returns its path.
+std::string WriteTempZip(const std::string& name, const std::vector<ZipMember>& members) {
+  auto put16 = [](std::string& out, uint16_t v) {
+    out.push_back(v & 0xFF);
+    out.push_back(v >> 8);
+  };
+  auto put32 = [&put16](std::string& out, uint32_t v) {
+    put16(out, v & 0xFFFF);
+    put16(out, v >> 16);
+  };
+  std::string archive, directory;
+  for (const ZipMember& member : members) {
+    std::string data = member.contents;
+    if (member.deflate) {
+      z_stream stream = {};
+      deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+      data.resize(deflateBound(&stream, member.contents.size()));
+      stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(member.contents.data()));
+      stream.avail_in = member.contents.size();
+      stream.next_out = reinterpret_cast<Bytef*>(data.data());
+      stream.avail_out = data.size();
+      deflate(&stream, Z_FINISH);
+      data.resize(stream.total_out);
+      deflateEnd(&stream);
+    }
+    const uint32_t crc = crc32(0, reinterpret_cast<const Bytef*>(member.contents.data()), member.contents.size());
+    const uint16_t method = member.deflate ? 8 : 0;
+    const uint32_t offset = archive.size();
+
+    put32(archive, 0x04034b50);
+    put16(archive, 20);
+    put16(archive, 0);
+    put16(archive, method);
+    put32(archive, 0);
+    put32(archive, crc);
+    put32(archive, data.size());
+    put32(archive, member.contents.size());
+    put16(archive, member.name.size());
+    put16(archive, 0);
+    archive += member.name;
+    archive += data;
+
+    put32(directory, 0x02014b50);
+    put16(directory, 20);
+    put16(directory, 20);
+    put16(directory, 0);
+    put16(directory, method);
+    put32(directory, 0);
+    put32(directory, crc);
+    put32(directory, data.size());
+    put32(directory, member.contents.size());
+    put16(directory, member.name.size());
+    put16(directory, 0);
+    put16(directory, 0);
+    put16(directory, 0);
+    put16(directory, 0);
+    put32(directory, 0);
+    put32(directory, offset);
+    directory += member.name;
+  }
+  const uint32_t directory_offset = archive.size();
+  archive += directory;
+  put32(archive, 0x06054b50);
+  put16(archive, 0);
+  put16(archive, 0);
+  put16(archive, members.size());
+  put16(archive, members.size());
+  put32(archive, directory.size());
+  put32(archive, directory_offset);
+  put16(archive, 0);
+  return WriteTempFile(name, archive);
+}
+
+// Reads every row of the file at `path`, with fields in header order.
+std::vector<std::vector<std::string>> ReadAll(const std::string& path) {
+  GTFSCsvReader reader;
+  EXPECT_EQ(reader.Open(path), std::nullopt);
+  std::vector<std::vector<std::string>> rows;
+  while (reader.Next()) {
+    std::vector<std::string>& row = rows.emplace_back();
+    for (size_t i = 0; i < 3; ++i) {
+      row.emplace_back(reader.Field(i));
+    }
+  }
+  return rows;
+}
+
+}  // namespace
+
+TEST(GTFSCsvTest, columns) {
+  const std::string path = WriteTempFile("GTFSCsvTest_columns.txt", "trip_id,stop_id,arrival_time\nT1,S1,7:50:00\n");
+  GTFSCsvReader reader;
+  ASSERT_EQ(reader.Open(path), std::nullopt);
+  EXPECT_EQ(reader.FindColumn("stop_id"), 1);
+  EXPECT_EQ(reader.FindColumn("parent_station"), std::nullopt);
+
+  size_t column = 0;
+  EXPECT_EQ(reader.RequireColumn("arrival_time", column), std::nullopt);
+  EXPECT_EQ(column, 2);
+  EXPECT_THAT(reader.RequireColumn("departure_time", column), testing::Optional(testing::HasSubstr("departure_time")));
+}
+
+TEST(GTFSCsvTest, lineEndings) {
+  const std::string path = WriteTempFile(
+    "GTFSCsvTest_lineEndings.txt",
+    "\xEF\xBB\xBF" "a,b,c\r\n1,2,3\r\n\r\n4,5,6\n7,8,9"
+  );
+  EXPECT_THAT(ReadAll(path), testing::ElementsAre(
+    testing::ElementsAre("1", "2", "3"),
+    testing::ElementsAre("4", "5", "6"),
+    testing::ElementsAre("7", "8", "9")
+  ));
+}
+
+TEST(GTFSCsvTest, quotedFields) {
+  const std::string path = WriteTempFile(
+    "GTFSCsvTest_quotedFields.txt",
+    "\"a\",\"b\",\"c\"\r\n\"x, y\",\"say \"\"hi\"\"\",\"\"\r\n\"line\nbreak\",plain,\"\"\"\"\r\n"
+  );
+  GTFSCsvReader reader;
+  ASSERT_EQ(reader.Open(path), std::nullopt);
+  EXPECT_EQ(reader.FindColumn("c"), 2);
+  EXPECT_THAT(ReadAll(path), testing::ElementsAre(
+    testing::ElementsAre("x, y", "say \"hi\"", ""),
+    testing::ElementsAre("line\nbreak", "plain", "\"")
+  ));
+}
+
+TEST(GTFSCsvTest, shortRows) {
+  const std::string path = WriteTempFile("GTFSCsvTest_shortRows.txt", "a,b,c\n1\n1,2,3,4\n,,\n");
+  EXPECT_THAT(ReadAll(path), testing::ElementsAre(
+    testing::ElementsAre("1", "", ""),
+    testing::ElementsAre("1", "2", "3"),
+    testing::ElementsAre("", "", "")
+  ));
+}
+
+TEST(GTFSCsvTest, longFields) {
+  // Longer than the vectorized scan's block size.
+  const std::string long_field(100, 'x');
+  const std::string path = WriteTempFile(
+    "GTFSCsvTest_longFields.txt",
+    "a,b,c\n" + long_field + "," + long_field + "\n"
+  );
+  EXPECT_THAT(ReadAll(path), testing::ElementsAre(
+    testing::ElementsAre(long_field, long_field, "")
+  ));
+}
+
+TEST(GTFSCsvTest, missingFile) {
+  GTFSCsvReader reader;
+  EXPECT_NE(reader.Open("does/not/exist.txt"), std::nullopt);
+}
+
+TEST(GTFSCsvTest, zipMembers) {
+  // Enough rows that a deflated member is inflated in several pieces, with quoted line breaks and
+  // CRLFs that can straddle the pieces.
+  std::string contents = "a,b,c\r\n";
+  std::vector<std::vector<std::string>> expected;
+  for (int i = 0; i < 200000; ++i) {
+    const std::string quoted = i % 7 == 0 ? "line\nbreak " + std::to_string(i) : "say \"" + std::to_string(i) + "\"";
+    std::string escaped;
+    for (const char c : quoted) {
+      escaped += c == '"' ? "\"\"" : std::string(1, c);
+    }
+    contents += "T" + std::to_string(i) + ",\"" + escaped + "\"," + std::to_string(i % 13) + "\r\n";
+    expected.push_back({"T" + std::to_string(i), quoted, std::to_string(i % 13)});
+  }
+  const std::string zip = WriteTempZip("GTFSCsvTest_zipMembers.zip", {
+    {"stored.txt", "a,b,c\n1,2,3\n", false},
+    {"feed/deflated.txt", contents, true},
+  });
+
+  EXPECT_THAT(ReadAll(zip + "/stored.txt"), testing::ElementsAre(testing::ElementsAre("1", "2", "3")));
+  EXPECT_EQ(ReadAll(zip + "/deflated.txt"), expected);
+
+  EXPECT_TRUE(isGTFSArchive(zip));
+  EXPECT_TRUE(gtfsFileExists(zip + "/stored.txt"));
+  EXPECT_TRUE(gtfsFileExists(zip + "/deflated.txt"));
+  EXPECT_FALSE(gtfsFileExists(zip + "/frequencies.txt"));
+  GTFSCsvReader reader;
+  EXPECT_THAT(reader.Open(zip + "/frequencies.txt"), testing::Optional(testing::HasSubstr("frequencies.txt")));
+}
+
+TEST(GTFSCsvTest, parseTime) {
+  unsigned int seconds = 0;
+  EXPECT_TRUE(parseGTFSTimeSeconds("7:50:00", seconds));
+  EXPECT_EQ(seconds, 7 * 3600 + 50 * 60);
+  EXPECT_TRUE(parseGTFSTimeSeconds("25:01:02", seconds));
+  EXPECT_EQ(seconds, 25 * 3600 + 1 * 60 + 2);
+  EXPECT_TRUE(parseGTFSTimeSeconds(" 08:00:30 ", seconds));
+  EXPECT_EQ(seconds, 8 * 3600 + 30);
+
+  EXPECT_FALSE(parseGTFSTimeSeconds("", seconds));
+  EXPECT_FALSE(parseGTFSTimeSeconds("8:00", seconds));
+  EXPECT_FALSE(parseGTFSTimeSeconds("8:0:00", seconds));
+  EXPECT_FALSE(parseGTFSTimeSeconds("08-00-00", seconds));
+  EXPECT_FALSE(parseGTFSTimeSeconds("x8:00:00", seconds));
+  EXPECT_FALSE(parseGTFSTimeSeconds("1234:00:00", seconds));
+  EXPECT_FALSE(parseGTFSTimeSeconds("25:99:99", seconds));
+  EXPECT_FALSE(parseGTFSTimeSeconds("08:60:00", seconds));
+  EXPECT_FALSE(parseGTFSTimeSeconds("08:00:60", seconds));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,296 @@
+#include "GTFSRealtime.h"
+
+#include "absl/strings/str_cat.h"
+
+#include "MappedFile.h"
+
+namespace {
+
+// Protocol buffer wire types.
+constexpr uint32_t kVarint = 0;
+constexpr uint32_t kFixed64 = 1;
+constexpr uint32_t kLengthDelimited = 2;
+constexpr uint32_t kFixed32 = 5;
+
+// Reads the fields of one serialized protocol buffer message. This is all of the wire format that
+// GTFS Realtime needs, so there is no need for the protobuf library or generated code.
+class WireReader {
+public:
+  explicit WireReader(absl::string_view message) : p_(message.data()), end_(message.data() + message.size()) {}
+
+  // Reads the next field's tag. Returns false at the end of the message, and sets `error` if the
+  // tag is malformed.
+  bool Next(uint32_t& field, uint32_t& wire_type) {
+    if (p_ == end_ || error_) {
+      return false;
+    }
+    uint64_t tag;
+    if (!ReadVarint(tag) || (tag >> 3) == 0) {
+      error_ = true;
+      return false;
+    }
+    field = tag >> 3;
+    wire_type = tag & 7;
+    return true;
+  }
+
+  // Reads a field of wire type kVarint.
+  bool ReadVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p_ == end_) {
+        return Fail();
+      }
+      const uint8_t byte = static_cast<uint8_t>(*p_++);
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return Fail();
+  }
+
+  // Reads a field of wire type kLengthDelimited, without copying it.
+  bool ReadBytes(absl::string_view& bytes) {
+    uint64_t size;
+    if (!ReadVarint(size)) {
+      return false;
+    }
+    if (size > static_cast<uint64_t>(end_ - p_)) {
+      return Fail();
+    }
+    bytes = absl::string_view(p_, size);
+    p_ += size;
+    return true;
+  }
+
+  // Skips a field of wire type `wire_type`.
+  bool Skip(uint32_t wire_type) {
+    uint64_t ignored_varint;
+    absl::string_view ignored_bytes;
+    switch (wire_type) {
+      case kVarint:
+        return ReadVarint(ignored_varint);
+      case kFixed64:
+        return Advance(8);
+      case kLengthDelimited:
+        return ReadBytes(ignored_bytes);
+      case kFixed32:
+        return Advance(4);
+      default:
+        // Groups are deprecated, and GTFS Realtime does not use them.
+        return Fail();
+    }
+  }
+
+  bool error() const { return error_; }
+
+private:
+  bool Advance(size_t n) {
+    if (n > static_cast<size_t>(end_ - p_)) {
+      return Fail();
+    }
+    p_ += n;
+    return true;
+  }
+
+  bool Fail() {
+    error_ = true;
+    return false;
+  }
+
+  const char* p_;
+  const char* end_;
+  bool error_ = false;
+};
+
+// Each of these parses one message type into its struct. They return false if the message is
+// malformed. A field with an unexpected wire type is skipped, like an unknown field.
+
+bool parseStopTimeEvent(absl::string_view message, RealtimeStopTimeEvent& event) {
+  WireReader reader(message);
+  uint32_t field, wire_type;
+  while (reader.Next(field, wire_type)) {
+    uint64_t value;
+    if (field == 1 && wire_type == kVarint) {
+      if (!reader.ReadVarint(value)) {
+        return false;
+      }
+      // int32 fields are sign-extended to 64 bits on the wire.
+      event.delay = static_cast<int32_t>(value);
+    } else if (field == 2 && wire_type == kVarint) {
+      if (!reader.ReadVarint(value)) {
+        return false;
+      }
+      event.time = static_cast<int64_t>(value);
+    } else if (!reader.Skip(wire_type)) {
+      return false;
+    }
+  }
+  return !reader.error();
+}
+
+bool parseStopTimeUpdate(absl::string_view message, RealtimeStopTimeUpdate& update) {
+  WireReader reader(message);
+  uint32_t field, wire_type;
+  while (reader.Next(field, wire_type)) {
+    uint64_t value;
+    absl::string_view bytes;
+    if (field == 1 && wire_type == kVarint) {
+      if (!reader.ReadVarint(value)) {
+        return false;
+      }
+      update.stop_sequence = static_cast<uint32_t>(value);
+    } else if ((field == 2 || field == 3) && wire_type == kLengthDelimited) {
+      if (!reader.ReadBytes(bytes) ||
+          !parseStopTimeEvent(bytes, field == 2 ? update.arrival : update.departure)) {
+        return false;
+      }
+    } else if (field == 4 && wire_type == kLengthDelimited) {
+      if (!reader.ReadBytes(bytes)) {
+        return false;
+      }
+      update.stop_id = std::string(bytes);
+    } else if (field == 5 && wire_type == kVarint) {
+      if (!reader.ReadVarint(value)) {
+        return false;
+      }
+      update.schedule_relationship = static_cast<RealtimeStopTimeUpdate::Relationship>(value);
+    } else if (!reader.Skip(wire_type)) {
+      return false;
+    }
+  }
+  return !reader.error();
+}
+
+bool parseTripDescriptor(absl::string_view message, RealtimeTripUpdate& update) {
+  WireReader reader(message);
+  uint32_t field, wire_type;
+  while (reader.Next(field, wire_type)) {
+    uint64_t value;
+    absl::string_view bytes;
+    std::string* string_field = nullptr;
+    switch (field) {
+      case 1: string_field = &update.trip_id; break;
+      case 2: string_field = &update.start_time; break;
+      case 3: string_field = &update.start_date; break;
+      case 5: string_field = &update.route_id; break;
+    }
+    if (string_field != nullptr && wire_type == kLengthDelimited) {
+      if (!reader.ReadBytes(bytes)) {
+        return false;
+      }
+      *string_field = std::string(bytes);
+    } else if (field == 4 && wire_type == kVarint) {
+      if (!reader.ReadVarint(value)) {
+        return false;
+      }
+      update.schedule_relationship = static_cast<RealtimeTripUpdate::Relationship>(value);
+    } else if (!reader.Skip(wire_type)) {
+      return false;
+    }
+  }
+  return !reader.error();
+}
+
+bool parseTripUpdate(absl::string_view message, RealtimeTripUpdate& update) {
+  WireReader reader(message);
+  uint32_t field, wire_type;
+  while (reader.Next(field, wire_type)) {
+    uint64_t value;
+    absl::string_view bytes;
+    if (field == 1 && wire_type == kLengthDelimited) {
+      if (!reader.ReadBytes(bytes) || !parseTripDescriptor(bytes, update)) {
+        return false;
+      }
+    } else if (field == 2 && wire_type == kLengthDelimited) {
+      if (!reader.ReadBytes(bytes) || !parseStopTimeUpdate(bytes, update.stop_time_updates.emplace_back())) {
+        return false;
+      }
+    } else if (field == 5 && wire_type == kVarint) {
+      if (!reader.ReadVarint(value)) {
+        return false;
+      }
+      update.delay = static_cast<int32_t>(value);
+    } else if (!reader.Skip(wire_type)) {
+      return false;
+    }
+  }
+  return !reader.error();
+}
+
+// Parses a FeedEntity, setting `update` if it is a TripUpdate.
+bool parseFeedEntity(absl::string_view message, std::optional<RealtimeTripUpdate>& update) {
+  WireReader reader(message);
+  uint32_t field, wire_type;
+  bool is_deleted = false;
+  while (reader.Next(field, wire_type)) {
+    uint64_t value;
+    absl::string_view bytes;
+    if (field == 2 && wire_type == kVarint) {
+      if (!reader.ReadVarint(value)) {
+        return false;
+      }
+      is_deleted = value != 0;
+    } else if (field == 3 && wire_type == kLengthDelimited) {
+      update.emplace();
+      if (!reader.ReadBytes(bytes) || !parseTripUpdate(bytes, *update)) {
+        return false;
+      }
+    } else if (!reader.Skip(wire_type)) {
+      return false;
+    }
+  }
+  // Deleted entities only matter to incremental feeds, which say that an earlier update no longer
+  // applies. Full datasets, which is what is read here, do not have them.
+  if (is_deleted) {
+    update.reset();
+  }
+  return !reader.error();
+}
+
+}  // namespace
+
+std::optional<std::string> parseGTFSRealtimeTripUpdates(
+  absl::string_view message,
+  std::vector<RealtimeTripUpdate>& updates
+) {
+  WireReader reader(message);
+  uint32_t field, wire_type;
+  size_t entity = 0;
+  while (reader.Next(field, wire_type)) {
+    absl::string_view bytes;
+    if (field == 2 && wire_type == kLengthDelimited) {
+      std::optional<RealtimeTripUpdate> update;
+      if (!reader.ReadBytes(bytes) || !parseFeedEntity(bytes, update)) {
+        return absl::StrCat("Malformed GTFS Realtime entity ", entity);
+      }
+      if (update.has_value()) {
+        updates.push_back(std::move(*update));
+      }
+      ++entity;
+    } else if (!reader.Skip(wire_type)) {
+      break;
+    }
+  }
+  if (reader.error()) {
+    return absl::StrCat("Malformed GTFS Realtime message after entity ", entity);
+  }
+  return std::nullopt;
+}
+
+std::optional<std::string> readGTFSRealtimeTripUpdates(
+  const std::string& path,
+  std::vector<RealtimeTripUpdate>& updates
+) {
+  MappedFile file;
+  auto err = file.Open(path);
+  if (err.has_value()) {
+    return err;
+  }
+  err = parseGTFSRealtimeTripUpdates(file.contents(), updates);
+  if (err.has_value()) {
+    return absl::StrCat(path, ": ", *err);
+  }
+  return std::nullopt;
+}
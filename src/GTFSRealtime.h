@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+// The parts of GTFS Realtime TripUpdates that are needed to patch a World: delays, cancellations
+// and added trips. Vehicle positions and alerts are skipped.
+//
+// See https://gtfs.org/realtime/reference/ for what the fields mean.
+
+// A StopTimeEvent: either a delay relative to the schedule or an absolute time.
+struct RealtimeStopTimeEvent {
+  // Seconds, positive if late.
+  std::optional<int32_t> delay;
+  // POSIX time.
+  std::optional<int64_t> time;
+};
+
+struct RealtimeStopTimeUpdate {
+  enum class Relationship {
+    kScheduled = 0,
+    kSkipped = 1,
+    kNoData = 2,
+    kUnscheduled = 3,
+  };
+
+  std::optional<uint32_t> stop_sequence;
+  // Without the feed prefix.
+  std::string stop_id;
+  RealtimeStopTimeEvent arrival;
+  RealtimeStopTimeEvent departure;
+  Relationship schedule_relationship = Relationship::kScheduled;
+};
+
+struct RealtimeTripUpdate {
+  enum class Relationship {
+    kScheduled = 0,
+    kAdded = 1,
+    kUnscheduled = 2,
+    kCanceled = 3,
+    kReplacement = 5,
+    kDuplicated = 6,
+    kDeleted = 7,
+  };
+
+  // Without the feed prefix.
+  std::string trip_id;
+  std::string route_id;
+  // "HH:MM:SS" and "YYYYMMDD", or empty.
+  std::string start_time;
+  std::string start_date;
+  Relationship schedule_relationship = Relationship::kScheduled;
+  // Applies to every stop that no stop time update says otherwise about.
+  std::optional<int32_t> delay;
+  std::vector<RealtimeStopTimeUpdate> stop_time_updates;
+};
+
+// Appends the TripUpdates in the serialized FeedMessage `message` to `updates`. Entities that are
+// not TripUpdates, and fields that are not in the structs above, are skipped.
+//
+// Returns an error message if the message is malformed, otherwise returns nullopt.
+std::optional<std::string> parseGTFSRealtimeTripUpdates(
+  absl::string_view message,
+  std::vector<RealtimeTripUpdate>& updates
+);
+
+// Like `parseGTFSRealtimeTripUpdates`, with the FeedMessage in the file at `path`.
+std::optional<std::string> readGTFSRealtimeTripUpdates(
+  const std::string& path,
+  std::vector<RealtimeTripUpdate>& updates
+);
@@ -0,0 +1,91 @@
+#include <cstdint>
+#include <string>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "GTFSRealtime.h"
+
+// Just enough of a protocol buffer encoder to write test messages.
+static std::string varint(uint64_t value) {
+  std::string result;
+  while (value >= 0x80) {
+    result.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  result.push_back(static_cast<char>(value));
+  return result;
+}
+
+static std::string varintField(uint32_t field, uint64_t value) {
+  return varint(field << 3) + varint(value);
+}
+
+static std::string bytesField(uint32_t field, const std::string& bytes) {
+  return varint((field << 3) | 2) + varint(bytes.size()) + bytes;
+}
+
+TEST(GTFSRealtimeTest, tripUpdates) {
+  const std::string delayed_trip = bytesField(3,
+    bytesField(1, bytesField(1, "101") + bytesField(3, "20240607")) +
+    bytesField(2,
+      varintField(1, 2) + bytesField(4, "70261") +
+      bytesField(2, varintField(1, static_cast<uint64_t>(int64_t{-30}))) +
+      bytesField(3, varintField(2, 1717765200))
+    ) +
+    bytesField(2, bytesField(4, "70241") + varintField(5, 1)) +
+    varintField(5, 120)
+  );
+  const std::string canceled_trip = bytesField(3, bytesField(1, bytesField(1, "103") + varintField(4, 3)));
+  // Vehicle positions are skipped, and so is the header, which has a fixed64 just to exercise
+  // skipping it.
+  const std::string header = bytesField(1, bytesField(1, "2.0") + varint((3 << 3) | 1) + std::string(8, '\0'));
+  const std::string vehicle = bytesField(4, bytesField(1, bytesField(1, "105")));
+  const std::string message =
+    header +
+    bytesField(2, bytesField(1, "a") + delayed_trip) +
+    bytesField(2, bytesField(1, "b") + vehicle) +
+    bytesField(2, bytesField(1, "c") + canceled_trip);
+
+  std::vector<RealtimeTripUpdate> updates;
+  ASSERT_EQ(parseGTFSRealtimeTripUpdates(message, updates), std::nullopt);
+  ASSERT_EQ(updates.size(), 2);
+
+  EXPECT_EQ(updates[0].trip_id, "101");
+  EXPECT_EQ(updates[0].start_date, "20240607");
+  EXPECT_EQ(updates[0].schedule_relationship, RealtimeTripUpdate::Relationship::kScheduled);
+  EXPECT_EQ(updates[0].delay, 120);
+  ASSERT_EQ(updates[0].stop_time_updates.size(), 2);
+  EXPECT_EQ(updates[0].stop_time_updates[0].stop_sequence, 2);
+  EXPECT_EQ(updates[0].stop_time_updates[0].stop_id, "70261");
+  EXPECT_EQ(updates[0].stop_time_updates[0].arrival.delay, -30);
+  EXPECT_EQ(updates[0].stop_time_updates[0].departure.time, 1717765200);
+  EXPECT_EQ(updates[0].stop_time_updates[1].stop_id, "70241");
+  EXPECT_EQ(
+    updates[0].stop_time_updates[1].schedule_relationship,
+    RealtimeStopTimeUpdate::Relationship::kSkipped
+  );
+
+  EXPECT_EQ(updates[1].trip_id, "103");
+  EXPECT_EQ(updates[1].schedule_relationship, RealtimeTripUpdate::Relationship::kCanceled);
+}
+
+TEST(GTFSRealtimeTest, malformedMessages) {
+  const std::string entity = bytesField(2, bytesField(3, bytesField(1, bytesField(1, "101"))));
+  for (const std::string& message : {
+    // Truncated in the middle of the entity.
+    entity.substr(0, entity.size() - 2),
+    // A varint that never ends.
+    std::string(11, '\xff'),
+    // A group, which GTFS Realtime never uses.
+    varint((1 << 3) | 3),
+  }) {
+    std::vector<RealtimeTripUpdate> updates;
+    EXPECT_NE(parseGTFSRealtimeTripUpdates(message, updates), std::nullopt);
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
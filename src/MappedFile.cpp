@@ -0,0 +1,67 @@
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "absl/strings/str_cat.h"
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+  : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) {
+  if (this != &other) {
+    Close();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+std::optional<std::string> MappedFile::Open(const std::string& path) {
+  Close();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::StrCat("Could not open ", path, ": ", std::strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    std::string err = absl::StrCat("Could not stat ", path, ": ", std::strerror(errno));
+    close(fd);
+    return err;
+  }
+
+  // mmap refuses zero-length mappings, and an empty file is just an empty view anyway.
+  if (st.st_size > 0) {
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      std::string err = absl::StrCat("Could not mmap ", path, ": ", std::strerror(errno));
+      close(fd);
+      return err;
+    }
+    data_ = static_cast<const char*>(mapped);
+    size_ = st.st_size;
+  }
+
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  return std::nullopt;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other);
+  MappedFile& operator=(MappedFile&& other);
+
+  // Maps the file at `path`, replacing any previous mapping.
+  //
+  // Returns an error message if something went wrong, otherwise returns nullopt.
+  std::optional<std::string> Open(const std::string& path);
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  absl::string_view contents() const { return absl::string_view(data_, size_); }
+
+private:
+  void Close();
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Calls `f(i)` for every i in [0, n), spread over a thread per core, or over at most `max_threads`
+// threads (counting the calling thread) if it is not 0. Tasks are handed out in order, one at a
+// time, so a few big tasks do not leave the other threads idle.
+template <typename F>
+void ParallelFor(size_t n, F f, unsigned int max_threads = 0) {
+  std::atomic<size_t> next = 0;
+  auto work = [&]() {
+    for (size_t i = next++; i < n; i = next++) {
+      f(i);
+    }
+  };
+  if (max_threads == 0) {
+    max_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const size_t num_threads = std::min<size_t>(n, max_threads);
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+// Sorts `v` like std::stable_sort: each core sorts a slice, and then the slices are merged
+// pairwise, with the merges of each round running in parallel. Uses at most `max_threads` threads
+// if it is not 0, like ParallelFor.
+template <typename T, typename Comp>
+void ParallelStableSort(std::vector<T>& v, Comp comp, unsigned int max_threads = 0) {
+  // Below this many elements per slice, threads cost more than they save.
+  constexpr size_t kMinSlice = 1 << 14;
+  if (max_threads == 0) {
+    max_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const size_t num_slices = std::min<size_t>(max_threads, v.size() / kMinSlice);
+  if (num_slices <= 1) {
+    std::stable_sort(v.begin(), v.end(), comp);
+    return;
+  }
+  std::vector<size_t> bounds(num_slices + 1);
+  for (size_t i = 0; i <= num_slices; ++i) {
+    bounds[i] = v.size() * i / num_slices;
+  }
+  ParallelFor(num_slices, [&](size_t i) {
+    std::stable_sort(v.begin() + bounds[i], v.begin() + bounds[i + 1], comp);
+  }, max_threads);
+  for (size_t width = 1; width < num_slices; width *= 2) {
+    ParallelFor((num_slices + 2 * width - 1) / (2 * width), [&](size_t pair) {
+      const size_t first = pair * 2 * width;
+      const size_t middle = std::min(first + width, num_slices);
+      const size_t last = std::min(first + 2 * width, num_slices);
+      std::inplace_merge(v.begin() + bounds[first], v.begin() + bounds[middle], v.begin() + bounds[last], comp);
+    }, max_threads);
+  }
+}
+
+// A queue for handing work from producers to consumers on other threads. `Push` blocks while the
+// queue is full, so that producers cannot get more than `capacity` items ahead of the consumers.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+
+  void Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this]() { return items_.size() < capacity_; });
+    items_.push_back(std::move(item));
+    lock.unlock();
+    not_empty_.notify_one();
+  }
+
+  // Waits for an item and removes it. Returns nullopt once the queue is closed and empty.
+  std::optional<T> Pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return !items_.empty() || closed_; });
+    if (items_.empty()) {
+      return std::nullopt;
+    }
+    T item = std::move(items_.front());
+    items_.pop_front();
+    lock.unlock();
+    not_full_.notify_one();
+    return item;
+  }
+
+  // Says that there will be no more pushes, so that consumers stop once the queue is empty.
+  void Close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    not_empty_.notify_all();
+  }
+
+private:
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> items_;
+  bool closed_ = false;
+};
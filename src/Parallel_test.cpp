@@ -0,0 +1,73 @@
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "Parallel.h"
+
+TEST(ParallelTest, forVisitsEveryTaskOnce) {
+  std::vector<int> visits(10000);
+  ParallelFor(visits.size(), [&visits](size_t i) { visits[i] += 1; });
+  EXPECT_THAT(visits, testing::Each(1));
+}
+
+TEST(ParallelTest, forUsesAtMostMaxThreads) {
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  ParallelFor(1000, [&](size_t) {
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.insert(std::this_thread::get_id());
+  }, 2);
+  EXPECT_LE(threads.size(), 2);
+  EXPECT_TRUE(threads.contains(std::this_thread::get_id()));
+}
+
+TEST(ParallelTest, stableSortMatchesStdStableSort) {
+  // Big enough to be split into slices, with lots of ties so that stability matters.
+  std::mt19937 rng(1);
+  for (size_t size : {0, 1, 1000, 100000, 333333}) {
+    std::vector<std::pair<int, size_t>> v;
+    for (size_t i = 0; i < size; ++i) {
+      v.emplace_back(rng() % 1000, i);
+    }
+    auto by_first = [](const std::pair<int, size_t>& a, const std::pair<int, size_t>& b) {
+      return a.first < b.first;
+    };
+    std::vector<std::pair<int, size_t>> expected = v;
+    std::stable_sort(expected.begin(), expected.end(), by_first);
+    for (const unsigned int max_threads : {0u, 1u, 3u}) {
+      std::vector<std::pair<int, size_t>> sorted = v;
+      ParallelStableSort(sorted, by_first, max_threads);
+      EXPECT_EQ(sorted, expected) << size << " " << max_threads;
+    }
+  }
+}
+
+TEST(ParallelTest, boundedQueueDeliversEveryItemOnce) {
+  BoundedQueue<int> queue(4);
+  std::vector<int> popped(10000);
+  std::vector<std::thread> consumers;
+  for (int i = 0; i < 3; ++i) {
+    consumers.emplace_back([&queue, &popped]() {
+      while (std::optional<int> item = queue.Pop()) {
+        popped[*item] += 1;
+      }
+    });
+  }
+  for (size_t i = 0; i < popped.size(); ++i) {
+    queue.Push(i);
+  }
+  queue.Close();
+  for (std::thread& consumer : consumers) {
+    consumer.join();
+  }
+  EXPECT_THAT(popped, testing::Each(1));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
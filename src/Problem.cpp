@@ -1,5 +1,7 @@
 #include "Problem.h"
 
+#include "absl/container/flat_hash_set.h"
+
 size_t GetOrAddStop(const std::string& stop_id, Problem& problem) {
   if (problem.stop_id_to_index.contains(stop_id)) {
     return problem.stop_id_to_index.at(stop_id);
@@ -35,41 +37,238 @@ Edge* GetOrAddEdge(
   return &problem.edges[origin_stop_index].back();
 }
 
-Problem BuildProblem(const World& world) {
-  Problem problem;
+TripPathIndex TripPaths::GetOrAdd(std::span<const uint32_t> path) {
+  if (indices_.size() < size()) {
+    for (TripPathIndex p = indices_.size(); p < size(); ++p) {
+      const std::span<const uint32_t> existing = Get(p);
+      indices_.try_emplace(std::vector<uint32_t>(existing.begin(), existing.end()), p);
+    }
+  }
+  auto it = indices_.find(path);
+  if (it != indices_.end()) {
+    return it->second;
+  }
+  const TripPathIndex index = size();
+  indices_.emplace(std::vector<uint32_t>(path.begin(), path.end()), index);
+  trips.insert(trips.end(), path.begin(), path.end());
+  offsets.push_back(trips.size());
+  return index;
+}
 
-  // Reserve trip_id = 0 for anytime connections.
-  GetOrAddTrip("anytime", problem);
-
-  for (const auto& world_segment : world.segments) {
-    size_t origin_stop_index = GetOrAddStop(world_segment.origin_stop_id, problem);
-    size_t destination_stop_index = GetOrAddStop(world_segment.destination_stop_id, problem);
-    Edge* edge = GetOrAddEdge(origin_stop_index, destination_stop_index, problem);
-    size_t trip_index = GetOrAddTrip(world_segment.trip_id, problem);
-    edge->schedule.segments.push_back({
-      .departure_time = world_segment.departure_time,
-      .arrival_time = WorldTime(world_segment.departure_time.seconds + world_segment.duration.seconds),
-      .trip_indices = {trip_index},
-      .departure_trip_index = trip_index,
-      .arrival_trip_index = trip_index,
+ProblemGraph BuildProblemGraph(const Problem& problem) {
+  ProblemGraph graph;
+  const size_t num_stops = problem.edges.size();
+  graph.offsets.reserve(num_stops + 1);
+  std::vector<size_t> num_incoming(num_stops, 0);
+  std::vector<const Edge*> sorted_edges;
+  for (size_t origin = 0; origin < num_stops; ++origin) {
+    sorted_edges.clear();
+    for (const Edge& edge : problem.edges[origin]) {
+      sorted_edges.push_back(&edge);
+    }
+    std::sort(sorted_edges.begin(), sorted_edges.end(), [](const Edge* a, const Edge* b) {
+      return a->destination_stop_index < b->destination_stop_index;
     });
+    for (const Edge* edge : sorted_edges) {
+      graph.destinations.push_back(edge->destination_stop_index);
+      graph.schedules.push_back(edge->schedule);
+      num_incoming[edge->destination_stop_index] += 1;
+    }
+    graph.offsets.push_back(graph.destinations.size());
+  }
+
+  // Visiting the edges in order of origin fills in each destination's incoming edges sorted by
+  // origin.
+  graph.reverse_offsets.reserve(num_stops + 1);
+  for (size_t destination = 0; destination < num_stops; ++destination) {
+    graph.reverse_offsets.push_back(graph.reverse_offsets.back() + num_incoming[destination]);
+  }
+  graph.reverse_origins.resize(graph.destinations.size());
+  graph.reverse_edges.resize(graph.destinations.size());
+  std::vector<size_t> next(graph.reverse_offsets.begin(), graph.reverse_offsets.end() - 1);
+  for (size_t origin = 0; origin < num_stops; ++origin) {
+    for (size_t e = graph.offsets[origin]; e < graph.offsets[origin + 1]; ++e) {
+      const size_t i = next[graph.destinations[e]]++;
+      graph.reverse_origins[i] = origin;
+      graph.reverse_edges[i] = e;
+    }
+  }
+  return graph;
+}
+
+// Marks world indices that have no problem index yet.
+constexpr size_t kUnmapped = std::numeric_limits<size_t>::max();
+
+ProblemBuilder::ProblemBuilder(const World& world)
+  : world_(world),
+    stop_indices_(world.stops.size(), kUnmapped),
+    trip_indices_(world.trips.size(), kUnmapped) {
+  // Reserve trip_id = 0 for anytime connections.
+  GetOrAddTrip("anytime", problem_);
+}
+
+size_t ProblemBuilder::ProblemStop(WorldStopIndex stop) {
+  if (stop_indices_[stop] == kUnmapped) {
+    stop_indices_[stop] = GetOrAddStop(world_.stops.ids.Get(stop), problem_);
+  }
+  return stop_indices_[stop];
+}
+
+size_t ProblemBuilder::ProblemTrip(WorldTripIndex trip) {
+  if (trip_indices_[trip] == kUnmapped) {
+    trip_indices_[trip] = GetOrAddTrip(world_.trips.ids.Get(trip), problem_);
+  }
+  return trip_indices_[trip];
+}
+
+size_t ProblemBuilder::ProblemRun(const WorldTripRun& run) {
+  if (world_.trips.frequencies[run.trip].empty()) {
+    return ProblemTrip(run.trip);
+  }
+  auto [it, inserted] = run_indices_.try_emplace(std::make_pair(run.trip, run.start.seconds), kUnmapped);
+  if (inserted) {
+    it->second = GetOrAddTrip(absl::StrCat(world_.trips.ids.Get(run.trip), "@", run.start.seconds), problem_);
   }
+  return it->second;
+}
+
+void ProblemBuilder::AddSegment(const WorldSegment& world_segment, const WorldTripRun& run) {
+  size_t origin_stop_index = ProblemStop(world_segment.origin_stop);
+  size_t destination_stop_index = ProblemStop(world_segment.destination_stop);
+  Edge* edge = GetOrAddEdge(origin_stop_index, destination_stop_index, problem_);
+  const uint32_t trip_index = ProblemRun(run);
+  edge->schedule.segments.push_back({
+    .departure_time = world_segment.departure_time,
+    .arrival_time = WorldTime(world_segment.departure_time.seconds + world_segment.duration.seconds),
+    .departure_trip_index = trip_index,
+    .arrival_trip_index = trip_index,
+  });
+}
 
-  for (const auto& anytime_connection : world.anytime_connections) {
-    size_t origin_stop_index = GetOrAddStop(anytime_connection.origin_stop_id, problem);
-    size_t destination_stop_index = GetOrAddStop(anytime_connection.destination_stop_id, problem);
-    Edge* edge = GetOrAddEdge(origin_stop_index, destination_stop_index, problem);
+Problem ProblemBuilder::Finish() {
+  for (const auto& anytime_connection : world_.anytime_connections) {
+    size_t origin_stop_index = ProblemStop(anytime_connection.origin_stop);
+    size_t destination_stop_index = ProblemStop(anytime_connection.destination_stop);
+    Edge* edge = GetOrAddEdge(origin_stop_index, destination_stop_index, problem_);
     edge->schedule.anytime_duration = anytime_connection.duration;
   }
 
-  for (size_t i = 0; i < problem.edges.size(); ++i) {
-    for (size_t j = 0; j < problem.edges[i].size(); ++j) {
-      auto& segs = problem.edges[i][j].schedule.segments;
+  for (size_t i = 0; i < problem_.edges.size(); ++i) {
+    for (size_t j = 0; j < problem_.edges[i].size(); ++j) {
+      auto& segs = problem_.edges[i][j].schedule.segments;
       std::sort(segs.begin(), segs.end(), [](const Segment& a, const Segment& b) { return a.departure_time.seconds < b.departure_time.seconds; });
     }
   }
 
-  return problem;
+  return std::move(problem_);
+}
+
+Problem BuildProblem(const World& world) {
+  ProblemBuilder builder(world);
+  ForEachSegment(world, [&builder](const WorldSegment& segment, const WorldTripRun& run) {
+    builder.AddSegment(segment, run);
+  });
+  return builder.Finish();
+}
+
+Problem BuildProblemForDate(const World& world, absl::CivilDay date) {
+  ProblemBuilder builder(world);
+  StreamSegments(date, world, [&builder](const WorldSegment& segment, const WorldTripRun& run) {
+    builder.AddSegment(segment, run);
+  });
+  return builder.Finish();
+}
+
+// Moves `segment` back a whole number of periods, so that it departs before kSchedulePeriodSeconds.
+static void wrapToPeriod(Segment& segment) {
+  const unsigned int shift = segment.departure_time.seconds / kSchedulePeriodSeconds * kSchedulePeriodSeconds;
+  segment.departure_time.seconds -= shift;
+  segment.arrival_time.seconds -= shift;
+}
+
+// The edge from `origin_stop_index` to `destination_stop_index`, or nullptr if there is none.
+static Edge* findEdge(size_t origin_stop_index, size_t destination_stop_index, Problem& problem) {
+  for (Edge& edge : problem.edges[origin_stop_index]) {
+    if (edge.destination_stop_index == destination_stop_index) {
+      return &edge;
+    }
+  }
+  return nullptr;
+}
+
+// Erases the edge from `origin_stop_index` to `destination_stop_index`, and its adjacency.
+static void eraseEdge(size_t origin_stop_index, size_t destination_stop_index, Problem& problem) {
+  std::erase_if(problem.edges[origin_stop_index], [destination_stop_index](const Edge& edge) {
+    return edge.destination_stop_index == destination_stop_index;
+  });
+  std::erase(problem.adjacency_list.edges[origin_stop_index], destination_stop_index);
+}
+
+void ApplyTripChanges(const World& world, const std::vector<WorldTripChange>& changes, Problem& problem) {
+  // Edges are found again by their stops at the end, because adding and erasing edges moves them.
+  absl::flat_hash_set<std::pair<size_t, size_t>> touched_edges;
+  for (const WorldTripChange& change : changes) {
+    // The old segments can only be on edges that the problem already has, so those are looked up
+    // without adding anything.
+    auto old_trip = problem.trip_id_to_index.find(world.trips.ids.Get(change.trip));
+    if (old_trip != problem.trip_id_to_index.end()) {
+      const size_t old_trip_index = old_trip->second;
+      for (const WorldSegment& segment : change.old_segments) {
+        auto origin = problem.stop_id_to_index.find(world.stops.ids.Get(segment.origin_stop));
+        auto destination = problem.stop_id_to_index.find(world.stops.ids.Get(segment.destination_stop));
+        if (origin == problem.stop_id_to_index.end() || destination == problem.stop_id_to_index.end()) {
+          continue;
+        }
+        Edge* edge = findEdge(origin->second, destination->second, problem);
+        if (edge == nullptr) {
+          continue;
+        }
+        std::erase_if(edge->schedule.segments, [old_trip_index](const Segment& seg) {
+          return seg.departure_trip_index == old_trip_index;
+        });
+        touched_edges.insert({origin->second, destination->second});
+      }
+    }
+
+    const uint32_t trip_index = GetOrAddTrip(world.trips.ids.Get(change.trip), problem);
+    for (const WorldSegment& segment : change.new_segments) {
+      size_t origin_stop_index = GetOrAddStop(world.stops.ids.Get(segment.origin_stop), problem);
+      size_t destination_stop_index = GetOrAddStop(world.stops.ids.Get(segment.destination_stop), problem);
+      Segment seg{
+        .departure_time = segment.departure_time,
+        .arrival_time = WorldTime(segment.departure_time.seconds + segment.duration.seconds),
+        .departure_trip_index = trip_index,
+        .arrival_trip_index = trip_index,
+      };
+      if (problem.periodic) {
+        wrapToPeriod(seg);
+      }
+      GetOrAddEdge(origin_stop_index, destination_stop_index, problem)->schedule.segments.push_back(seg);
+      touched_edges.insert({origin_stop_index, destination_stop_index});
+    }
+  }
+
+  for (const auto& [origin_stop_index, destination_stop_index] : touched_edges) {
+    Schedule& schedule = findEdge(origin_stop_index, destination_stop_index, problem)->schedule;
+    if (schedule.segments.empty() && !schedule.anytime_duration.has_value()) {
+      // Like a problem built without the removed segments, which would not have this edge at all.
+      eraseEdge(origin_stop_index, destination_stop_index, problem);
+      continue;
+    }
+    std::stable_sort(schedule.segments.begin(), schedule.segments.end(), SegmentComp);
+  }
+}
+
+void MakePeriodic(Problem& problem) {
+  for (std::vector<Edge>& edges : problem.edges) {
+    for (Edge& edge : edges) {
+      for (Segment& segment : edge.schedule.segments) {
+        wrapToPeriod(segment);
+      }
+      std::stable_sort(edge.schedule.segments.begin(), edge.schedule.segments.end(), SegmentComp);
+    }
+  }
+  problem.periodic = true;
 }
 
 static void GetMinimalConnectingSegments(
@@ -108,7 +307,6 @@ static void GetMinimalConnectingSegments(
       result.push_back({
         a[a_index].departure_time,
         b[b_index].arrival_time,
-        {},
         a[a_index].departure_trip_index,
         b[b_index].arrival_trip_index
       });
@@ -117,7 +315,48 @@ static void GetMinimalConnectingSegments(
   }
 }
 
-void EraseNonMinimal(Schedule& schedule) {
+// Like `GetMinimalConnectingSegments`, but with `b` repeating every kSchedulePeriodSeconds. For
+// each segment of `a`, finds the first departure of `b` that it connects to, on whatever day that
+// is. Does not leave out segments that are not minimal.
+static void GetMinimalConnectingSegmentsPeriodic(
+  const std::vector<Segment>& a,
+  const std::vector<Segment>& b,
+  const unsigned int min_transfer_seconds,
+  std::vector<Segment>& result
+) {
+  if (b.empty()) {
+    return;
+  }
+  for (const Segment& a_seg : a) {
+    const unsigned int arrival = a_seg.arrival_time.seconds;
+    unsigned int offset = arrival / kSchedulePeriodSeconds * kSchedulePeriodSeconds;
+    size_t b_index = std::partition_point(b.begin(), b.end(), [arrival, offset](const Segment& seg) {
+      return seg.departure_time.seconds + offset < arrival;
+    }) - b.begin();
+    // Staying on the same trip needs no transfer time. A trip's other days' runs are different
+    // vehicles, but they are a whole day away.
+    while (true) {
+      if (b_index == b.size()) {
+        b_index = 0;
+        offset += kSchedulePeriodSeconds;
+      }
+      const Segment& b_seg = b[b_index];
+      if (b_seg.departure_time.seconds + offset >= arrival + min_transfer_seconds ||
+          b_seg.departure_trip_index == a_seg.arrival_trip_index) {
+        break;
+      }
+      ++b_index;
+    }
+    result.push_back({
+      a_seg.departure_time,
+      WorldTime(b[b_index].arrival_time.seconds + offset),
+      a_seg.departure_trip_index,
+      b[b_index].arrival_trip_index
+    });
+  }
+}
+
+void EraseNonMinimal(Schedule& schedule, bool periodic) {
   // Conjecture:
   // If I iterate through backwards, keep track of the earliest arrival time so far, and delete
   // anything later than that, then I'll have the minimal segments.
@@ -132,22 +371,32 @@ void EraseNonMinimal(Schedule& schedule) {
   // timewise non-minimal segment that leaves you on the same trip. So maybe I should relax the
   // minimality to be > min connection time. This seems complicated but doable.
   unsigned int best_arrival = std::numeric_limits<unsigned int>::max();
-  unsigned int anytime_duration = schedule.anytime_duration_or_big().seconds;
-  for (size_t i = schedule.segments.size(); i > 0; --i) {
-    Segment& seg = schedule.segments[i - 1];
-    if (
-      seg.arrival_time.seconds >= best_arrival ||
-      seg.arrival_time.seconds - seg.departure_time.seconds >= anytime_duration
-    ) {
-      // Mark for deletion.
-      seg.arrival_time.seconds = std::numeric_limits<unsigned int>::max();
-    } else {
-      best_arrival = seg.arrival_time.seconds;
+  if (periodic && !schedule.segments.empty()) {
+    // After the last departure come the next day's, the best of which is the earliest arrival.
+    unsigned int earliest_arrival = std::numeric_limits<unsigned int>::max();
+    for (const Segment& seg : schedule.segments) {
+      earliest_arrival = std::min(earliest_arrival, seg.arrival_time.seconds);
     }
+    best_arrival = earliest_arrival + kSchedulePeriodSeconds;
   }
-  std::erase_if(schedule.segments, [](const Segment& seg) {
-    return seg.arrival_time.seconds == std::numeric_limits<unsigned int>::max();
-  });
+  const unsigned int anytime_duration = schedule.anytime_duration_or_big().seconds;
+  // Kept segments are compacted towards the back as they are found, in one pass without branches
+  // on the data: every segment is written to the next free slot, which only stays taken if the
+  // segment is kept.
+  std::vector<Segment>& segments = schedule.segments;
+  const size_t n = segments.size();
+  size_t kept_begin = n;
+  for (size_t i = n; i > 0; --i) {
+    const Segment seg = segments[i - 1];
+    const bool keep =
+      (seg.arrival_time.seconds < best_arrival) &
+      (seg.arrival_time.seconds - seg.departure_time.seconds < anytime_duration);
+    segments[kept_begin - 1] = seg;
+    kept_begin -= keep;
+    best_arrival = keep ? seg.arrival_time.seconds : best_arrival;
+  }
+  std::copy(segments.begin() + kept_begin, segments.end(), segments.begin());
+  segments.resize(n - kept_begin);
   // Intentionally not removing the anytime_duration because in practice there's probably always
   // gonna be some time outside of service hours where it is the best.
 }
@@ -159,79 +408,136 @@ bool SegmentComp(const Segment& a, const Segment& b) {
   );
 }
 
-Schedule GetMinimalConnectingSchedule(
+// Merges the sorted runs `[begin, mid1)`, `[mid1, mid2)` and `[mid2, end)` into `out`, keeping equal
+// segments in the order of the runs, like two stable merges would.
+static void mergeThreeRuns(
+  const Segment* begin, const Segment* mid1, const Segment* mid2, const Segment* end, Segment* out
+) {
+  const Segment* p1 = begin;
+  const Segment* p2 = mid1;
+  const Segment* p3 = mid2;
+  while (p1 != mid1 && p2 != mid2 && p3 != end) {
+    if (SegmentComp(*p2, *p1)) {
+      if (SegmentComp(*p3, *p2)) {
+        *out++ = *p3++;
+      } else {
+        *out++ = *p2++;
+      }
+    } else if (SegmentComp(*p3, *p1)) {
+      *out++ = *p3++;
+    } else {
+      *out++ = *p1++;
+    }
+  }
+  // At most two runs are left.
+  auto merge_two = [&out](const Segment* a, const Segment* a_end, const Segment* b, const Segment* b_end) {
+    out = std::merge(a, a_end, b, b_end, out, SegmentComp);
+  };
+  if (p1 == mid1) {
+    merge_two(p2, mid2, p3, end);
+  } else if (p2 == mid2) {
+    merge_two(p1, mid1, p3, end);
+  } else {
+    merge_two(p1, mid1, p2, mid2);
+  }
+}
+
+void GetMinimalConnectingSchedule(
   const Schedule& a,
   const Schedule& b,
-  const unsigned int min_transfer_seconds
+  const unsigned int min_transfer_seconds,
+  bool periodic,
+  std::vector<Segment>& scratch,
+  Schedule& result
 ) {
-  Schedule result;
+  result.anytime_duration = std::nullopt;
   if (a.anytime_duration.has_value() && b.anytime_duration.has_value()) {
     result.anytime_duration = WorldDuration(a.anytime_duration->seconds + b.anytime_duration->seconds);
   }
 
-  // TODO: Think harder about the reservation size, maybe I can remove the 5 fudge factor.
-  result.segments.reserve(
-    (a.anytime_duration.has_value() ? b.segments.size() : 0) +
-    (b.anytime_duration.has_value() ? a.segments.size() : 0) +
-    std::min(a.segments.size(), b.segments.size()) +
-    5
-  );
+  // The result is made of three runs, each sorted, which are put together in `scratch` and then
+  // merged into `result`.
+  std::vector<Segment>& parts = periodic ? result.segments : scratch;
+  parts.clear();
 
+  // Taking `a` anytime, and then a segment of `b`.
   if (a.anytime_duration.has_value()) {
     for (const Segment& segment : b.segments) {
-      result.segments.push_back(Segment{
-        .departure_time = WorldTime(segment.departure_time.seconds - a.anytime_duration->seconds),
-        .departure_trip_index = 0
+      // In a periodic schedule, leaving before midnight for an early departure of `b` is leaving
+      // the day before.
+      const unsigned int day_before =
+        periodic && segment.departure_time.seconds < a.anytime_duration->seconds ? kSchedulePeriodSeconds : 0;
+      parts.push_back(Segment{
+        .departure_time = WorldTime(segment.departure_time.seconds + day_before - a.anytime_duration->seconds),
+        .arrival_time = WorldTime(segment.arrival_time.seconds + day_before),
+        .departure_trip_index = 0,
+        .arrival_trip_index = segment.arrival_trip_index,
       });
     }
   }
-  const size_t merge_part_1 = result.segments.size();
+  const size_t merge_part_1 = parts.size();
 
+  // Taking a segment of `a`, and then `b` anytime.
   if (b.anytime_duration.has_value()) {
     for (const Segment& segment : a.segments) {
-      result.segments.push_back(Segment{
-        .departure_time = WorldTime(segment.departure_time.seconds - b.anytime_duration->seconds),
-        .departure_trip_index = 0
+      parts.push_back(Segment{
+        .departure_time = segment.departure_time,
+        .arrival_time = WorldTime(segment.arrival_time.seconds + b.anytime_duration->seconds),
+        .departure_trip_index = segment.departure_trip_index,
+        .arrival_trip_index = 0,
       });
     }
   }
-  const size_t merge_part_2 = result.segments.size();
-
-  GetMinimalConnectingSegments(a.segments, b.segments, min_transfer_seconds, result.segments);
+  const size_t merge_part_2 = parts.size();
 
-  std::inplace_merge(
-    result.segments.begin(),
-    result.segments.begin() + merge_part_1,
-    result.segments.begin() + merge_part_2,
-    SegmentComp
-  );
-  std::inplace_merge(
-    result.segments.begin(),
-    result.segments.begin() + merge_part_2,
-    result.segments.end(),
-    SegmentComp
-  );
+  if (periodic) {
+    GetMinimalConnectingSegmentsPeriodic(a.segments, b.segments, min_transfer_seconds, result.segments);
+    for (Segment& segment : result.segments) {
+      wrapToPeriod(segment);
+    }
+    // Wrapping moves the end of the first part to its start, so it is no longer sorted.
+    std::sort(result.segments.begin(), result.segments.end(), SegmentComp);
+  } else {
+    GetMinimalConnectingSegments(a.segments, b.segments, min_transfer_seconds, scratch);
+    result.segments.resize(scratch.size());
+    mergeThreeRuns(
+      scratch.data(), scratch.data() + merge_part_1, scratch.data() + merge_part_2, scratch.data() + scratch.size(),
+      result.segments.data()
+    );
+  }
 
-  EraseNonMinimal(result);
+  EraseNonMinimal(result, periodic);
+}
 
+Schedule GetMinimalConnectingSchedule(
+  const Schedule& a,
+  const Schedule& b,
+  const unsigned int min_transfer_seconds,
+  bool periodic
+) {
+  thread_local std::vector<Segment> scratch;
+  Schedule result;
+  GetMinimalConnectingSchedule(a, b, min_transfer_seconds, periodic, scratch, result);
   return result;
 }
 
-void MergeIntoSchedule(const Schedule& src, Schedule &dest) {
+void MergeIntoSchedule(const Schedule& src, Schedule &dest, bool periodic) {
   unsigned int anytime_duration = std::min(src.anytime_duration_or_big().seconds, dest.anytime_duration_or_big().seconds);
   if (anytime_duration < std::numeric_limits<unsigned int>::max()) {
     dest.anytime_duration = WorldDuration(anytime_duration);
   }
-  const size_t merge_part = dest.segments.size();
-  dest.segments.reserve(src.segments.size() + dest.segments.size());
-  for (const Segment& seg : src.segments) {
-    dest.segments.push_back(seg);
+  // Merge from the back, so that `dest`'s segments only move into space that is already free.
+  // Equal segments end up with `dest`'s first, like a stable merge.
+  std::vector<Segment>& segments = dest.segments;
+  size_t dest_left = segments.size();
+  size_t src_left = src.segments.size();
+  segments.resize(dest_left + src_left);
+  for (size_t out = segments.size(); src_left > 0; --out) {
+    if (dest_left > 0 && SegmentComp(src.segments[src_left - 1], segments[dest_left - 1])) {
+      segments[out - 1] = segments[--dest_left];
+    } else {
+      segments[out - 1] = src.segments[--src_left];
+    }
   }
-  std::inplace_merge(
-    dest.segments.begin(),
-    dest.segments.begin() + merge_part,
-    dest.segments.end(),
-    SegmentComp
-  );
-  EraseNonMinimal(dest);
+  EraseNonMinimal(dest, periodic);
 }
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/types/span.h"
 
 #include "cereal/types/optional.hpp"
 #include "cereal/types/unordered_map.hpp"
@@ -12,40 +20,95 @@
 #include "WalkFinder.h"
 #include "World.h"
 
+// Index of a path in `TripPaths`.
+using TripPathIndex = uint32_t;
+
+// Marks a segment without a recorded path.
+constexpr TripPathIndex kNoTripPath = std::numeric_limits<uint32_t>::max();
+
+// The trips that segments ride, in order, stored back to back in one arena that only grows. Paths
+// are hash-consed, so two segments ride the same trips iff they have the same path index.
+struct TripPaths {
+  // Path `p` is `trips[offsets[p]]` up to `trips[offsets[p + 1]]`.
+  std::vector<uint32_t> offsets = {0};
+  std::vector<uint32_t> trips;
+
+  size_t size() const { return offsets.size() - 1; }
+
+  // Returns the index of `path`, adding it if it is new.
+  TripPathIndex GetOrAdd(std::span<const uint32_t> path);
+
+  // The trips of `path`, which may be kNoTripPath.
+  std::span<const uint32_t> Get(TripPathIndex path) const {
+    if (path == kNoTripPath) {
+      return {};
+    }
+    return std::span<const uint32_t>(trips).subspan(offsets[path], offsets[path + 1] - offsets[path]);
+  }
+
+  template<class Archive>
+  void serialize(Archive& ar) {
+    ar(CEREAL_NVP(offsets), CEREAL_NVP(trips));
+  }
+
+private:
+  // Hashes and compares paths as spans, so that `GetOrAdd` looks paths up without copying them.
+  struct PathHash {
+    using is_transparent = void;
+    size_t operator()(std::span<const uint32_t> path) const {
+      return absl::Hash<absl::Span<const uint32_t>>()(absl::MakeConstSpan(path.data(), path.size()));
+    }
+  };
+  struct PathEq {
+    using is_transparent = void;
+    bool operator()(std::span<const uint32_t> a, std::span<const uint32_t> b) const {
+      return std::equal(a.begin(), a.end(), b.begin(), b.end());
+    }
+  };
+
+  // Paths -> indices. Not serialized, so `GetOrAdd` rebuilds it when it is missing paths.
+  absl::flat_hash_map<std::vector<uint32_t>, TripPathIndex, PathHash, PathEq> indices_;
+};
+
+// One way to travel along an edge. This is a small, trivially copyable value, so that schedules can
+// be copied and scanned in bulk; the trips in between the departure and arrival trips are in
+// `Problem::trip_paths`.
 struct Segment {
   WorldTime departure_time;
   WorldTime arrival_time;
 
-  // Might not be populated depending on how the segment was constructed.
-  // Mostly used for display purposes, because the departure and arrival trips are all you need to
-  // know for solving purposes.
-  std::vector<size_t> trip_indices;
-
   // Always populated.
-  size_t departure_trip_index;
-  size_t arrival_trip_index;
+  uint32_t departure_trip_index;
+  uint32_t arrival_trip_index;
+
+  // All the trips, in `Problem::trip_paths`. Might not be populated depending on how the segment was
+  // constructed. Mostly used for display purposes, because the departure and arrival trips are all
+  // you need to know for solving purposes.
+  TripPathIndex trip_path = kNoTripPath;
 
   template<class Archive>
   void serialize(Archive& ar) {
     ar(
       CEREAL_NVP(departure_time),
       CEREAL_NVP(arrival_time),
-      CEREAL_NVP(trip_indices),
       CEREAL_NVP(departure_trip_index),
-      CEREAL_NVP(arrival_trip_index)
+      CEREAL_NVP(arrival_trip_index),
+      CEREAL_NVP(trip_path)
     );
   }
 
-  bool operator==(const Segment& other) {
+  bool operator==(const Segment& other) const {
     return (
       departure_time == other.departure_time &&
       arrival_time == other.arrival_time &&
       departure_trip_index == other.departure_trip_index &&
       arrival_trip_index == other.arrival_trip_index &&
-      trip_indices == other.trip_indices
+      trip_path == other.trip_path
     );
   }
 };
+static_assert(std::is_trivially_copyable_v<Segment>);
+static_assert(sizeof(Segment) == 20);
 
 struct Schedule {
   std::vector<Segment> segments;
@@ -69,6 +132,9 @@ struct Schedule {
   }
 };
 
+// The schedules of a periodic Problem repeat with this period. See `Problem::periodic`.
+constexpr unsigned int kSchedulePeriodSeconds = 24 * 3600;
+
 struct Edge {
   size_t destination_stop_index;
   Schedule schedule;
@@ -92,6 +158,16 @@ struct Problem {
   // This is the projection of `edges` to just a graph on stops.
   AdjacencyList adjacency_list;
 
+  // The paths of the segments in `edges` that have them.
+  TripPaths trip_paths;
+
+  // If set, the schedules are one day of a schedule that repeats every day: a segment that departs at
+  // `t` departs again at `t + k * kSchedulePeriodSeconds` for every k, and so can be combined with
+  // segments that depart the next day, or the day after. The next days' segments are never stored;
+  // they are offset views of the same segments. Departures are all before kSchedulePeriodSeconds,
+  // but arrivals can be later. See `MakePeriodic`.
+  bool periodic = false;
+
   template<class Archive>
   void serialize(Archive& ar) {
     ar(
@@ -100,30 +176,181 @@ struct Problem {
       CEREAL_NVP(trip_id_to_index),
       CEREAL_NVP(trip_index_to_id),
       CEREAL_NVP(edges),
-      CEREAL_NVP(adjacency_list)
+      CEREAL_NVP(adjacency_list),
+      CEREAL_NVP(trip_paths),
+      CEREAL_NVP(periodic)
+    );
+  }
+};
+
+// A Problem's edges, frozen in compressed sparse row form, for searches that look edges up by their
+// stops over and over. The schedules are stored contiguously, in order of origin and then
+// destination, so that finding an edge is a binary search among its origin's edges.
+struct ProblemGraph {
+  // The edges from stop `s` are edges `offsets[s]` up to `offsets[s + 1]`, sorted by destination.
+  // Edge `e` goes to `destinations[e]` on `schedules[e]`.
+  std::vector<size_t> offsets = {0};
+  std::vector<size_t> destinations;
+  std::vector<Schedule> schedules;
+
+  // The reverse: the edges into stop `s` are `reverse_edges[reverse_offsets[s]]` up to
+  // `reverse_edges[reverse_offsets[s + 1]]`, sorted by origin, which is in `reverse_origins`.
+  std::vector<size_t> reverse_offsets = {0};
+  std::vector<size_t> reverse_origins;
+  std::vector<size_t> reverse_edges;
+
+  size_t num_stops() const { return offsets.size() - 1; }
+
+  std::span<const size_t> Destinations(size_t origin) const {
+    return std::span<const size_t>(destinations).subspan(offsets[origin], offsets[origin + 1] - offsets[origin]);
+  }
+  std::span<const Schedule> Schedules(size_t origin) const {
+    return std::span<const Schedule>(schedules).subspan(offsets[origin], offsets[origin + 1] - offsets[origin]);
+  }
+
+  // The origins of the edges into `destination`, and the edges themselves, in the same order.
+  std::span<const size_t> Origins(size_t destination) const {
+    return std::span<const size_t>(reverse_origins).subspan(
+      reverse_offsets[destination], reverse_offsets[destination + 1] - reverse_offsets[destination]
+    );
+  }
+  std::span<const size_t> IncomingEdges(size_t destination) const {
+    return std::span<const size_t>(reverse_edges).subspan(
+      reverse_offsets[destination], reverse_offsets[destination + 1] - reverse_offsets[destination]
     );
   }
+
+  // The schedule from `origin` to `destination`, or nullptr if there is no edge between them.
+  const Schedule* Find(size_t origin, size_t destination) const {
+    const std::span<const size_t> candidates = Destinations(origin);
+    auto it = std::lower_bound(candidates.begin(), candidates.end(), destination);
+    if (it == candidates.end() || *it != destination) {
+      return nullptr;
+    }
+    return &schedules[offsets[origin] + (it - candidates.begin())];
+  }
 };
 
+// Freezes the edges of `problem`, which can be dropped or changed afterwards.
+ProblemGraph BuildProblemGraph(const Problem& problem);
+
 size_t GetOrAddStop(const std::string& stop_id, Problem& problem);
 size_t GetOrAddTrip(const std::string& trip_id, Problem& problem);
 Edge* GetOrAddEdge(size_t origin_stop_index, size_t destination_stop_index, Problem& problem);
 
+// Builds a Problem one segment at a time, so that the segments do not need to be kept anywhere
+// else first. `world` supplies the ids and the anytime connections, and must outlive the builder.
+class ProblemBuilder {
+public:
+  explicit ProblemBuilder(const World& world);
+
+  // Adds `segment`, made by `run`, to the schedule of its edge.
+  void AddSegment(const WorldSegment& segment, const WorldTripRun& run);
+
+  // Adds the anytime connections, sorts the schedules and returns the problem. Call this once,
+  // after all the segments have been added.
+  Problem Finish();
+
+private:
+  size_t ProblemStop(WorldStopIndex stop);
+  size_t ProblemTrip(WorldTripIndex trip);
+  size_t ProblemRun(const WorldTripRun& run);
+
+  const World& world_;
+  Problem problem_;
+  // World indices -> problem indices. The world's ids are already interned, so each id only needs
+  // to be looked up by string the first time it shows up.
+  std::vector<size_t> stop_indices_;
+  std::vector<size_t> trip_indices_;
+  // Each run of a frequency-based trip is a separate problem trip, because the runs are different
+  // vehicles.
+  absl::flat_hash_map<std::pair<WorldTripIndex, unsigned int>, size_t> run_indices_;
+};
+
+// Builds the problem for the segments in `world.segments` and `world.repeating_segments`.
 Problem BuildProblem(const World& world);
 
+// Builds the problem for `date` straight from the trips in `world`, streaming their segments into
+// a ProblemBuilder instead of going through `world.segments`, which is ignored. This way the
+// segments are only ever held once, in the problem.
+Problem BuildProblemForDate(const World& world, absl::CivilDay date);
+
+// Patches `problem`, which was built from `world` with `BuildProblem` or `BuildProblemForDate`, with
+// the trip changes that `ApplyTripUpdates` made to `world`. Only the edges that the changed trips'
+// old or new segments are on are touched, and edges that are left with no segments and no anytime
+// connection are erased, like they would be missing from a problem built from the updated world.
+// If `problem` is periodic, the new segments are wrapped into the period like `MakePeriodic` does.
+void ApplyTripChanges(const World& world, const std::vector<WorldTripChange>& changes, Problem& problem);
+
+// Makes `problem` periodic, so that trips that run after midnight (at 24:00 or later) connect with
+// the morning's trips. This assumes that every day has the same trips as the one that `problem` was
+// built for.
+//
+// Segments that depart at 24:00 or later are moved back a whole number of periods, so that each
+// schedule is a single sorted day of departures.
+void MakePeriodic(Problem& problem);
+
 // The order that segments should be ordered in a schedule.
 bool SegmentComp(const Segment& a, const Segment& b);
 
-// Erases non minimal entries from `schedule`.
+// Erases non minimal entries from `schedule`. If `periodic`, a segment is also non minimal if a
+// segment departing on a later day is.
 //
 // Precondition: `schedule.segments` is sorted by departure time ascending, with ties broken sorting
 // by arrival time descending.
-void EraseNonMinimal(Schedule& schedule);
+void EraseNonMinimal(Schedule& schedule, bool periodic = false);
 
+// If `periodic`, `a` and `b` are periodic schedules (see `Problem::periodic`), and segments of `a`
+// connect to `b`'s segments on later days too.
+//
+// Taking one of them anytime and a segment of the other gives a segment with the real departure and
+// arrival times, and the trip of the segment at its timed end.
 Schedule GetMinimalConnectingSchedule(
   const Schedule& a,
   const Schedule& b,
-  const unsigned int min_transfer_seconds
+  const unsigned int min_transfer_seconds,
+  bool periodic = false
+);
+
+// Like the other `GetMinimalConnectingSchedule`, but writes the schedule to `result`, reusing its
+// memory, and uses `scratch` along the way. Repeated calls with the same buffers stop allocating
+// once the buffers are big enough. `result` must not be `a` or `b`.
+void GetMinimalConnectingSchedule(
+  const Schedule& a,
+  const Schedule& b,
+  const unsigned int min_transfer_seconds,
+  bool periodic,
+  std::vector<Segment>& scratch,
+  Schedule& result
 );
 
-void MergeIntoSchedule(const Schedule& src, Schedule &dest);
+// Merges `src` into `dest`, keeping only the minimal segments. Only allocates if `dest` does not
+// have room for `src`'s segments.
+void MergeIntoSchedule(const Schedule& src, Schedule &dest, bool periodic = false);
+
+// Calls `f(segment, offset)` for the segments of `schedule` in order of departure, starting with the
+// first one that departs at or after `time`, until `f` returns false. The segment departs at
+// `segment.departure_time.seconds + offset` and arrives `offset` after its `arrival_time`.
+//
+// If not `periodic`, `offset` is always 0. If `periodic`, the segments are visited as they repeat,
+// through the end of the day and on into the next day (with `offset` increased by a period), for one
+// period's worth of departures.
+template <typename F>
+void ForEachDepartureFrom(const Schedule& schedule, WorldTime time, bool periodic, F f) {
+  const std::vector<Segment>& segments = schedule.segments;
+  unsigned int offset = periodic ? time.seconds / kSchedulePeriodSeconds * kSchedulePeriodSeconds : 0;
+  const unsigned int first_departure = time.seconds - offset;
+  size_t i = std::partition_point(segments.begin(), segments.end(), [first_departure](const Segment& seg) {
+    return seg.departure_time.seconds < first_departure;
+  }) - segments.begin();
+  const size_t count = periodic ? segments.size() : segments.size() - i;
+  for (size_t visited = 0; visited < count; ++visited, ++i) {
+    if (i == segments.size()) {
+      i = 0;
+      offset += kSchedulePeriodSeconds;
+    }
+    if (!f(segments[i], offset)) {
+      return;
+    }
+  }
+}
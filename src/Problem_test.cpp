@@ -1,3 +1,4 @@
+#include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <rapidcheck/gtest.h>
 
@@ -49,6 +50,74 @@ bool IsMinimalSchedule(const Schedule& schedule) {
   return true;
 }
 
+// Returns an arbitrary schedule of one day of a periodic problem: minimal, and with departures
+// spread over the whole period.
+Schedule ArbitraryPeriodicSchedule() {
+  Schedule result;
+  const size_t num_segments = *rc::gen::inRange<size_t>(0, 10);
+  for (size_t i = 0; i < num_segments; ++i) {
+    const unsigned int departure_time = *rc::gen::inRange<unsigned int>(0, kSchedulePeriodSeconds);
+    const unsigned int duration = *rc::gen::inRange<unsigned int>(0, kSchedulePeriodSeconds / 2);
+    result.segments.push_back(Segment{
+      .departure_time = WorldTime(departure_time),
+      .arrival_time = WorldTime(departure_time + duration)
+    });
+  }
+  std::sort(result.segments.begin(), result.segments.end(), SegmentComp);
+  EraseNonMinimal(result, /*periodic=*/true);
+  return result;
+}
+
+// (departure, arrival) of each segment.
+std::vector<std::pair<unsigned int, unsigned int>> Times(const Schedule& schedule) {
+  std::vector<std::pair<unsigned int, unsigned int>> result;
+  for (const Segment& seg : schedule.segments) {
+    result.emplace_back(seg.departure_time.seconds, seg.arrival_time.seconds);
+  }
+  return result;
+}
+
+// EraseNonMinimal as it used to be: mark the segments to erase, and then erase them.
+void ReferenceEraseNonMinimal(Schedule& schedule) {
+  unsigned int best_arrival = std::numeric_limits<unsigned int>::max();
+  const unsigned int anytime_duration = schedule.anytime_duration_or_big().seconds;
+  std::vector<bool> erase(schedule.segments.size());
+  for (size_t i = schedule.segments.size(); i > 0; --i) {
+    const Segment& seg = schedule.segments[i - 1];
+    if (
+      seg.arrival_time.seconds >= best_arrival ||
+      seg.arrival_time.seconds - seg.departure_time.seconds >= anytime_duration
+    ) {
+      erase[i - 1] = true;
+    } else {
+      best_arrival = seg.arrival_time.seconds;
+    }
+  }
+  std::vector<Segment> kept;
+  for (size_t i = 0; i < schedule.segments.size(); ++i) {
+    if (!erase[i]) {
+      kept.push_back(schedule.segments[i]);
+    }
+  }
+  schedule.segments = std::move(kept);
+}
+
+// Numbers the segments through their departure trip, so that tests can tell equal ones apart.
+void NumberSegments(Schedule& schedule, uint32_t first) {
+  for (Segment& seg : schedule.segments) {
+    seg.departure_trip_index = first++;
+  }
+}
+
+// (departure, arrival, departure trip) of each segment.
+std::vector<std::tuple<unsigned int, unsigned int, uint32_t>> NumberedTimes(const Schedule& schedule) {
+  std::vector<std::tuple<unsigned int, unsigned int, uint32_t>> result;
+  for (const Segment& seg : schedule.segments) {
+    result.emplace_back(seg.departure_time.seconds, seg.arrival_time.seconds, seg.departure_trip_index);
+  }
+  return result;
+}
+
 }  // namespace
 
 RC_GTEST_PROP(
@@ -62,6 +131,256 @@ RC_GTEST_PROP(
 }
 
 
+RC_GTEST_PROP(
+  ProblemTest,
+  eraseNonMinimalMatchesMarkAndErase,
+  ()
+) {
+  Schedule schedule = ArbitraryScheduleNotMinimized();
+  NumberSegments(schedule, 0);
+  Schedule expected = schedule;
+  ReferenceEraseNonMinimal(expected);
+  EraseNonMinimal(schedule);
+  RC_ASSERT(NumberedTimes(schedule) == NumberedTimes(expected));
+}
+
+RC_GTEST_PROP(
+  ProblemTest,
+  mergeIntoScheduleMatchesStableMerge,
+  ()
+) {
+  Schedule src = ArbitraryScheduleNotMinimized();
+  Schedule dest = ArbitraryScheduleNotMinimized();
+  EraseNonMinimal(src);
+  EraseNonMinimal(dest);
+  NumberSegments(dest, 0);
+  NumberSegments(src, dest.segments.size());
+
+  Schedule expected = dest;
+  if (src.anytime_duration_or_big().seconds < expected.anytime_duration_or_big().seconds) {
+    expected.anytime_duration = src.anytime_duration;
+  }
+  expected.segments.insert(expected.segments.end(), src.segments.begin(), src.segments.end());
+  std::inplace_merge(
+    expected.segments.begin(), expected.segments.begin() + dest.segments.size(), expected.segments.end(), SegmentComp
+  );
+  ReferenceEraseNonMinimal(expected);
+
+  MergeIntoSchedule(src, dest);
+  RC_ASSERT(NumberedTimes(dest) == NumberedTimes(expected));
+  RC_ASSERT(dest.anytime_duration_or_big().seconds == expected.anytime_duration_or_big().seconds);
+}
+
+RC_GTEST_PROP(
+  ProblemTest,
+  connectingScheduleReusesBuffers,
+  ()
+) {
+  // Writing into buffers left over from another call gives the same schedule as a fresh one.
+  const bool periodic = *rc::gen::arbitrary<bool>();
+  std::vector<Segment> scratch;
+  Schedule result;
+  for (int i = 0; i < 3; ++i) {
+    Schedule a = periodic ? ArbitraryPeriodicSchedule() : ArbitraryScheduleNotMinimized();
+    Schedule b = periodic ? ArbitraryPeriodicSchedule() : ArbitraryScheduleNotMinimized();
+    EraseNonMinimal(a, periodic);
+    EraseNonMinimal(b, periodic);
+    const unsigned int min_transfer_seconds = *rc::gen::inRange<unsigned int>(0, 100);
+    GetMinimalConnectingSchedule(a, b, min_transfer_seconds, periodic, scratch, result);
+    const Schedule expected = GetMinimalConnectingSchedule(a, b, min_transfer_seconds, periodic);
+    RC_ASSERT(NumberedTimes(result) == NumberedTimes(expected));
+    RC_ASSERT(result.anytime_duration_or_big().seconds == expected.anytime_duration_or_big().seconds);
+  }
+}
+
+RC_GTEST_PROP(
+  ProblemTest,
+  periodicEraseNonMinimalProducesMinimal,
+  ()
+) {
+  Schedule schedule = ArbitraryScheduleNotMinimized();
+  EraseNonMinimal(schedule, /*periodic=*/true);
+  RC_ASSERT(IsMinimalSchedule(schedule));
+  // Nothing is beaten by the next day's departures either.
+  Schedule two_days = schedule;
+  for (const Segment& seg : schedule.segments) {
+    two_days.segments.push_back(Segment{
+      .departure_time = WorldTime(seg.departure_time.seconds + kSchedulePeriodSeconds),
+      .arrival_time = WorldTime(seg.arrival_time.seconds + kSchedulePeriodSeconds)
+    });
+  }
+  RC_ASSERT(IsMinimalSchedule(two_days));
+}
+
+RC_GTEST_PROP(
+  ProblemTest,
+  periodicConnectingScheduleMatchesUnrolledDays,
+  ()
+) {
+  // Connecting to `b` repeating every day is the same as connecting to a few days of `b` written
+  // out, and then wrapping the result back into one day.
+  const Schedule a = ArbitraryPeriodicSchedule();
+  const Schedule b = ArbitraryPeriodicSchedule();
+  Schedule unrolled_b;
+  for (unsigned int day = 0; day < 3; ++day) {
+    for (const Segment& seg : b.segments) {
+      unrolled_b.segments.push_back(Segment{
+        .departure_time = WorldTime(seg.departure_time.seconds + day * kSchedulePeriodSeconds),
+        .arrival_time = WorldTime(seg.arrival_time.seconds + day * kSchedulePeriodSeconds)
+      });
+    }
+  }
+  Schedule expected = GetMinimalConnectingSchedule(a, unrolled_b, 0);
+  std::sort(expected.segments.begin(), expected.segments.end(), SegmentComp);
+  EraseNonMinimal(expected, /*periodic=*/true);
+
+  RC_ASSERT(Times(GetMinimalConnectingSchedule(a, b, 0, /*periodic=*/true)) == Times(expected));
+}
+
+RC_GTEST_PROP(
+  ProblemTest,
+  problemGraphFindsEveryEdge,
+  ()
+) {
+  Problem problem;
+  const size_t num_stops = *rc::gen::inRange<size_t>(0, 12);
+  for (size_t i = 0; i < num_stops; ++i) {
+    GetOrAddStop(std::to_string(i), problem);
+  }
+  const size_t num_edges = num_stops == 0 ? 0 : *rc::gen::inRange<size_t>(0, 40);
+  for (size_t i = 0; i < num_edges; ++i) {
+    const size_t origin = *rc::gen::inRange<size_t>(0, num_stops);
+    const size_t destination = *rc::gen::inRange<size_t>(0, num_stops);
+    GetOrAddEdge(origin, destination, problem)->schedule.anytime_duration = WorldDuration(i);
+  }
+
+  const ProblemGraph graph = BuildProblemGraph(problem);
+  RC_ASSERT(graph.num_stops() == num_stops);
+  size_t num_incoming = 0;
+  for (size_t origin = 0; origin < num_stops; ++origin) {
+    for (size_t destination = 0; destination < num_stops; ++destination) {
+      const Edge* edge = nullptr;
+      for (const Edge& candidate : problem.edges[origin]) {
+        if (candidate.destination_stop_index == destination) {
+          edge = &candidate;
+        }
+      }
+      const Schedule* schedule = graph.Find(origin, destination);
+      RC_ASSERT((edge == nullptr) == (schedule == nullptr));
+      if (edge != nullptr) {
+        RC_ASSERT(schedule->anytime_duration->seconds == edge->schedule.anytime_duration->seconds);
+      }
+    }
+
+    // Each incoming edge is the edge from its origin, in order of origin.
+    const std::span<const size_t> origins = graph.Origins(origin);
+    const std::span<const size_t> incoming = graph.IncomingEdges(origin);
+    RC_ASSERT(std::is_sorted(origins.begin(), origins.end()));
+    for (size_t i = 0; i < incoming.size(); ++i) {
+      RC_ASSERT(&graph.schedules[incoming[i]] == graph.Find(origins[i], origin));
+    }
+    num_incoming += incoming.size();
+  }
+  RC_ASSERT(num_incoming == graph.schedules.size());
+}
+
+TEST(ProblemTest, periodicLateTripConnectsToNextMorning) {
+  // A train from 23:30 to 23:50, and then a bus that only runs from 00:10 to 00:30 and at 08:00.
+  const Schedule train{.segments = {
+    {.departure_time = WorldTime(23 * 3600 + 30 * 60), .arrival_time = WorldTime(23 * 3600 + 50 * 60)},
+  }};
+  const Schedule bus{.segments = {
+    {.departure_time = WorldTime(10 * 60), .arrival_time = WorldTime(30 * 60), .departure_trip_index = 1, .arrival_trip_index = 1},
+    {.departure_time = WorldTime(8 * 3600), .arrival_time = WorldTime(8 * 3600 + 20 * 60), .departure_trip_index = 2, .arrival_trip_index = 2},
+  }};
+
+  EXPECT_TRUE(GetMinimalConnectingSchedule(train, bus, 0).segments.empty());
+  EXPECT_THAT(
+    Times(GetMinimalConnectingSchedule(train, bus, 0, /*periodic=*/true)),
+    testing::ElementsAre(std::make_pair(23 * 3600 + 30 * 60, 24 * 3600 + 30 * 60))
+  );
+
+  // Walking 20 minutes to the 00:10 bus means leaving the day before.
+  const Schedule walk{.anytime_duration = WorldDuration(20 * 60)};
+  EXPECT_THAT(
+    Times(GetMinimalConnectingSchedule(walk, bus, 0, /*periodic=*/true)),
+    testing::ElementsAre(
+      std::make_pair(7 * 3600 + 40 * 60, 8 * 3600 + 20 * 60),
+      std::make_pair(23 * 3600 + 50 * 60, 24 * 3600 + 30 * 60)
+    )
+  );
+}
+
+TEST(ProblemTest, anytimeConnectionsKeepTheirArrivalsAndTrips) {
+  const Schedule walk{.anytime_duration = WorldDuration(5 * 60)};
+  const Schedule bus{.segments = {
+    {.departure_time = WorldTime(8 * 3600), .arrival_time = WorldTime(8 * 3600 + 20 * 60), .departure_trip_index = 1, .arrival_trip_index = 2},
+  }};
+
+  // Walking and then taking the bus leaves 5 minutes before the bus, and arrives with it.
+  const Schedule walk_bus = GetMinimalConnectingSchedule(walk, bus, 0);
+  ASSERT_EQ(walk_bus.segments.size(), 1);
+  EXPECT_EQ(walk_bus.segments[0].departure_time.seconds, 8 * 3600 - 5 * 60);
+  EXPECT_EQ(walk_bus.segments[0].arrival_time.seconds, 8 * 3600 + 20 * 60);
+  EXPECT_EQ(walk_bus.segments[0].departure_trip_index, 0);
+  EXPECT_EQ(walk_bus.segments[0].arrival_trip_index, 2);
+
+  // Taking the bus and then walking leaves with the bus, and arrives 5 minutes after it.
+  const Schedule bus_walk = GetMinimalConnectingSchedule(bus, walk, 0);
+  ASSERT_EQ(bus_walk.segments.size(), 1);
+  EXPECT_EQ(bus_walk.segments[0].departure_time.seconds, 8 * 3600);
+  EXPECT_EQ(bus_walk.segments[0].arrival_time.seconds, 8 * 3600 + 25 * 60);
+  EXPECT_EQ(bus_walk.segments[0].departure_trip_index, 1);
+  EXPECT_EQ(bus_walk.segments[0].arrival_trip_index, 0);
+}
+
+TEST(ProblemTest, makePeriodicWrapsAfterMidnightDepartures) {
+  Problem problem;
+  const size_t a = GetOrAddStop("a", problem);
+  const size_t b = GetOrAddStop("b", problem);
+  GetOrAddEdge(a, b, problem)->schedule.segments = {
+    {.departure_time = WorldTime(6 * 3600), .arrival_time = WorldTime(6 * 3600 + 600)},
+    {.departure_time = WorldTime(25 * 3600), .arrival_time = WorldTime(25 * 3600 + 600)},
+  };
+  MakePeriodic(problem);
+  EXPECT_TRUE(problem.periodic);
+  EXPECT_THAT(
+    Times(GetOrAddEdge(a, b, problem)->schedule),
+    testing::ElementsAre(std::make_pair(3600, 3600 + 600), std::make_pair(6 * 3600, 6 * 3600 + 600))
+  );
+
+  // A departure at 23:00 can be followed by the 01:00 one the next day, but not the 06:00 one.
+  std::vector<std::pair<unsigned int, unsigned int>> departures;
+  ForEachDepartureFrom(
+    GetOrAddEdge(a, b, problem)->schedule, WorldTime(23 * 3600), problem.periodic,
+    [&departures](const Segment& seg, unsigned int offset) {
+      departures.emplace_back(seg.departure_time.seconds + offset, seg.arrival_time.seconds + offset);
+      return departures.size() < 1;
+    }
+  );
+  EXPECT_THAT(departures, testing::ElementsAre(std::make_pair(25 * 3600, 25 * 3600 + 600)));
+}
+
+TEST(ProblemTest, tripPathsAreHashConsed) {
+  TripPaths paths;
+  const std::vector<uint32_t> ab = {1, 2};
+  const std::vector<uint32_t> abc = {1, 2, 3};
+  const TripPathIndex ab_index = paths.GetOrAdd(ab);
+  const TripPathIndex abc_index = paths.GetOrAdd(abc);
+  EXPECT_NE(ab_index, abc_index);
+  EXPECT_EQ(paths.GetOrAdd(ab), ab_index);
+  EXPECT_THAT(paths.Get(abc_index), testing::ElementsAre(1, 2, 3));
+  EXPECT_TRUE(paths.Get(kNoTripPath).empty());
+  EXPECT_EQ(paths.size(), 2);
+
+  // Like a deserialized copy, which only has the arena.
+  TripPaths loaded;
+  loaded.offsets = paths.offsets;
+  loaded.trips = paths.trips;
+  EXPECT_EQ(loaded.GetOrAdd(abc), abc_index);
+  EXPECT_EQ(loaded.size(), 2);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
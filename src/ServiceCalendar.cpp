@@ -0,0 +1,263 @@
+#include "ServiceCalendar.h"
+
+#include <algorithm>
+#include <variant>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+
+#include "GTFSCsv.h"
+
+// Parses a required GTFS day, which is a string of the form "YYYYMMDD".
+static std::variant<absl::CivilDay, std::string> parseGTFSDay(absl::string_view day) {
+  if (day.size() != 8) {
+    return absl::StrCat("Invalid day: ", day);
+  }
+  unsigned int year = 0, month = 0, day_of_month = 0;
+  bool success = true;
+  success &= absl::SimpleAtoi(day.substr(0, 4), &year);
+  success &= absl::SimpleAtoi(day.substr(4, 2), &month);
+  success &= absl::SimpleAtoi(day.substr(6, 2), &day_of_month);
+  if (!success) {
+    return absl::StrCat("Invalid day: ", day);
+  }
+  return absl::CivilDay(year, month, day_of_month);
+}
+
+ServiceCalendar::ServiceCalendar(absl::CivilDay first_day, absl::CivilDay last_day)
+  : first_day_(first_day),
+    num_days_(std::max<int64_t>(0, last_day - first_day + 1)),
+    words_per_service_((num_days_ + 63) / 64) {}
+
+ServiceIndex ServiceCalendar::GetOrAdd(absl::string_view service_id) {
+  const ServiceIndex service = service_ids_.GetOrAdd(service_id);
+  days_.resize(service_ids_.size() * words_per_service_);
+  return service;
+}
+
+std::optional<int64_t> ServiceCalendar::DayBit(absl::CivilDay day) const {
+  const int64_t bit = day - first_day_;
+  if (bit < 0 || bit >= num_days_) {
+    return std::nullopt;
+  }
+  return bit;
+}
+
+void ServiceCalendar::SetActive(ServiceIndex service, absl::CivilDay day, bool active) {
+  std::optional<int64_t> bit = DayBit(day);
+  if (!bit.has_value()) {
+    return;
+  }
+  uint64_t& word = days_[service * words_per_service_ + *bit / 64];
+  const uint64_t mask = uint64_t(1) << (*bit % 64);
+  word = active ? (word | mask) : (word & ~mask);
+}
+
+bool ServiceCalendar::IsActive(ServiceIndex service, absl::CivilDay day) const {
+  std::optional<int64_t> bit = DayBit(day);
+  if (!bit.has_value()) {
+    return false;
+  }
+  return (days_[service * words_per_service_ + *bit / 64] >> (*bit % 64)) & 1;
+}
+
+std::vector<bool> ServiceCalendar::ActiveServices(absl::CivilDay day) const {
+  return ActiveServices(day, day);
+}
+
+std::vector<bool> ServiceCalendar::ActiveServices(absl::CivilDay first, absl::CivilDay last) const {
+  std::vector<bool> result(size());
+  const int64_t first_bit = std::max<int64_t>(first - first_day_, 0);
+  const int64_t last_bit = std::min<int64_t>(last - first_day_, num_days_ - 1);
+  if (first_bit > last_bit) {
+    return result;
+  }
+
+  // Masks selecting the days in range in the first and last words.
+  const size_t first_word = first_bit / 64;
+  const size_t last_word = last_bit / 64;
+  const uint64_t first_mask = ~uint64_t(0) << (first_bit % 64);
+  const uint64_t last_mask = ~uint64_t(0) >> (63 - last_bit % 64);
+  for (ServiceIndex service = 0; service < size(); ++service) {
+    const uint64_t* words = service_days(service);
+    uint64_t any = 0;
+    if (first_word == last_word) {
+      any = words[first_word] & first_mask & last_mask;
+    } else {
+      any = (words[first_word] & first_mask) | (words[last_word] & last_mask);
+      for (size_t w = first_word + 1; w < last_word; ++w) {
+        any |= words[w];
+      }
+    }
+    result[service] = any != 0;
+  }
+  return result;
+}
+
+std::vector<ServiceIndex> ServiceCalendar::Merge(const ServiceCalendar& other) {
+  if (other.num_days_ == 0) {
+    std::vector<ServiceIndex> remap;
+    for (ServiceIndex service = 0; service < other.size(); ++service) {
+      remap.push_back(GetOrAdd(other.service_ids_.Get(service)));
+    }
+    return remap;
+  }
+
+  ServiceCalendar merged = num_days_ == 0
+    ? ServiceCalendar(other.first_day(), other.last_day())
+    : ServiceCalendar(std::min(first_day(), other.first_day()), std::max(last_day(), other.last_day()));
+  auto copy_days = [&merged](const ServiceCalendar& from, ServiceIndex from_service, ServiceIndex to_service) {
+    for (int64_t d = 0; d < from.num_days_; ++d) {
+      if (from.days_[from_service * from.words_per_service_ + d / 64] >> (d % 64) & 1) {
+        merged.SetActive(to_service, from.first_day_ + d, true);
+      }
+    }
+  };
+  for (ServiceIndex service = 0; service < size(); ++service) {
+    copy_days(*this, service, merged.GetOrAdd(service_ids_.Get(service)));
+  }
+  std::vector<ServiceIndex> remap;
+  for (ServiceIndex service = 0; service < other.size(); ++service) {
+    remap.push_back(merged.GetOrAdd(other.service_ids_.Get(service)));
+    copy_days(other, service, remap.back());
+  }
+  *this = std::move(merged);
+  return remap;
+}
+
+std::optional<std::string> readServiceCalendar(
+  const std::string& directory,
+  const std::string& id_prefix,
+  ServiceCalendar& calendar
+) {
+  // The files are read into these first, because the calendar's range is only known once every
+  // date in them has been seen.
+  struct CalendarRow {
+    std::string service_id;
+    // Indexed like absl::Weekday: Monday first.
+    bool weekdays[7];
+    absl::CivilDay start_date;
+    absl::CivilDay end_date;
+  };
+  struct CalendarDateRow {
+    std::string service_id;
+    absl::CivilDay date;
+    bool added;
+  };
+  std::vector<CalendarRow> calendar_rows;
+  std::vector<CalendarDateRow> calendar_date_rows;
+  std::optional<absl::CivilDay> first_day, last_day;
+  auto cover = [&first_day, &last_day](absl::CivilDay day) {
+    first_day = first_day.has_value() ? std::min(*first_day, day) : day;
+    last_day = last_day.has_value() ? std::max(*last_day, day) : day;
+  };
+
+  // Each file is optional as long as the other one exists.
+  const std::string calendar_path = directory + "/calendar.txt";
+  const std::string calendar_dates_path = directory + "/calendar_dates.txt";
+  const bool has_calendar = gtfsFileExists(calendar_path);
+  const bool has_calendar_dates = gtfsFileExists(calendar_dates_path);
+  if (!has_calendar && !has_calendar_dates) {
+    return absl::StrCat(directory, " has neither calendar.txt nor calendar_dates.txt");
+  }
+
+  if (has_calendar) {
+    GTFSCsvReader reader;
+    size_t service_id_col, start_date_col, end_date_col;
+    size_t weekday_cols[7];
+    auto err = openGTFSCsv(
+      calendar_path,
+      {
+        {"service_id", &service_id_col},
+        {"monday", &weekday_cols[0]},
+        {"tuesday", &weekday_cols[1]},
+        {"wednesday", &weekday_cols[2]},
+        {"thursday", &weekday_cols[3]},
+        {"friday", &weekday_cols[4]},
+        {"saturday", &weekday_cols[5]},
+        {"sunday", &weekday_cols[6]},
+        {"start_date", &start_date_col},
+        {"end_date", &end_date_col},
+      },
+      reader
+    );
+    if (err.has_value()) {
+      return err;
+    }
+    while (reader.Next()) {
+      CalendarRow& row = calendar_rows.emplace_back();
+      row.service_id = absl::StrCat(id_prefix, reader.Field(service_id_col));
+      for (int i = 0; i < 7; ++i) {
+        row.weekdays[i] = reader.Field(weekday_cols[i]) == "1";
+      }
+      auto start_date_or = parseGTFSDay(reader.Field(start_date_col));
+      if (std::holds_alternative<std::string>(start_date_or)) {
+        return std::get<1>(start_date_or);
+      }
+      row.start_date = std::get<0>(start_date_or);
+      auto end_date_or = parseGTFSDay(reader.Field(end_date_col));
+      if (std::holds_alternative<std::string>(end_date_or)) {
+        return std::get<1>(end_date_or);
+      }
+      row.end_date = std::get<0>(end_date_or);
+      cover(row.start_date);
+      cover(row.end_date);
+    }
+    if (reader.Error().has_value()) {
+      return reader.Error();
+    }
+  }
+
+  if (has_calendar_dates) {
+    GTFSCsvReader reader;
+    size_t service_id_col, date_col, exception_type_col;
+    auto err = openGTFSCsv(
+      calendar_dates_path,
+      {{"service_id", &service_id_col}, {"date", &date_col}, {"exception_type", &exception_type_col}},
+      reader
+    );
+    if (err.has_value()) {
+      return err;
+    }
+    while (reader.Next()) {
+      CalendarDateRow& row = calendar_date_rows.emplace_back();
+      row.service_id = absl::StrCat(id_prefix, reader.Field(service_id_col));
+      auto date_or = parseGTFSDay(reader.Field(date_col));
+      if (std::holds_alternative<std::string>(date_or)) {
+        return std::get<1>(date_or);
+      }
+      row.date = std::get<0>(date_or);
+      absl::string_view exception_type = reader.Field(exception_type_col);
+      if (exception_type == "1") {
+        row.added = true;
+      } else if (exception_type == "2") {
+        row.added = false;
+      } else {
+        return absl::StrCat("Unknown exception type in calendar_dates.txt: ", exception_type);
+      }
+      cover(row.date);
+    }
+    if (reader.Error().has_value()) {
+      return reader.Error();
+    }
+  }
+
+  if (!first_day.has_value()) {
+    calendar = ServiceCalendar();
+    return std::nullopt;
+  }
+  calendar = ServiceCalendar(*first_day, *last_day);
+  for (const CalendarRow& row : calendar_rows) {
+    const ServiceIndex service = calendar.GetOrAdd(row.service_id);
+    for (absl::CivilDay day = row.start_date; day <= row.end_date; ++day) {
+      if (row.weekdays[static_cast<int>(absl::GetWeekday(day))]) {
+        calendar.SetActive(service, day, true);
+      }
+    }
+  }
+  // Exceptions override the regular calendar.
+  for (const CalendarDateRow& row : calendar_date_rows) {
+    calendar.SetActive(calendar.GetOrAdd(row.service_id), row.date, row.added);
+  }
+  return std::nullopt;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/civil_time.h"
+
+#include "StringInterner.h"
+
+using ServiceIndex = uint32_t;
+
+// Which days each service runs on, over a range of days.
+//
+// Each service has a bitmap with one bit per day of the range, so whether a service runs on a day is
+// a single bit test, and the services running on any day of a range of days take a few word ORs
+// per service.
+class ServiceCalendar {
+public:
+  // An empty calendar, which has no services and covers no days.
+  ServiceCalendar() = default;
+
+  // A calendar covering [first_day, last_day], with no services yet.
+  ServiceCalendar(absl::CivilDay first_day, absl::CivilDay last_day);
+
+  // GTFS service ids (with the feed prefix), indexed by ServiceIndex.
+  const StringInterner& service_ids() const { return service_ids_; }
+  size_t size() const { return service_ids_.size(); }
+
+  // The range of days that the calendar covers. No service runs outside of it.
+  absl::CivilDay first_day() const { return first_day_; }
+  absl::CivilDay last_day() const { return first_day_ + (num_days_ - 1); }
+  int64_t num_days() const { return num_days_; }
+
+  // Returns the index of the service with id `service_id`, adding it (running on no days) if it is
+  // new.
+  ServiceIndex GetOrAdd(absl::string_view service_id);
+
+  // Sets whether `service` runs on `day`. Days outside of the calendar's range are ignored.
+  void SetActive(ServiceIndex service, absl::CivilDay day, bool active);
+
+  bool IsActive(ServiceIndex service, absl::CivilDay day) const;
+
+  // The services that run on `day`, indexed by ServiceIndex.
+  std::vector<bool> ActiveServices(absl::CivilDay day) const;
+
+  // The services that run on at least one day in [first, last], indexed by ServiceIndex.
+  std::vector<bool> ActiveServices(absl::CivilDay first, absl::CivilDay last) const;
+
+  // Adds every service in `other` to this calendar, widening this calendar's range to cover
+  // `other`'s. A service that is in both runs on the days that it runs on in either. Returns the
+  // index in this calendar of each service in `other`.
+  std::vector<ServiceIndex> Merge(const ServiceCalendar& other);
+
+  // Raw access to the bitmap of `service`, for serialization. Bit `d % 64` of word `d / 64` is day
+  // `first_day() + d`.
+  size_t words_per_service() const { return words_per_service_; }
+  const uint64_t* service_days(ServiceIndex service) const { return days_.data() + service * words_per_service_; }
+  uint64_t* mutable_service_days(ServiceIndex service) { return days_.data() + service * words_per_service_; }
+
+private:
+  // Returns the bit for `day`, or nullopt if it is out of range.
+  std::optional<int64_t> DayBit(absl::CivilDay day) const;
+
+  StringInterner service_ids_;
+  absl::CivilDay first_day_;
+  int64_t num_days_ = 0;
+  size_t words_per_service_ = 0;
+  // Service `s` runs on day `first_day_ + d` iff bit `d % 64` of `days_[s * words_per_service_ + d / 64]`
+  // is set.
+  std::vector<uint64_t> days_;
+};
+
+// Reads calendar.txt and calendar_dates.txt at `directory` into `calendar`, which covers every day
+// mentioned in either file.
+//
+// All GTFS IDs are prefixed with `id_prefix`.
+//
+// Returns an error message if something went wrong, otherwise returns nullopt.
+std::optional<std::string> readServiceCalendar(
+  const std::string& directory,
+  const std::string& id_prefix,
+  ServiceCalendar& calendar
+);
@@ -0,0 +1,95 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "ServiceCalendar.h"
+
+namespace {
+
+// The ids of the services in `active`.
+std::vector<std::string> ServiceIds(const ServiceCalendar& calendar, const std::vector<bool>& active) {
+  std::vector<std::string> result;
+  for (ServiceIndex service = 0; service < calendar.size(); ++service) {
+    if (active[service]) {
+      result.push_back(calendar.service_ids().Get(service));
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
+TEST(ServiceCalendarTest, caltrainRange) {
+  ServiceCalendar calendar;
+  ASSERT_EQ(readServiceCalendar("data/fetched-2024-06-08/caltrain", "caltrain-", calendar), std::nullopt);
+  EXPECT_EQ(calendar.first_day(), absl::CivilDay(2023, 9, 23));
+  EXPECT_EQ(calendar.last_day(), absl::CivilDay(2024, 7, 1));
+  EXPECT_EQ(calendar.size(), 4);
+}
+
+TEST(ServiceCalendarTest, caltrainDays) {
+  ServiceCalendar calendar;
+  ASSERT_EQ(readServiceCalendar("data/fetched-2024-06-08/caltrain", "caltrain-", calendar), std::nullopt);
+  const ServiceIndex weekend = calendar.service_ids().Find("caltrain-72981").value();
+  const ServiceIndex weekday = calendar.service_ids().Find("caltrain-72982").value();
+
+  EXPECT_TRUE(calendar.IsActive(weekday, absl::CivilDay(2024, 6, 13)));
+  EXPECT_FALSE(calendar.IsActive(weekend, absl::CivilDay(2024, 6, 13)));
+  EXPECT_TRUE(calendar.IsActive(weekend, absl::CivilDay(2024, 6, 16)));
+  // Removed by calendar_dates.txt.
+  EXPECT_FALSE(calendar.IsActive(weekend, absl::CivilDay(2024, 6, 9)));
+  // Memorial Day runs the weekend service.
+  EXPECT_TRUE(calendar.IsActive(weekend, absl::CivilDay(2024, 5, 27)));
+  EXPECT_FALSE(calendar.IsActive(weekday, absl::CivilDay(2024, 5, 27)));
+  // Out of range.
+  EXPECT_FALSE(calendar.IsActive(weekday, absl::CivilDay(2024, 7, 2)));
+  EXPECT_FALSE(calendar.IsActive(weekday, absl::CivilDay(2023, 9, 22)));
+}
+
+TEST(ServiceCalendarTest, caltrainRangeQuery) {
+  ServiceCalendar calendar;
+  ASSERT_EQ(readServiceCalendar("data/fetched-2024-06-08/caltrain", "caltrain-", calendar), std::nullopt);
+
+  // Weekdays only.
+  EXPECT_THAT(
+    ServiceIds(calendar, calendar.ActiveServices(absl::CivilDay(2024, 6, 10), absl::CivilDay(2024, 6, 14))),
+    testing::UnorderedElementsAre("caltrain-72982")
+  );
+  // Both shutdown weekend days are removed from the weekend service.
+  EXPECT_THAT(
+    ServiceIds(calendar, calendar.ActiveServices(absl::CivilDay(2024, 6, 8), absl::CivilDay(2024, 6, 9))),
+    testing::IsEmpty()
+  );
+  EXPECT_THAT(
+    ServiceIds(calendar, calendar.ActiveServices(absl::CivilDay(2024, 4, 1), absl::CivilDay(2024, 5, 31))),
+    testing::UnorderedElementsAre("caltrain-72981", "caltrain-72982", "caltrain-79159", "caltrain-79932")
+  );
+  EXPECT_THAT(
+    ServiceIds(calendar, calendar.ActiveServices(absl::CivilDay(2025, 1, 1), absl::CivilDay(2025, 12, 31))),
+    testing::IsEmpty()
+  );
+}
+
+TEST(ServiceCalendarTest, rangeQueryIsUnionOfDays) {
+  ServiceCalendar calendar;
+  ASSERT_EQ(readServiceCalendar("data/fetched-2024-06-08/bart", "bart-", calendar), std::nullopt);
+
+  // Ranges that start and end at various places within the 64-day words.
+  for (int start_offset : {0, 1, 63, 64, 100}) {
+    for (int length : {1, 2, 7, 64, 65, 200}) {
+      const absl::CivilDay first = calendar.first_day() + start_offset;
+      const absl::CivilDay last = first + (length - 1);
+      std::vector<bool> expected(calendar.size());
+      for (absl::CivilDay day = first; day <= last; ++day) {
+        for (ServiceIndex service = 0; service < calendar.size(); ++service) {
+          expected[service] = expected[service] || calendar.IsActive(service, day);
+        }
+      }
+      EXPECT_EQ(calendar.ActiveServices(first, last), expected) << first << " to " << last;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -85,36 +85,29 @@ void AddSegmentsFromDeparture(
         };
       }
 
-      auto it = std::lower_bound(
-        edge.schedule.segments.begin(),
-        edge.schedule.segments.end(),
-        cur.time,
-        [](const Segment& seg, const WorldTime& cur_time) { return seg.departure_time.seconds < cur_time.seconds; }
-      );
-      while (
-        it != edge.schedule.segments.end() &&
-        (
-          // We can stop checking departures if they depart after the best arrival time that we have already found.
-          !best_arrival.has_value() || it->departure_time.seconds < best_arrival->time.seconds
-        )
-      ) {
-        if (!best_arrival.has_value() || it->arrival_time.seconds < best_arrival->time.seconds) {
-          if (it->departure_trip_index != it->arrival_trip_index) {
+      // In a periodic problem, the departures go on into the next day.
+      ForEachDepartureFrom(edge.schedule, cur.time, original.periodic, [&](const Segment& seg, unsigned int offset) {
+        // We can stop checking departures if they depart after the best arrival time that we have already found.
+        if (best_arrival.has_value() && seg.departure_time.seconds + offset >= best_arrival->time.seconds) {
+          return false;
+        }
+        if (!best_arrival.has_value() || seg.arrival_time.seconds + offset < best_arrival->time.seconds) {
+          if (seg.departure_trip_index != seg.arrival_trip_index) {
             throw std::runtime_error("TODO: handle multi-trip segments");
           }
           best_arrival = TimeLoc{
-            .time = it->arrival_time,
+            .time = WorldTime(seg.arrival_time.seconds + offset),
             .stop_index = edge.destination_stop_index,
             .breadcrumb = Breadcrumb{
               .previous_stop_index = cur.stop_index,
-              .departure_time = it->departure_time,
-              .trip_index = it->departure_trip_index,
+              .departure_time = WorldTime(seg.departure_time.seconds + offset),
+              .trip_index = seg.departure_trip_index,
             },
             .visited = false
           };
         }
-        ++it;
-      }
+        return true;
+      });
 
       if (best_arrival.has_value() && best_arrival->time.seconds < stop_state[best_arrival->stop_index].time.seconds) {
         stop_state[best_arrival->stop_index] = *best_arrival;
@@ -135,6 +128,8 @@ void AddSegmentsFromDeparture(
   // Trip index in original problem.
   std::vector<size_t> trips_from_latest_at_keep;
   trips_from_latest_at_keep.reserve(50);
+  // The same trips, in order, in the new problem.
+  std::vector<uint32_t> path;
 
   for (const size_t final_stop_index : keep_stop_indexes) {
     if (final_stop_index == start.stop_index || !stop_state[final_stop_index].visited) {
@@ -168,11 +163,19 @@ void AddSegmentsFromDeparture(
       .departure_time = cur.breadcrumb->departure_time,
       .arrival_time = latest_at_keep.time
     };
+    if (original.periodic) {
+      // The first departure might be on the next day.
+      const unsigned int shift = new_segment.departure_time.seconds / kSchedulePeriodSeconds * kSchedulePeriodSeconds;
+      new_segment.departure_time.seconds -= shift;
+      new_segment.arrival_time.seconds -= shift;
+    }
+    path.clear();
     for (auto it = trips_from_latest_at_keep.rbegin(); it != trips_from_latest_at_keep.rend(); ++it) {
-      new_segment.trip_indices.push_back(GetOrAddTrip(original.trip_index_to_id[*it], new_problem));
+      path.push_back(GetOrAddTrip(original.trip_index_to_id[*it], new_problem));
     }
-    new_segment.departure_trip_index = new_segment.trip_indices.front();
-    new_segment.arrival_trip_index = new_segment.trip_indices.back();
+    new_segment.departure_trip_index = path.front();
+    new_segment.arrival_trip_index = path.back();
+    new_segment.trip_path = new_problem.trip_paths.GetOrAdd(path);
 
     const size_t new_problem_dest_stop_index = GetOrAddStop(
       original.stop_index_to_id[latest_at_keep.stop_index], new_problem
@@ -206,6 +209,7 @@ Problem SimplifyProblem(const Problem& problem, const std::vector<std::string>&
   // Make sure to dedupe things cuz there are going to be dups for many reasons.
 
   Problem new_problem;
+  new_problem.periodic = problem.periodic;
 
   std::vector<size_t> keep_stop_indexes;
   std::vector<bool> is_keep_stop(problem.edges.size());
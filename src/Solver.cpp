@@ -21,21 +21,10 @@ struct SolverWalkVisitorState {
   Schedule schedule;
 };
 
-static const Schedule* GetSchedule(
-  const Problem& problem,
-  size_t origin_stop_index,
-  size_t destination_stop_index
-) {
-  for (const Edge& edge : problem.edges[origin_stop_index]) {
-    if (edge.destination_stop_index == destination_stop_index) {
-      return &edge.schedule;
-    }
-  }
-  return nullptr;
-}
-
 struct SolverWalkVisitor {
   const Problem& problem;
+  // The edges of `problem`, for looking up the schedule of each step of the walk.
+  const ProblemGraph& graph;
 
   std::vector<unsigned int> min_to_enter;
   unsigned int remaining_stops_lower_bound;
@@ -45,6 +34,8 @@ struct SolverWalkVisitor {
   std::vector<BestWalk> best_walks;
 
   std::vector<SolverWalkVisitorState> stack;
+  // Reused by every step's GetMinimalConnectingSchedule.
+  std::vector<Segment> scratch;
 
   // If this returns false, this branch of the DFS is pruned.
   // The DFS will always pop the stop, even if this returns false.
@@ -66,7 +57,7 @@ struct SolverWalkVisitor {
     }
 
     const SolverWalkVisitorState& prev_state = stack[stack.size() - 2];
-    const Schedule* schedule = GetSchedule(problem, prev_state.stop_index, stop_index);
+    const Schedule* schedule = graph.Find(prev_state.stop_index, stop_index);
     if (schedule == nullptr) {
       // There is no schedule between these stops, so prune.
       return false;
@@ -77,7 +68,9 @@ struct SolverWalkVisitor {
     //    problem.stop_id_to_index.at("bart-place_RICH") == prev_state.stop_index) ? 1 * 60 : 0 * 60
     // );
     const unsigned int min_transfer_seconds = 0;
-    state.schedule = GetMinimalConnectingSchedule(prev_state.schedule, *schedule, min_transfer_seconds);
+    GetMinimalConnectingSchedule(
+      prev_state.schedule, *schedule, min_transfer_seconds, problem.periodic, scratch, state.schedule
+    );
 
     const unsigned int captured_best_duration = best_duration;
     const unsigned int captured_remaining_stops_lower_bound = remaining_stops_lower_bound;
@@ -159,6 +152,9 @@ static Problem NaivePruneProblem(const Problem& problem) {
   // The trips stay the same.
   pruned.trip_id_to_index = problem.trip_id_to_index;
   pruned.trip_index_to_id = problem.trip_index_to_id;
+  // Segments that are copied over keep their paths.
+  pruned.trip_paths = problem.trip_paths;
+  pruned.periodic = problem.periodic;
 
   // Figure out which stops to keep.
   std::unordered_map<size_t, size_t> old_to_new_stop_index;
@@ -222,7 +218,7 @@ static Problem NaivePruneProblem(const Problem& problem) {
         }
 
         // TODO: Implement min_transfer_seconds here.
-        old_schedule = GetMinimalConnectingSchedule(old_schedule, next_edge->schedule, 0);
+        old_schedule = GetMinimalConnectingSchedule(old_schedule, next_edge->schedule, 0, problem.periodic);
         old_origin_stop_index = old_destination_stop_index;
         old_destination_stop_index = next_edge->destination_stop_index;
       }
@@ -264,24 +260,14 @@ void Solve(
 
   std::cout << "Solving...\n";
 
-  SolverWalkVisitor visitor{.problem = problem, .best_duration = 5 * 3600 + 35 * 60};
+  const ProblemGraph graph = BuildProblemGraph(problem);
+  SolverWalkVisitor visitor{.problem = problem, .graph = graph, .best_duration = 5 * 3600 + 35 * 60};
 
-  visitor.min_to_enter = std::vector<unsigned int>(problem.edges.size(), std::numeric_limits<unsigned int>::max());
-  visitor.visited = std::vector<unsigned int>(problem.edges.size(), 0);
-  for (const std::vector<Edge>& edges : problem.edges) {
-    for (const Edge& edge : edges) {
-      if (edge.schedule.anytime_duration.has_value()) {
-        visitor.min_to_enter[edge.destination_stop_index] = std::min(
-          visitor.min_to_enter[edge.destination_stop_index],
-          edge.schedule.anytime_duration->seconds
-        );
-      }
-      for (const Segment& seg : edge.schedule.segments) {
-        visitor.min_to_enter[edge.destination_stop_index] = std::min(
-          visitor.min_to_enter[edge.destination_stop_index],
-          seg.arrival_time.seconds - seg.departure_time.seconds
-        );
-      }
+  visitor.min_to_enter = std::vector<unsigned int>(graph.num_stops(), std::numeric_limits<unsigned int>::max());
+  visitor.visited = std::vector<unsigned int>(graph.num_stops(), 0);
+  for (size_t stop_index = 0; stop_index < graph.num_stops(); ++stop_index) {
+    for (const size_t edge : graph.IncomingEdges(stop_index)) {
+      visitor.min_to_enter[stop_index] = std::min(visitor.min_to_enter[stop_index], graph.schedules[edge].lower_bound());
     }
   }
   visitor.remaining_stops_lower_bound = 0;
@@ -318,7 +304,7 @@ void Solve(
     for (size_t i = 1; i < best_walk.walk.size(); ++i) {
       const size_t current_stop_index = best_walk.walk[i - 1];
       const size_t next_stop_index = best_walk.walk[i];
-      const Schedule* next_schedule = GetSchedule(problem, current_stop_index, next_stop_index);
+      const Schedule* next_schedule = graph.Find(current_stop_index, next_stop_index);
       if (next_schedule == nullptr) {
         throw std::runtime_error("No schedule found. This should never happen.");
       }
@@ -404,7 +390,7 @@ void Solve(
 
       std::cout << absl::StreamFormat(
         "%-40s %s\n",
-        world.stops.at(problem.stop_index_to_id[best_walk.walk[i]]).name,
+        world.stops.names[world.stops.ids.Find(problem.stop_index_to_id[best_walk.walk[i]]).value()],
         absl::StrJoin(arrival_times, " ", optTimeFormatter)
       );
       if (i > 0 && i < best_walk.walk.size() - 1) {
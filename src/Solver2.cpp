@@ -26,6 +26,9 @@ DenseProblem MakeDenseProblem(const Problem& problem) {
     }
   }
 
+  // Reused for every connection, so that the loop below does not allocate once they have grown.
+  Schedule connecting;
+  std::vector<Segment> scratch;
   for (size_t intermediate = 0; intermediate < result.num_stops; ++intermediate) {
     if (problem.stop_index_to_id[intermediate] == "DUMMY") {
       continue;
@@ -35,14 +38,15 @@ DenseProblem MakeDenseProblem(const Problem& problem) {
         if (intermediate == from || intermediate == to || from == to) {
           continue;
         }
-        MergeIntoSchedule(
-          GetMinimalConnectingSchedule(
-            result.entries[from * result.num_stops + intermediate],
-            result.entries[intermediate * result.num_stops + to],
-            /*min_transfer_seconds=*/ 0
-          ),
-          result.entries[from * result.num_stops + to]
+        GetMinimalConnectingSchedule(
+          result.entries[from * result.num_stops + intermediate],
+          result.entries[intermediate * result.num_stops + to],
+          /*min_transfer_seconds=*/ 0,
+          problem.periodic,
+          scratch,
+          connecting
         );
+        MergeIntoSchedule(connecting, result.entries[from * result.num_stops + to], problem.periodic);
       }
     }
   }
@@ -0,0 +1,32 @@
+#include "StopGrid.h"
+
+#include <algorithm>
+
+StopGrid::StopGrid(
+  const std::vector<double>& xs,
+  const std::vector<double>& ys,
+  const std::vector<uint32_t>& points,
+  double cell_size
+) : cell_size_(cell_size) {
+  std::vector<std::pair<uint64_t, uint32_t>> keyed;
+  keyed.reserve(points.size());
+  for (const uint32_t point : points) {
+    keyed.emplace_back(CellKey(Cell(xs[point]), Cell(ys[point])), point);
+  }
+  std::sort(keyed.begin(), keyed.end());
+
+  points_.reserve(keyed.size());
+  xs_.reserve(keyed.size());
+  ys_.reserve(keyed.size());
+  for (uint32_t i = 0; i < keyed.size(); ++i) {
+    const auto& [key, point] = keyed[i];
+    points_.push_back(point);
+    xs_.push_back(xs[point]);
+    ys_.push_back(ys[point]);
+    if (i == 0 || keyed[i - 1].first != key) {
+      cells_[key] = {i, i + 1};
+    } else {
+      cells_[key].second = i + 1;
+    }
+  }
+}
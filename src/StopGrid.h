@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+
+// A uniform grid over points in the plane, for finding the points near a position without looking
+// at all of them.
+//
+// Points are identified by their index into the coordinate vectors passed to the constructor. Only
+// the points listed in `points` are indexed. The coordinates are copied into the grid in cell order,
+// so a query reads a few contiguous runs of memory.
+class StopGrid {
+public:
+  StopGrid(
+    const std::vector<double>& xs,
+    const std::vector<double>& ys,
+    const std::vector<uint32_t>& points,
+    double cell_size
+  );
+
+  // Calls `f(point, distance)` for every indexed point at most `radius` from (x, y), including a
+  // point at (x, y) itself.
+  template <typename F>
+  void ForEachWithin(double x, double y, double radius, F f) const {
+    const int64_t min_cx = Cell(x - radius), max_cx = Cell(x + radius);
+    const int64_t min_cy = Cell(y - radius), max_cy = Cell(y + radius);
+    for (int64_t cx = min_cx; cx <= max_cx; ++cx) {
+      for (int64_t cy = min_cy; cy <= max_cy; ++cy) {
+        auto it = cells_.find(CellKey(cx, cy));
+        if (it == cells_.end()) {
+          continue;
+        }
+        for (uint32_t i = it->second.first; i < it->second.second; ++i) {
+          const double dx = xs_[i] - x;
+          const double dy = ys_[i] - y;
+          const double distance = std::sqrt(dx * dx + dy * dy);
+          if (distance <= radius) {
+            f(points_[i], distance);
+          }
+        }
+      }
+    }
+  }
+
+private:
+  int64_t Cell(double coordinate) const {
+    return static_cast<int64_t>(std::floor(coordinate / cell_size_));
+  }
+
+  static uint64_t CellKey(int64_t cx, int64_t cy) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+  }
+
+  double cell_size_;
+  // The indexed points and their coordinates, grouped by cell.
+  std::vector<uint32_t> points_;
+  std::vector<double> xs_;
+  std::vector<double> ys_;
+  // Cell key -> [begin, end) in the vectors above.
+  absl::flat_hash_map<uint64_t, std::pair<uint32_t, uint32_t>> cells_;
+};
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cmath>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <rapidcheck/gtest.h>
+
+#include "StopGrid.h"
+
+namespace {
+
+std::vector<uint32_t> Within(const StopGrid& grid, double x, double y, double radius) {
+  std::vector<uint32_t> result;
+  grid.ForEachWithin(x, y, radius, [&result](uint32_t point, double) {
+    result.push_back(point);
+  });
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+}  // namespace
+
+TEST(StopGridTest, onlyIndexedPoints) {
+  const std::vector<double> xs = {0, 1, 2, 1000};
+  const std::vector<double> ys = {0, 0, 0, 0};
+  const StopGrid grid(xs, ys, {0, 2, 3}, 10);
+  EXPECT_THAT(Within(grid, 0, 0, 5), testing::ElementsAre(0, 2));
+  EXPECT_THAT(Within(grid, 995, 0, 5), testing::ElementsAre(3));
+  EXPECT_THAT(Within(grid, 500, 0, 5), testing::IsEmpty());
+}
+
+TEST(StopGridTest, negativeCoordinates) {
+  const std::vector<double> xs = {-15, -5, 5};
+  const std::vector<double> ys = {-15, -5, 5};
+  const StopGrid grid(xs, ys, {0, 1, 2}, 10);
+  EXPECT_THAT(Within(grid, -5, -5, 15), testing::ElementsAre(0, 1, 2));
+  EXPECT_THAT(Within(grid, -5, -5, 14), testing::ElementsAre(1));
+}
+
+RC_GTEST_PROP(StopGridTest, matchesBruteForce, ()) {
+  const size_t num_points = *rc::gen::inRange<size_t>(0, 200);
+  std::vector<double> xs, ys;
+  std::vector<uint32_t> points;
+  for (size_t i = 0; i < num_points; ++i) {
+    xs.push_back(*rc::gen::inRange(-2000, 2000));
+    ys.push_back(*rc::gen::inRange(-2000, 2000));
+    points.push_back(i);
+  }
+  const double cell_size = *rc::gen::inRange(1, 1000);
+  const double radius = *rc::gen::inRange(0, 1000);
+  const double x = *rc::gen::inRange(-2000, 2000);
+  const double y = *rc::gen::inRange(-2000, 2000);
+
+  std::vector<uint32_t> expected;
+  for (uint32_t point : points) {
+    if (std::sqrt((xs[point] - x) * (xs[point] - x) + (ys[point] - y) * (ys[point] - y)) <= radius) {
+      expected.push_back(point);
+    }
+  }
+  RC_ASSERT(Within(StopGrid(xs, ys, points, cell_size), x, y, radius) == expected);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
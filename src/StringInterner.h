@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+
+// Assigns dense indices 0, 1, 2, ... to distinct strings, in the order they are first added.
+class StringInterner {
+public:
+  StringInterner() = default;
+
+  // The index points into `strings_`, so copies have to rebuild it. Moves are fine because moving a
+  // deque does not move its elements.
+  StringInterner(const StringInterner& other) { *this = other; }
+  StringInterner& operator=(const StringInterner& other) {
+    if (this != &other) {
+      strings_.clear();
+      indices_.clear();
+      for (const std::string& s : other.strings_) {
+        GetOrAdd(s);
+      }
+    }
+    return *this;
+  }
+  StringInterner(StringInterner&&) = default;
+  StringInterner& operator=(StringInterner&&) = default;
+
+  // Returns the index of `s`, adding it if it is new.
+  uint32_t GetOrAdd(absl::string_view s) {
+    auto it = indices_.find(s);
+    if (it != indices_.end()) {
+      return it->second;
+    }
+    const uint32_t index = strings_.size();
+    strings_.emplace_back(s);
+    indices_.emplace(strings_.back(), index);
+    return index;
+  }
+
+  std::optional<uint32_t> Find(absl::string_view s) const {
+    auto it = indices_.find(s);
+    if (it == indices_.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  const std::string& Get(uint32_t index) const { return strings_[index]; }
+
+  uint32_t size() const { return strings_.size(); }
+
+private:
+  std::deque<std::string> strings_;
+  absl::flat_hash_map<absl::string_view, uint32_t> indices_;
+};
@@ -1,52 +1,36 @@
 #include "World.h"
 
 #include <algorithm>
-#include <sstream>
+#include <cctype>
+#include <iterator>
+#include <queue>
+#include <thread>
+#include <tuple>
 #include <variant>
 
-#include "absl/strings/ascii.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/match.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/str_cat.h"
-#include "absl/strings/str_split.h"
 #include "absl/strings/numbers.h"
 #include "absl/time/civil_time.h"
 
-#include "csv.hpp"
+#include "GTFSCsv.h"
+#include "Parallel.h"
+#include "ServiceCalendar.h"
+#include "StopGrid.h"
 
 // Parses an optional GTFS time, which is a string of the form "HH:MM:SS" or "".
 static std::variant<std::optional<WorldTime>, std::string> parseGTFSTime(absl::string_view time) {
   if (time.empty()) {
     return std::nullopt;
   }
-  std::vector<absl::string_view> parts = absl::StrSplit(time, ':');
-  if (parts.size() != 3) {
+  unsigned int seconds = 0;
+  if (!parseGTFSTimeSeconds(time, seconds)) {
     return absl::StrCat("Invalid time: ", time);
   }
-  bool success = true;
-  unsigned int hours = 0, minutes = 0, seconds = 0;
-  success &= absl::SimpleAtoi(parts[0], &hours);
-  success &= absl::SimpleAtoi(parts[1], &minutes);
-  success &= absl::SimpleAtoi(parts[2], &seconds);
-  if (!success) {
-    return absl::StrCat("Invalid time: ", time);
-  }
-  return WorldTime(hours * 3600 + minutes * 60 + seconds);
-}
-
-// Parses a required GTFS day, which is a string of the form "YYYYMMDD".
-static std::variant<absl::CivilDay, std::string> parseGTFSDay(absl::string_view day) {
-  if (day.size() != 8) {
-    return absl::StrCat("Invalid day: ", day);
-  }
-  unsigned int year = 0, month = 0, day_of_month = 0;
-  bool success = true;
-  success &= absl::SimpleAtoi(day.substr(0, 4), &year);
-  success &= absl::SimpleAtoi(day.substr(4, 2), &month);
-  success &= absl::SimpleAtoi(day.substr(6, 2), &day_of_month);
-  if (!success) {
-    return absl::StrCat("Invalid day: ", day);
-  }
-  return absl::CivilDay(year, month, day_of_month);
+  return WorldTime(seconds);
 }
 
 std::optional<std::string> readServiceIds(
@@ -55,109 +39,338 @@ std::optional<std::string> readServiceIds(
   absl::CivilDay date,
   std::unordered_set<std::string>& service_ids
 ) {
-  // Figure out the services to load based on the calendars.
-  std::ostringstream weekday_stream;
-  weekday_stream << absl::GetWeekday(date);
-  std::string weekday = absl::AsciiStrToLower(weekday_stream.str());
-  csv::CSVReader calendar_reader(directory + "/calendar.txt");
-  for (const csv::CSVRow& row : calendar_reader) {
-    std::string service_id = id_prefix + row["service_id"].get<>();
-    std::string start_date_raw = row["start_date"].get<>();
-    std::string end_date_raw = row["end_date"].get<>();
-    auto start_date_or = parseGTFSDay(start_date_raw);
-    if (std::holds_alternative<std::string>(start_date_or)) {
-      return std::get<1>(start_date_or);
-    }
-    absl::CivilDay start_date = std::get<0>(start_date_or);
-    auto end_date_or = parseGTFSDay(end_date_raw);
-    if (std::holds_alternative<std::string>(end_date_or)) {
-      return std::get<1>(end_date_or);
-    }
-    absl::CivilDay end_date = std::get<0>(end_date_or);
-    if (date >= start_date && date <= end_date && row[weekday].get<>() == "1") {
-      service_ids.insert(service_id);
-    }
-  }
-  csv::CSVReader calendar_dates_reader(directory + "/calendar_dates.txt");
-  for (const csv::CSVRow& row : calendar_dates_reader) {
-    std::string service_id = id_prefix + row["service_id"].get<>();
-    std::string exception_date_raw = row["date"].get<>();
-    auto exception_date_or = parseGTFSDay(exception_date_raw);
-    if (std::holds_alternative<std::string>(exception_date_or)) {
-      return std::get<1>(exception_date_or);
-    }
-    absl::CivilDay exception_date = std::get<0>(exception_date_or);
-    if (exception_date != date) {
+  ServiceCalendar calendar;
+  auto err = readServiceCalendar(directory, id_prefix, calendar);
+  if (err.has_value()) {
+    return err;
+  }
+  const std::vector<bool> active = calendar.ActiveServices(date);
+  for (ServiceIndex service = 0; service < calendar.size(); ++service) {
+    if (active[service]) {
+      service_ids.insert(calendar.service_ids().Get(service));
+    }
+  }
+  return std::nullopt;
+}
+
+WorldRouteIndex WorldRoutes::GetOrAdd(absl::string_view id) {
+  const WorldRouteIndex index = ids.GetOrAdd(id);
+  if (index == names.size()) {
+    names.emplace_back();
+  }
+  return index;
+}
+
+WorldStopIndex WorldStops::GetOrAdd(absl::string_view id) {
+  const WorldStopIndex index = ids.GetOrAdd(id);
+  if (index == names.size()) {
+    names.emplace_back();
+    parent_stations.push_back(kNoWorldIndex);
+    lats.emplace_back();
+    lons.emplace_back();
+    meters_x.push_back(0);
+    meters_y.push_back(0);
+    is_segment_stop.push_back(false);
+  }
+  return index;
+}
+
+WorldTripIndex WorldTrips::GetOrAdd(absl::string_view id) {
+  const WorldTripIndex index = ids.GetOrAdd(id);
+  if (index == routes.size()) {
+    routes.push_back(kNoWorldIndex);
+    services.push_back(kNoWorldIndex);
+    frequencies.emplace_back();
+    patterns.push_back(kNoWorldIndex);
+    time_offsets.push_back(0);
+  }
+  return index;
+}
+
+std::span<const WorldStopIndex> WorldTrips::PatternStops(WorldPatternIndex pattern) const {
+  return std::span<const WorldStopIndex>(
+    pattern_stops.data() + pattern_offsets[pattern],
+    pattern_stops.data() + pattern_offsets[pattern + 1]
+  );
+}
+
+WorldTripStopTimesView WorldTrips::StopTimes(WorldTripIndex trip) const {
+  if (patterns[trip] == kNoWorldIndex) {
+    return WorldTripStopTimesView();
+  }
+  return WorldTripStopTimesView(
+    PatternStops(patterns[trip]),
+    arrival_times.data() + time_offsets[trip],
+    departure_times.data() + time_offsets[trip]
+  );
+}
+
+// How a time is stored in `WorldTrips::arrival_times` and `WorldTrips::departure_times`.
+static uint32_t encodeWorldTime(const std::optional<WorldTime>& time) {
+  return time.has_value() ? time->seconds : kNoWorldTime;
+}
+
+void WorldTrips::SetStopTimes(WorldTripIndex first_trip, std::vector<std::vector<WorldTripStopTimes>>&& stop_times) {
+  // Find the pattern of each trip.
+  absl::flat_hash_map<std::vector<WorldStopIndex>, WorldPatternIndex> pattern_ids;
+  std::vector<WorldStopIndex> stops;
+  for (size_t i = 0; i < stop_times.size(); ++i) {
+    if (stop_times[i].empty()) {
       continue;
     }
-    if (row["exception_type"].get<>() == "2") {
-      if (service_ids.contains(service_id)) {
-        service_ids.erase(service_id);
-      }
-    } else if (row["exception_type"].get<>() == "1") {
-      if (!service_ids.contains(service_id)) {
-        service_ids.insert(service_id);
-      }
-    } else {
-      return "Unknown exception type in calendar_dates.txt: " + row["exception_type"].get<>();
+    stops.clear();
+    for (const WorldTripStopTimes& stop_time : stop_times[i]) {
+      stops.push_back(stop_time.stop);
     }
+    auto [it, inserted] = pattern_ids.try_emplace(stops, num_patterns());
+    if (inserted) {
+      pattern_stops.insert(pattern_stops.end(), stops.begin(), stops.end());
+      pattern_offsets.push_back(pattern_stops.size());
+    }
+    patterns[first_trip + i] = it->second;
+  }
+
+  // Lay out the times pattern by pattern, and by departure within a pattern.
+  auto first_departure = [&stop_times](size_t i) {
+    return stop_times[i].front().departure_time.value_or(WorldTime(0)).seconds;
+  };
+  std::vector<size_t> order;
+  for (size_t i = 0; i < stop_times.size(); ++i) {
+    if (!stop_times[i].empty()) {
+      order.push_back(i);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return std::make_tuple(patterns[first_trip + a], first_departure(a), a) <
+      std::make_tuple(patterns[first_trip + b], first_departure(b), b);
+  });
+  for (const size_t i : order) {
+    time_offsets[first_trip + i] = arrival_times.size();
+    for (const WorldTripStopTimes& stop_time : stop_times[i]) {
+      arrival_times.push_back(encodeWorldTime(stop_time.arrival_time));
+      departure_times.push_back(encodeWorldTime(stop_time.departure_time));
+    }
+    // Free each trip's stop times as soon as they are packed, so that they are not all held twice.
+    std::vector<WorldTripStopTimes>().swap(stop_times[i]);
   }
-  return std::nullopt;
 }
 
-std::optional<std::string> readGTFSToWorld(
+WorldTripStopTimesView WorldTrips::ScheduledStopTimes(WorldTripIndex trip) const {
+  auto scheduled = scheduled_stop_times.find(trip);
+  if (scheduled == scheduled_stop_times.end()) {
+    return StopTimes(trip);
+  }
+  const auto [pattern, time_offset] = scheduled->second;
+  if (pattern == kNoWorldIndex) {
+    return WorldTripStopTimesView();
+  }
+  return WorldTripStopTimesView(
+    PatternStops(pattern),
+    arrival_times.data() + time_offset,
+    departure_times.data() + time_offset
+  );
+}
+
+void WorldTrips::ReplaceStopTimes(WorldTripIndex trip, const std::vector<WorldTripStopTimes>& stop_times) {
+  const bool first_replacement =
+    scheduled_stop_times.try_emplace(trip, patterns[trip], time_offsets[trip]).second;
+  if (stop_times.empty()) {
+    patterns[trip] = kNoWorldIndex;
+    return;
+  }
+  auto same_stop = [](WorldStopIndex stop, const WorldTripStopTimes& stop_time) {
+    return stop == stop_time.stop;
+  };
+  const bool same_stops = patterns[trip] != kNoWorldIndex && std::ranges::equal(
+    PatternStops(patterns[trip]), stop_times, same_stop
+  );
+  if (!same_stops) {
+    for (const WorldTripStopTimes& stop_time : stop_times) {
+      pattern_stops.push_back(stop_time.stop);
+    }
+    pattern_offsets.push_back(pattern_stops.size());
+    patterns[trip] = num_patterns() - 1;
+  }
+  // The first replacement must not overwrite the scheduled times.
+  if (first_replacement || !same_stops) {
+    time_offsets[trip] = arrival_times.size();
+    arrival_times.resize(arrival_times.size() + stop_times.size());
+    departure_times.resize(departure_times.size() + stop_times.size());
+  }
+  for (size_t i = 0; i < stop_times.size(); ++i) {
+    arrival_times[time_offsets[trip] + i] = encodeWorldTime(stop_times[i].arrival_time);
+    departure_times[time_offsets[trip] + i] = encodeWorldTime(stop_times[i].departure_time);
+  }
+}
+
+// Whether `filter` keeps the route `route_id`, run by `agency_id` (empty if the route does not say).
+// Both ids have the feed prefix.
+static bool keepRoute(const WorldFilter& filter, const std::string& route_id, const std::string& agency_id) {
+  if (filter.exclude_routes.contains(route_id) ||
+      (!filter.include_routes.empty() && !filter.include_routes.contains(route_id))) {
+    return false;
+  }
+  if (agency_id.empty()) {
+    return true;
+  }
+  return !filter.exclude_agencies.contains(agency_id) &&
+    (filter.include_agencies.empty() || filter.include_agencies.contains(agency_id));
+}
+
+// Whether `filter`'s bounding box, if any, contains `stop`.
+static bool inBoundingBox(const WorldFilter& filter, const WorldStops& stops, WorldStopIndex stop) {
+  if (!filter.bounding_box.has_value()) {
+    return true;
+  }
+  const WorldFilter::BoundingBox& box = *filter.bounding_box;
+  double lat = 0, lon = 0;
+  // These were checked when the stop was read.
+  (void)absl::SimpleAtod(stops.lats[stop], &lat);
+  (void)absl::SimpleAtod(stops.lons[stop], &lon);
+  return lat >= box.min_lat && lat <= box.max_lat && lon >= box.min_lon && lon <= box.max_lon;
+}
+
+std::optional<std::string> readGTFSToWorldForDates(
   const std::string& directory,
   const std::string& id_prefix,
-  absl::CivilDay date,
+  const std::vector<absl::CivilDay>& dates,
   const std::unordered_set<std::string>* segment_stop_ids,
-  World& world
+  const WorldFilter& filter,
+  World& world,
+  unsigned int num_threads
 ) {
-  std::unordered_set<std::string> service_ids;
-  auto service_ids_err = readServiceIds(directory, id_prefix, date, service_ids);
-  if (service_ids_err.has_value()) {
-    return service_ids_err;
+  ServiceCalendar calendar;
+  auto calendar_err = readServiceCalendar(directory, id_prefix, calendar);
+  if (calendar_err.has_value()) {
+    return calendar_err;
   }
+  std::vector<bool> active_services(calendar.size());
+  for (const absl::CivilDay date : dates) {
+    const std::vector<bool> active_on_date = calendar.ActiveServices(date);
+    for (ServiceIndex service = 0; service < calendar.size(); ++service) {
+      active_services[service] = active_services[service] || active_on_date[service];
+    }
+  }
+  const std::vector<ServiceIndex> world_services = world.calendar.Merge(calendar);
+
+  // Ids read from the files get the prefix prepended in this buffer, which is reused so that
+  // looking up an id does not allocate.
+  std::string id = id_prefix;
+  auto prefixed = [&id, &id_prefix](absl::string_view raw_id) -> const std::string& {
+    id.resize(id_prefix.size());
+    id.append(raw_id.data(), raw_id.size());
+    return id;
+  };
 
   // Load routes.
-  csv::CSVReader routes_reader(directory + "/routes.txt");
-  for (const csv::CSVRow& row : routes_reader) {
-    std::string route_id = id_prefix + row["route_id"].get<>();
-    std::string route_short_name = row["route_short_name"].get<>();
-    world.routes[route_id] = WorldRoute{route_short_name};
-  }
-
-  // Load stops.
-  csv::CSVReader stops_reader(directory + "/stops.txt");
-  for (const csv::CSVRow& row : stops_reader) {
-    std::string stop_id = id_prefix + row["stop_id"].get<>();
-    std::string stop_name = row["stop_name"].get<>();
-    std::string parent_station_raw = row["parent_station"].get<>();
-    std::string lat = row["stop_lat"].get<>();
-    std::string lon = row["stop_lon"].get<>();
-    std::optional<std::string> parent_station = parent_station_raw.empty() ? std::nullopt : std::make_optional(id_prefix + parent_station_raw);
-    world.stops[stop_id] = WorldStop{
-      stop_name,
-      parent_station,
-      lat,
-      lon,
-      88080.0 * (std::stod(lon) + 122.5),
-      111320.0 * (std::stod(lat) - 37.3),
-    };
+  GTFSCsvReader routes_reader;
+  size_t route_id_col, route_short_name_col;
+  auto routes_err = openGTFSCsv(
+    directory + "/routes.txt",
+    {{"route_id", &route_id_col}, {"route_short_name", &route_short_name_col}},
+    routes_reader
+  );
+  if (routes_err.has_value()) {
+    return routes_err;
+  }
+  const std::optional<size_t> agency_id_col = routes_reader.FindColumn("agency_id");
+  // Routes that `filter` leaves out, by their id in the feed. Their trips are skipped.
+  absl::flat_hash_set<std::string> filtered_routes;
+  std::string agency_id;
+  while (routes_reader.Next()) {
+    const absl::string_view raw_agency_id =
+      agency_id_col.has_value() ? routes_reader.Field(*agency_id_col) : absl::string_view();
+    agency_id = raw_agency_id.empty() ? std::string() : absl::StrCat(id_prefix, raw_agency_id);
+    if (!keepRoute(filter, prefixed(routes_reader.Field(route_id_col)), agency_id)) {
+      filtered_routes.insert(std::string(routes_reader.Field(route_id_col)));
+      continue;
+    }
+    const WorldRouteIndex route = world.routes.GetOrAdd(prefixed(routes_reader.Field(route_id_col)));
+    world.routes.names[route] = std::string(routes_reader.Field(route_short_name_col));
+  }
+  if (routes_reader.Error().has_value()) {
+    return routes_reader.Error();
+  }
+
+  // Load stops. A parent station can come after its children in stops.txt, so parents are resolved
+  // after all the stops have been added.
+  GTFSCsvReader stops_reader;
+  size_t stop_id_col, stop_name_col, stop_lat_col, stop_lon_col;
+  auto stops_err = openGTFSCsv(
+    directory + "/stops.txt",
+    {{"stop_id", &stop_id_col}, {"stop_name", &stop_name_col}, {"stop_lat", &stop_lat_col}, {"stop_lon", &stop_lon_col}},
+    stops_reader
+  );
+  if (stops_err.has_value()) {
+    return stops_err;
+  }
+  const std::optional<size_t> parent_station_col = stops_reader.FindColumn("parent_station");
+  std::vector<std::pair<WorldStopIndex, std::string>> parent_station_ids;
+  const WorldStopIndex first_stop = world.stops.size();
+  while (stops_reader.Next()) {
+    const WorldStopIndex stop = world.stops.GetOrAdd(prefixed(stops_reader.Field(stop_id_col)));
+    absl::string_view lat = stops_reader.Field(stop_lat_col);
+    absl::string_view lon = stops_reader.Field(stop_lon_col);
+    double lat_degrees = 0, lon_degrees = 0;
+    if (!absl::SimpleAtod(lat, &lat_degrees) || !absl::SimpleAtod(lon, &lon_degrees)) {
+      return absl::StrCat("Invalid location for stop ", id, ": ", lat, ",", lon);
+    }
     // Approximate conversions around this area:
     // 1 lat = 111,320m
     // 1 lon = 88,080m
+    world.stops.names[stop] = std::string(stops_reader.Field(stop_name_col));
+    world.stops.meters_x[stop] = 88080.0 * (lon_degrees + 122.5);
+    world.stops.meters_y[stop] = 111320.0 * (lat_degrees - 37.3);
+    world.stops.lats[stop] = std::string(lat);
+    world.stops.lons[stop] = std::string(lon);
+    world.stops.parent_stations[stop] = kNoWorldIndex;
+    const absl::string_view parent_station_raw =
+      parent_station_col.has_value() ? stops_reader.Field(*parent_station_col) : absl::string_view();
+    if (!parent_station_raw.empty()) {
+      parent_station_ids.emplace_back(stop, prefixed(parent_station_raw));
+    }
+  }
+  if (stops_reader.Error().has_value()) {
+    return stops_reader.Error();
+  }
+  for (const auto& [stop, parent_station_id] : parent_station_ids) {
+    std::optional<WorldStopIndex> parent_station = world.stops.ids.Find(parent_station_id);
+    if (!parent_station.has_value()) {
+      return absl::StrCat("Parent station of ", world.stops.ids.Get(stop), " not found: ", parent_station_id);
+    }
+    world.stops.parent_stations[stop] = *parent_station;
+  }
+
+  // Trips are interpreted as stopping at the root ancestor of each stop, so the stop_times pass
+  // below looks that up directly, by the id as it appears in the feed. Stops whose root is outside
+  // of the filter's bounding box map to kNoWorldIndex.
+  absl::flat_hash_map<absl::string_view, WorldStopIndex> root_stops_by_feed_id;
+  root_stops_by_feed_id.reserve(world.stops.size() - first_stop);
+  for (WorldStopIndex stop = first_stop; stop < world.stops.size(); ++stop) {
+    WorldStopIndex root = stop;
+    while (world.stops.parent_stations[root] != kNoWorldIndex) {
+      root = world.stops.parent_stations[root];
+    }
+    // The interner's strings never move, so views of them stay valid.
+    root_stops_by_feed_id[absl::string_view(world.stops.ids.Get(stop)).substr(id_prefix.size())] =
+      inBoundingBox(filter, world.stops, root) ? root : kNoWorldIndex;
   }
 
   // Validate segment_stop_ids.
+  for (WorldStopIndex stop = first_stop; stop < world.stops.size(); ++stop) {
+    world.stops.is_segment_stop[stop] = segment_stop_ids == nullptr;
+  }
   if (segment_stop_ids != nullptr) {
-    std::vector<const std::string> stops_not_found;
-    std::vector<const std::string> stops_not_root;
+    std::vector<std::string> stops_not_found;
+    std::vector<std::string> stops_not_root;
     for (const std::string& stop_id : *segment_stop_ids) {
-      auto it = world.stops.find(stop_id);
-      if (it == world.stops.end()) {
+      std::optional<WorldStopIndex> stop = world.stops.ids.Find(stop_id);
+      if (!stop.has_value()) {
         stops_not_found.push_back(stop_id);
-      } else if (it->second.parent_station_id.has_value()) {
+      } else if (world.stops.parent_stations[*stop] != kNoWorldIndex) {
         stops_not_root.push_back(stop_id);
+      } else {
+        world.stops.is_segment_stop[*stop] = true;
       }
     }
     if (!stops_not_found.empty() || !stops_not_root.empty()) {
@@ -172,268 +385,1379 @@ std::optional<std::string> readGTFSToWorld(
     }
   }
 
-  // Load trips.
-  csv::CSVReader trips_reader(directory + "/trips.txt");
-  for (const csv::CSVRow& row : trips_reader) {
-    if (!service_ids.contains(id_prefix + row["service_id"].get<>())) {
+  // Load trips. `world` might already have trips from other feeds, and only the ones from this feed
+  // need to be processed below.
+  const WorldTripIndex first_trip = world.trips.size();
+  GTFSCsvReader trips_reader;
+  size_t trip_route_id_col, service_id_col, trip_id_col;
+  auto trips_err = openGTFSCsv(
+    directory + "/trips.txt",
+    {{"route_id", &trip_route_id_col}, {"service_id", &service_id_col}, {"trip_id", &trip_id_col}},
+    trips_reader
+  );
+  if (trips_err.has_value()) {
+    return trips_err;
+  }
+  while (trips_reader.Next()) {
+    std::optional<ServiceIndex> service = calendar.service_ids().Find(prefixed(trips_reader.Field(service_id_col)));
+    if (!service.has_value() || !active_services[*service] ||
+        filtered_routes.contains(trips_reader.Field(trip_route_id_col))) {
       continue;
     }
-    std::string trip_id = id_prefix + row["trip_id"].get<>();
-    std::string route_id = id_prefix + row["route_id"].get<>();
-    world.trips[trip_id] = WorldTrip{route_id, {}};
+    const WorldTripIndex trip = world.trips.GetOrAdd(prefixed(trips_reader.Field(trip_id_col)));
+    world.trips.routes[trip] = world.routes.GetOrAdd(prefixed(trips_reader.Field(trip_route_id_col)));
+    world.trips.services[trip] = world_services[*service];
+  }
+  if (trips_reader.Error().has_value()) {
+    return trips_reader.Error();
   }
 
-  // Load stop times into the trips.
-  csv::CSVReader stop_times_reader(directory + "/stop_times.txt");
-  for (const csv::CSVRow& row : stop_times_reader) {
-    std::string trip_id = id_prefix + row["trip_id"].get<>();
-    std::string stop_id = id_prefix + row["stop_id"].get<>();
-    auto trip_it = world.trips.find(trip_id);
-    if (trip_it == world.trips.end()) {
-      // This is expected because we only include trips from some services.
-      continue;
+  // Load frequencies, which is optional. Finishing the trips below needs to know which trips are
+  // frequency-based.
+  const std::string frequencies_path = directory + "/frequencies.txt";
+  if (gtfsFileExists(frequencies_path)) {
+    GTFSCsvReader frequencies_reader;
+    size_t frequency_trip_id_col, start_time_col, end_time_col, headway_secs_col;
+    auto frequencies_err = openGTFSCsv(
+      frequencies_path,
+      {
+        {"trip_id", &frequency_trip_id_col},
+        {"start_time", &start_time_col},
+        {"end_time", &end_time_col},
+        {"headway_secs", &headway_secs_col},
+      },
+      frequencies_reader
+    );
+    if (frequencies_err.has_value()) {
+      return frequencies_err;
     }
-    for (;;) {
-      auto stop_it = world.stops.find(stop_id);
-      if (stop_it == world.stops.end()) {
-        return "While reading stop_times for trip " + trip_id + ", stop not found: " + stop_id;
+    while (frequencies_reader.Next()) {
+      std::optional<WorldTripIndex> trip = world.trips.ids.Find(prefixed(frequencies_reader.Field(frequency_trip_id_col)));
+      if (!trip.has_value() || *trip < first_trip) {
+        continue;
       }
-      if (stop_it->second.parent_station_id.has_value()) {
-        stop_id = stop_it->second.parent_station_id.value();
-      } else {
-        break;
+      unsigned int start_time = 0, end_time = 0, headway = 0;
+      if (!parseGTFSTimeSeconds(frequencies_reader.Field(start_time_col), start_time) ||
+          !parseGTFSTimeSeconds(frequencies_reader.Field(end_time_col), end_time) ||
+          !absl::SimpleAtoi(frequencies_reader.Field(headway_secs_col), &headway) ||
+          headway == 0) {
+        return absl::StrCat("Invalid frequency for trip ", world.trips.ids.Get(*trip));
+      }
+      if (end_time <= start_time) {
+        continue;
+      }
+      // Runs start every `headway` seconds in [start_time, end_time).
+      const unsigned int last_start = start_time + (end_time - start_time - 1) / headway * headway;
+      world.trips.frequencies[*trip].push_back(
+        last_start == start_time ? Range(start_time, start_time, 0) : Range(start_time, last_start, headway)
+      );
+    }
+    if (frequencies_reader.Error().has_value()) {
+      return frequencies_reader.Error();
+    }
+  }
+
+  // Drop a trip's stop times outside of the filter's time window, then sort and check the rest, and
+  // then eliminate consecutive duplicate stops because I don't like them. Trips are independent, so
+  // this can run on any thread once a trip has all its stop times.
+  const bool has_window = filter.earliest.has_value() || filter.latest.has_value();
+  const unsigned int earliest = filter.earliest.value_or(WorldTime(0)).seconds;
+  const unsigned int latest = filter.latest.value_or(WorldTime(std::numeric_limits<unsigned int>::max())).seconds;
+  auto in_window = [earliest, latest](const std::optional<WorldTime>& time) {
+    return time.has_value() && time->seconds >= earliest && time->seconds <= latest;
+  };
+  std::vector<char> wacky(world.trips.size() - first_trip);
+  // The stop times of this feed's trips, which are packed into `world.trips` once they are all read.
+  std::vector<std::vector<WorldTripStopTimes>> feed_stop_times(world.trips.size() - first_trip);
+  auto finish_trip = [&](WorldTripIndex trip) {
+    auto& stop_times = feed_stop_times[trip - first_trip];
+    if (has_window && world.trips.frequencies[trip].empty()) {
+      // Stop times without any times are kept; segmenting skips over them anyway.
+      std::erase_if(stop_times, [&in_window](const WorldTripStopTimes& x) {
+        return (x.arrival_time.has_value() || x.departure_time.has_value()) &&
+          !in_window(x.arrival_time) && !in_window(x.departure_time);
+      });
+    }
+    std::sort(stop_times.begin(), stop_times.end(), [](const WorldTripStopTimes& a, const WorldTripStopTimes& b) {
+      return a.departure_time.value_or(WorldTime(0)).seconds < b.departure_time.value_or(WorldTime(0)).seconds;
+    });
+    bool sorted = std::is_sorted(stop_times.begin(), stop_times.end(), [](const WorldTripStopTimes& a, const WorldTripStopTimes& b) {
+      return a.arrival_time.value_or(WorldTime(0)).seconds < b.arrival_time.value_or(WorldTime(0)).seconds;
+    });
+    if (!sorted) {
+      wacky[trip - first_trip] = true;
+      return;
+    }
+
+    for (size_t i = 1; i < stop_times.size(); ++i) {
+      auto& prev = stop_times[i - 1];
+      auto& cur = stop_times[i];
+      if (prev.stop == cur.stop) {
+        prev.stop = kNoWorldIndex;
+        cur.arrival_time = prev.arrival_time;
       }
     }
-    auto arrival_time = parseGTFSTime(row["arrival_time"].get<>());
+    std::erase_if(
+      stop_times,
+      [](const WorldTripStopTimes& x) { return x.stop == kNoWorldIndex; }
+    );
+  };
+
+  // Load stop times into the trips.
+  GTFSCsvReader stop_times_reader;
+  size_t stop_time_trip_id_col, arrival_time_col, departure_time_col, stop_time_stop_id_col;
+  auto open_stop_times = [&]() {
+    return openGTFSCsv(
+      directory + "/stop_times.txt",
+      {
+        {"trip_id", &stop_time_trip_id_col},
+        {"arrival_time", &arrival_time_col},
+        {"departure_time", &departure_time_col},
+        {"stop_id", &stop_time_stop_id_col},
+      },
+      stop_times_reader
+    );
+  };
+  // Adds the current row of `stop_times_reader`, which is for `trip`, to `stop_times`.
+  auto read_stop_time = [&](WorldTripIndex trip, std::vector<WorldTripStopTimes>& stop_times) -> std::optional<std::string> {
+    auto stop = root_stops_by_feed_id.find(stop_times_reader.Field(stop_time_stop_id_col));
+    if (stop == root_stops_by_feed_id.end()) {
+      return absl::StrCat(
+        "While reading stop_times for trip ", world.trips.ids.Get(trip),
+        ", stop not found: ", prefixed(stop_times_reader.Field(stop_time_stop_id_col))
+      );
+    }
+    if (stop->second == kNoWorldIndex) {
+      // Outside of the bounding box. The trip rides straight through.
+      return std::nullopt;
+    }
+    auto arrival_time = parseGTFSTime(stop_times_reader.Field(arrival_time_col));
     if (std::holds_alternative<std::string>(arrival_time)) {
       return std::get<1>(arrival_time);
     }
-    auto departure_time = parseGTFSTime(row["departure_time"].get<>());
+    auto departure_time = parseGTFSTime(stop_times_reader.Field(departure_time_col));
     if (std::holds_alternative<std::string>(departure_time)) {
       return std::get<1>(departure_time);
     }
-    trip_it->second.stop_times.push_back(
+    stop_times.push_back(
       WorldTripStopTimes{
-        stop_id,
+        stop->second,
         std::get<0>(arrival_time),
         std::get<0>(departure_time),
         true, // TODO
-        // row["timepoint"].get<>() == "1",
+        // timepoint == "1",
       }
     );
+    return std::nullopt;
+  };
+  auto stop_times_err = open_stop_times();
+  if (stop_times_err.has_value()) {
+    return stop_times_err;
   }
 
-  // Error checking on the stop times.
-  for (auto& entry: world.trips) {
-    auto& trip = entry.second;
-    std::sort(trip.stop_times.begin(), trip.stop_times.end(), [](const WorldTripStopTimes& a, const WorldTripStopTimes& b) {
-      return a.departure_time.value_or(WorldTime(0)).seconds < b.departure_time.value_or(WorldTime(0)).seconds;
+  // stop_times.txt is parsed on this thread while worker threads finish the trips that have all
+  // their stop times. Feeds almost always group stop_times.txt by trip, so a trip is taken to be
+  // complete as soon as a row for another trip comes along, and is handed off in a chunk with other
+  // complete trips. The queue is bounded so that unfinished stop times, which the time window can
+  // shrink a lot, do not pile up when parsing gets ahead of the workers. With only one thread, trips
+  // are finished on this thread as they are handed off.
+  constexpr size_t kTripsPerFinishChunk = 64;
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const size_t num_finishers = num_threads - 1;
+  BoundedQueue<std::vector<WorldTripIndex>> finish_queue(2 * num_finishers);
+  std::vector<std::thread> finishers;
+  for (size_t i = 0; i < num_finishers; ++i) {
+    finishers.emplace_back([&finish_queue, &finish_trip]() {
+      while (std::optional<std::vector<WorldTripIndex>> chunk = finish_queue.Pop()) {
+        for (const WorldTripIndex trip : *chunk) {
+          finish_trip(trip);
+        }
+      }
     });
-    bool sorted = std::is_sorted(trip.stop_times.begin(), trip.stop_times.end(), [](const WorldTripStopTimes& a, const WorldTripStopTimes& b) {
-      return a.arrival_time.value_or(WorldTime(0)).seconds < b.arrival_time.value_or(WorldTime(0)).seconds;
+  }
+
+  // A trip whose rows turn up again after it was handed off is "split". Its rows from then on are
+  // kept aside, because a worker might be finishing the earlier ones. The rows that each trip was
+  // read from before it was handed off, [first_rows, end_rows), are noted so that the earlier ones
+  // can be read again below.
+  enum TripState : char { kUnread, kReading, kHandedOff, kSplit };
+  std::vector<TripState> trip_states(world.trips.size() - first_trip, kUnread);
+  std::vector<size_t> first_rows(world.trips.size() - first_trip);
+  std::vector<size_t> end_rows(world.trips.size() - first_trip);
+  std::vector<WorldTripIndex> split_trips;
+  absl::flat_hash_map<WorldTripIndex, std::vector<WorldTripStopTimes>> late_stop_times;
+  std::optional<WorldTripIndex> reading_trip;
+  std::vector<WorldTripIndex> chunk;
+  auto hand_off = [&](WorldTripIndex trip, size_t end_row) {
+    trip_states[trip - first_trip] = kHandedOff;
+    end_rows[trip - first_trip] = end_row;
+    if (finishers.empty()) {
+      finish_trip(trip);
+      return;
+    }
+    chunk.push_back(trip);
+    if (chunk.size() == kTripsPerFinishChunk) {
+      finish_queue.Push(std::move(chunk));
+      chunk.clear();
+    }
+  };
+  std::optional<std::string> read_err;
+  size_t row = 0;
+  for (; stop_times_reader.Next(); ++row) {
+    std::optional<WorldTripIndex> trip = world.trips.ids.Find(prefixed(stop_times_reader.Field(stop_time_trip_id_col)));
+    if (!trip.has_value() || *trip < first_trip) {
+      // This is expected because we only include trips from some services.
+      continue;
+    }
+    TripState& state = trip_states[*trip - first_trip];
+    if (state == kHandedOff) {
+      state = kSplit;
+      split_trips.push_back(*trip);
+    }
+    if (state == kSplit) {
+      read_err = read_stop_time(*trip, late_stop_times[*trip]);
+      if (read_err.has_value()) {
+        break;
+      }
+      continue;
+    }
+    if (state == kUnread) {
+      if (reading_trip.has_value()) {
+        hand_off(*reading_trip, row);
+      }
+      reading_trip = *trip;
+      state = kReading;
+      first_rows[*trip - first_trip] = row;
+    }
+    read_err = read_stop_time(*trip, feed_stop_times[*trip - first_trip]);
+    if (read_err.has_value()) {
+      break;
+    }
+  }
+  if (!read_err.has_value()) {
+    read_err = stop_times_reader.Error();
+  }
+  if (!read_err.has_value() && reading_trip.has_value()) {
+    hand_off(*reading_trip, row);
+  }
+  if (!chunk.empty()) {
+    finish_queue.Push(std::move(chunk));
+  }
+  finish_queue.Close();
+  for (std::thread& finisher : finishers) {
+    finisher.join();
+  }
+  if (read_err.has_value()) {
+    return read_err;
+  }
+
+  // Split trips were finished with only the rows they were read from before they were handed off.
+  // Those rows are read again, in file order, skipping the rows of other trips among them, which
+  // were kept aside for split trips or are not in the feed's World. The rows kept aside for the
+  // trip are added after them. Reading stops after the last of them. There are few split trips, so
+  // this thread finishes them itself rather than going over `num_threads`.
+  if (!split_trips.empty()) {
+    std::sort(split_trips.begin(), split_trips.end(), [&first_rows, first_trip](WorldTripIndex a, WorldTripIndex b) {
+      return first_rows[a - first_trip] < first_rows[b - first_trip];
     });
-    if (!sorted) {
-      return "Trip " + entry.first + " has wacky stop times.";
+    stop_times_err = open_stop_times();
+    if (stop_times_err.has_value()) {
+      return stop_times_err;
+    }
+    row = 0;
+    bool has_row = stop_times_reader.Next();
+    for (const WorldTripIndex trip : split_trips) {
+      std::vector<WorldTripStopTimes>& stop_times = feed_stop_times[trip - first_trip];
+      stop_times.clear();
+      wacky[trip - first_trip] = false;
+      for (; has_row && row < first_rows[trip - first_trip]; ++row) {
+        has_row = stop_times_reader.Next();
+      }
+      for (; has_row && row < end_rows[trip - first_trip]; ++row, has_row = stop_times_reader.Next()) {
+        std::optional<WorldTripIndex> row_trip = world.trips.ids.Find(prefixed(stop_times_reader.Field(stop_time_trip_id_col)));
+        if (row_trip != trip) {
+          continue;
+        }
+        read_err = read_stop_time(trip, stop_times);
+        if (read_err.has_value()) {
+          return read_err;
+        }
+      }
+      const std::vector<WorldTripStopTimes>& late = late_stop_times[trip];
+      stop_times.insert(stop_times.end(), late.begin(), late.end());
+      finish_trip(trip);
+    }
+    if (stop_times_reader.Error().has_value()) {
+      return stop_times_reader.Error();
     }
   }
 
-  // Eliminate consecutive duplicate stops because I don't like them.
-  for (auto& entry : world.trips) {
-    auto& trip = entry.second;
-    for (size_t i = 1; i < trip.stop_times.size(); ++i) {
-      auto& prev = trip.stop_times[i - 1];
-      auto& cur = trip.stop_times[i];
-      if (prev.stop_id == cur.stop_id) {
-        prev.stop_id = "ERASE ME";
-        cur.arrival_time = prev.arrival_time;
+  // Report the first bad trip, like a sequential pass would.
+  for (size_t i = 0; i < wacky.size(); ++i) {
+    if (wacky[i]) {
+      return "Trip " + world.trips.ids.Get(first_trip + i) + " has wacky stop times.";
+    }
+  }
+
+  world.trips.SetStopTimes(first_trip, std::move(feed_stop_times));
+  return std::nullopt;
+}
+
+std::optional<std::string> readGTFSToWorld(
+  const std::string& directory,
+  const std::string& id_prefix,
+  absl::CivilDay date,
+  const std::unordered_set<std::string>* segment_stop_ids,
+  World& world
+) {
+  World feed_world;
+  auto err = readGTFSToWorldForDates(directory, id_prefix, {date}, segment_stop_ids, WorldFilter(), feed_world);
+  if (err.has_value()) {
+    return err;
+  }
+  SegmentWorld(date, feed_world);
+  MergeWorld(std::move(feed_world), world);
+  return std::nullopt;
+}
+
+// Ordinary trips that make the same segment at least this many times in a row at a regular
+// interval are compressed into a WorldRepeatingSegment.
+constexpr size_t kMinRepeatingDepartures = 3;
+
+// Segments made by some of the trips, before they are combined into the World.
+struct SegmentBuffers {
+  std::vector<WorldSegment> segments;
+  std::vector<WorldRepeatingSegment> repeating_segments;
+  // `first_run`s of `repeating_segments` index this.
+  std::vector<WorldTripRun> repeating_segment_runs;
+};
+
+// Adds a WorldRepeatingSegment for each of the segments of the frequency-based `trip`, for each
+// of its frequencies.
+static void segmentFrequencyTrip(WorldTripIndex trip, const World& world, SegmentBuffers& out) {
+  const WorldTripStopTimesView stop_times = world.trips.StopTimes(trip);
+  if (stop_times.empty() || !stop_times.front().departure_time.has_value()) {
+    return;
+  }
+  // The template's times are relative to when it leaves its first stop.
+  const unsigned int template_start = stop_times.front().departure_time->seconds;
+  std::optional<WorldTripStopTimes> prev;
+  for (const WorldTripStopTimes stop_time : stop_times) {
+    if (!world.stops.is_segment_stop[stop_time.stop] ||
+        !stop_time.departure_time.has_value() ||
+        !stop_time.arrival_time.has_value()) {
+      continue;
+    }
+    if (prev.has_value() && prev->stop == stop_time.stop) {
+      // Two stops that `UnifyStations` made into one: the trip just dwells there.
+      prev = stop_time;
+      continue;
+    }
+    if (prev.has_value()) {
+      const unsigned int offset = prev->departure_time->seconds - template_start;
+      for (const Range& starts : world.trips.frequencies[trip]) {
+        out.repeating_segments.push_back(WorldRepeatingSegment{
+          .departures = Range(starts.start + offset, starts.finish + offset, starts.interval),
+          .duration = WorldDuration(stop_time.arrival_time->seconds - prev->departure_time->seconds),
+          .origin_stop = prev->stop,
+          .destination_stop = stop_time.stop,
+          .route = world.trips.routes[trip],
+          .first_run = static_cast<uint32_t>(out.repeating_segment_runs.size()),
+        });
+        for (const unsigned int start : starts) {
+          out.repeating_segment_runs.push_back(WorldTripRun{trip, WorldTime(start)});
+        }
       }
     }
-    std::erase_if(
-      trip.stop_times,
-      [](const WorldTripStopTimes& x) { return x.stop_id == "ERASE ME"; }
-    );
+    prev = stop_time;
   }
+}
 
-  // Segment the trips.
-  for (const auto& entry : world.trips) {
-    const auto& trip = entry.second;
+// Moves runs of segments in `world.segments` that depart at a regular interval into
+// `world.repeating_segments`. Segments are only compressed together if they have the same stops,
+// route and duration.
+static void compressRegularSegments(World& world, unsigned int num_threads) {
+  // Group the segments, ordering each group by departure time. Ties keep the order of
+  // `world.segments`, which comes from the trips in id order.
+  auto key = [](const WorldSegment& s) {
+    return std::make_tuple(s.origin_stop, s.destination_stop, s.route, s.duration.seconds, s.departure_time.seconds);
+  };
+  ParallelStableSort(world.segments, [&key](const WorldSegment& a, const WorldSegment& b) {
+    return key(a) < key(b);
+  }, num_threads);
 
-    std::optional<WorldTripStopTimes> prev;
-    for (const auto& stop_time : trip.stop_times) {
-      if (segment_stop_ids != nullptr && !segment_stop_ids->contains(stop_time.stop_id)) {
-        continue;
+  std::vector<WorldSegment> remaining;
+  const std::vector<WorldSegment>& segments = world.segments;
+  auto same_group = [&segments](size_t i, size_t j) {
+    return segments[i].origin_stop == segments[j].origin_stop &&
+      segments[i].destination_stop == segments[j].destination_stop &&
+      segments[i].route == segments[j].route &&
+      segments[i].duration.seconds == segments[j].duration.seconds;
+  };
+  size_t i = 0;
+  while (i < segments.size()) {
+    // Find the longest run of departures from `i` with a constant, nonzero interval.
+    size_t end = i + 1;
+    if (end < segments.size() && same_group(i, end)) {
+      const unsigned int interval = segments[end].departure_time.seconds - segments[i].departure_time.seconds;
+      while (
+        interval > 0 &&
+        end < segments.size() &&
+        same_group(i, end) &&
+        segments[end].departure_time.seconds - segments[end - 1].departure_time.seconds == interval
+      ) {
+        ++end;
       }
+    }
+    if (end - i < kMinRepeatingDepartures) {
+      remaining.push_back(segments[i]);
+      ++i;
+      continue;
+    }
 
-      if (!stop_time.departure_time.has_value() || !stop_time.arrival_time.has_value()) {
-        // !stop_time.timepoint || 
-        // TODO: Maybe handle non-timepoints and things without dep/arr times?
-        continue;
+    const WorldSegment& first = segments[i];
+    world.repeating_segments.push_back(WorldRepeatingSegment{
+      .departures = Range(
+        first.departure_time.seconds,
+        segments[end - 1].departure_time.seconds,
+        segments[i + 1].departure_time.seconds - first.departure_time.seconds
+      ),
+      .duration = first.duration,
+      .origin_stop = first.origin_stop,
+      .destination_stop = first.destination_stop,
+      .route = first.route,
+      .first_run = static_cast<uint32_t>(world.repeating_segment_runs.size()),
+    });
+    for (size_t j = i; j < end; ++j) {
+      world.repeating_segment_runs.push_back(WorldTripRun{segments[j].trip, WorldTime()});
+    }
+    i = end;
+  }
+  world.segments = std::move(remaining);
+}
+
+// Adds the segments of `trip` to `out`.
+static void segmentTrip(WorldTripIndex trip, const World& world, SegmentBuffers& out) {
+  if (!world.trips.frequencies[trip].empty()) {
+    segmentFrequencyTrip(trip, world, out);
+    return;
+  }
+  std::optional<WorldTripStopTimes> prev;
+  for (const WorldTripStopTimes stop_time : world.trips.StopTimes(trip)) {
+    if (!world.stops.is_segment_stop[stop_time.stop]) {
+      continue;
+    }
+
+    if (!stop_time.departure_time.has_value() || !stop_time.arrival_time.has_value()) {
+      // !stop_time.timepoint || 
+      // TODO: Maybe handle non-timepoints and things without dep/arr times?
+      continue;
+    }
+
+    if (prev.has_value() && prev->stop == stop_time.stop) {
+      prev = stop_time;
+      continue;
+    }
+    if (prev.has_value()) {
+      const WorldTime departure_time = prev->departure_time.value();
+      const WorldTime arrival_time = stop_time.arrival_time.value();
+      out.segments.push_back(WorldSegment{
+        .departure_time = departure_time,
+        .duration = WorldDuration(arrival_time.seconds - departure_time.seconds),
+        .origin_stop = prev->stop,
+        .destination_stop = stop_time.stop,
+        .route = world.trips.routes[trip],
+        .trip = trip,
+      });
+    }
+    prev = stop_time;
+  }
+}
+
+// The trips that run on `date`, in id order. Segmenting trips in id order means that segments that
+// tie in later sorts are always in the same order, regardless of the order of trips.txt.
+static std::vector<WorldTripIndex> tripsById(absl::CivilDay date, const World& world) {
+  const std::vector<bool> active_services = world.calendar.ActiveServices(date);
+  std::vector<WorldTripIndex> trips_by_id;
+  for (WorldTripIndex trip = 0; trip < world.trips.size(); ++trip) {
+    if (active_services[world.trips.services[trip]]) {
+      trips_by_id.push_back(trip);
+    }
+  }
+  std::sort(trips_by_id.begin(), trips_by_id.end(), [&world](WorldTripIndex a, WorldTripIndex b) {
+    return world.trips.ids.Get(a) < world.trips.ids.Get(b);
+  });
+  return trips_by_id;
+}
+
+// Trips are segmented in parallel in chunks of this many, each into its own buffers, which are
+// then used in order, so the result is the same as segmenting the trips one by one.
+constexpr size_t kTripsPerChunk = 256;
+
+// Adds the segments of chunk `chunk` of `trips` to `out`.
+static void segmentChunk(const std::vector<WorldTripIndex>& trips, size_t chunk, const World& world, SegmentBuffers& out) {
+  const size_t end = std::min(trips.size(), (chunk + 1) * kTripsPerChunk);
+  for (size_t i = chunk * kTripsPerChunk; i < end; ++i) {
+    segmentTrip(trips[i], world, out);
+  }
+}
+
+void StreamSegments(
+  absl::CivilDay date,
+  const World& world,
+  absl::FunctionRef<void(const WorldSegment&, const WorldTripRun&)> sink
+) {
+  const std::vector<WorldTripIndex> trips_by_id = tripsById(date, world);
+  const size_t num_chunks = (trips_by_id.size() + kTripsPerChunk - 1) / kTripsPerChunk;
+  // Enough chunks per batch to keep every core busy, and few enough that a batch's segments are
+  // small next to whatever `sink` builds from them.
+  const size_t chunks_per_batch = 4 * std::max(1u, std::thread::hardware_concurrency());
+  std::vector<SegmentBuffers> batch(std::min(chunks_per_batch, num_chunks));
+  for (size_t first_chunk = 0; first_chunk < num_chunks; first_chunk += chunks_per_batch) {
+    const size_t batch_size = std::min(chunks_per_batch, num_chunks - first_chunk);
+    ParallelFor(batch_size, [&](size_t i) {
+      batch[i].segments.clear();
+      batch[i].repeating_segments.clear();
+      batch[i].repeating_segment_runs.clear();
+      segmentChunk(trips_by_id, first_chunk + i, world, batch[i]);
+    });
+    for (size_t i = 0; i < batch_size; ++i) {
+      for (const WorldSegment& segment : batch[i].segments) {
+        sink(segment, WorldTripRun{segment.trip, WorldTime()});
       }
+      for (const WorldRepeatingSegment& repeating : batch[i].repeating_segments) {
+        ForEachDeparture(repeating, batch[i].repeating_segment_runs, sink);
+      }
+    }
+  }
+}
 
-      if (!prev.has_value()) {
-        prev = stop_time;
-        continue;
+void SegmentWorld(absl::CivilDay date, World& world, unsigned int num_threads) {
+  const std::vector<WorldTripIndex> trips_by_id = tripsById(date, world);
+  std::vector<SegmentBuffers> chunks((trips_by_id.size() + kTripsPerChunk - 1) / kTripsPerChunk);
+  ParallelFor(chunks.size(), [&](size_t chunk) {
+    segmentChunk(trips_by_id, chunk, world, chunks[chunk]);
+  }, num_threads);
+
+  world.segments.clear();
+  world.repeating_segments.clear();
+  world.repeating_segment_runs.clear();
+  for (SegmentBuffers& chunk : chunks) {
+    world.segments.insert(world.segments.end(), chunk.segments.begin(), chunk.segments.end());
+    const uint32_t run_offset = world.repeating_segment_runs.size();
+    for (WorldRepeatingSegment& segment : chunk.repeating_segments) {
+      segment.first_run += run_offset;
+      world.repeating_segments.push_back(segment);
+    }
+    world.repeating_segment_runs.insert(
+      world.repeating_segment_runs.end(), chunk.repeating_segment_runs.begin(), chunk.repeating_segment_runs.end()
+    );
+  }
+  compressRegularSegments(world, num_threads);
+  ParallelStableSort(world.segments, WorldSegmentComp, num_threads);
+  world.departures = BuildDepartureIndex(world);
+}
+
+bool WorldSegmentComp(const WorldSegment& a, const WorldSegment& b) {
+  if (a.departure_time.seconds == b.departure_time.seconds) {
+    return a.duration.seconds < b.duration.seconds;
+  }
+  return a.departure_time.seconds < b.departure_time.seconds;
+}
+
+std::vector<WorldSegment> WorldDepartureIndex::At(const World& world, WorldStopIndex stop) const {
+  return Between(world, stop, WorldTime(0), WorldTime(std::numeric_limits<unsigned int>::max()));
+}
+
+std::vector<WorldSegment> WorldDepartureIndex::Between(
+  const World& world,
+  WorldStopIndex stop,
+  WorldTime from,
+  WorldTime to
+) const {
+  std::vector<WorldSegment> result;
+  // Stops added after the index was built have no departures in it.
+  if (stop + 1 >= segment_offsets.size()) {
+    return result;
+  }
+  const auto at_begin = segments.begin() + segment_offsets[stop];
+  const auto at_end = segments.begin() + segment_offsets[stop + 1];
+  auto begin = std::partition_point(at_begin, at_end, [&world, from](uint32_t segment) {
+    return world.segments[segment].departure_time.seconds < from.seconds;
+  });
+  auto end = std::partition_point(begin, at_end, [&world, to](uint32_t segment) {
+    return world.segments[segment].departure_time.seconds <= to.seconds;
+  });
+  for (auto it = begin; it != end; ++it) {
+    result.push_back(world.segments[*it]);
+  }
+  const size_t ordinary = result.size();
+
+  for (uint32_t i = repeating_offsets[stop]; i < repeating_offsets[stop + 1]; ++i) {
+    const WorldRepeatingSegment& repeating = world.repeating_segments[repeating_segments[i]];
+    const Range& range = repeating.departures;
+    if (range.finish < from.seconds || range.start > to.seconds) {
+      continue;
+    }
+    unsigned int first = 0;
+    unsigned int last = 0;
+    if (range.interval > 0) {
+      first = from.seconds > range.start ? (from.seconds - range.start + range.interval - 1) / range.interval : 0;
+      last = (std::min(range.finish, to.seconds) - range.start) / range.interval;
+    }
+    for (unsigned int k = first; k <= last; ++k) {
+      result.push_back(WorldSegment{
+        .departure_time = WorldTime(range.start + k * range.interval),
+        .duration = repeating.duration,
+        .origin_stop = repeating.origin_stop,
+        .destination_stop = repeating.destination_stop,
+        .route = repeating.route,
+        .trip = world.repeating_segment_runs[repeating.first_run + k].trip,
+      });
+    }
+  }
+  if (result.size() > ordinary) {
+    std::stable_sort(result.begin(), result.end(), WorldSegmentComp);
+  }
+  return result;
+}
+
+WorldDepartureIndex BuildDepartureIndex(const World& world) {
+  WorldDepartureIndex index;
+  index.segment_offsets.assign(world.stops.size() + 1, 0);
+  index.repeating_offsets.assign(world.stops.size() + 1, 0);
+  for (const WorldSegment& segment : world.segments) {
+    index.segment_offsets[segment.origin_stop + 1] += 1;
+  }
+  for (const WorldRepeatingSegment& repeating : world.repeating_segments) {
+    index.repeating_offsets[repeating.origin_stop + 1] += 1;
+  }
+  for (size_t stop = 0; stop < world.stops.size(); ++stop) {
+    index.segment_offsets[stop + 1] += index.segment_offsets[stop];
+    index.repeating_offsets[stop + 1] += index.repeating_offsets[stop];
+  }
+
+  index.segments.resize(world.segments.size());
+  std::vector<uint32_t> next(index.segment_offsets.begin(), index.segment_offsets.end() - 1);
+  for (uint32_t i = 0; i < world.segments.size(); ++i) {
+    index.segments[next[world.segments[i].origin_stop]++] = i;
+  }
+  index.repeating_segments.resize(world.repeating_segments.size());
+  next.assign(index.repeating_offsets.begin(), index.repeating_offsets.end() - 1);
+  for (uint32_t i = 0; i < world.repeating_segments.size(); ++i) {
+    index.repeating_segments[next[world.repeating_segments[i].origin_stop]++] = i;
+  }
+
+  for (size_t stop = 0; stop < world.stops.size(); ++stop) {
+    std::stable_sort(
+      index.segments.begin() + index.segment_offsets[stop],
+      index.segments.begin() + index.segment_offsets[stop + 1],
+      [&world](uint32_t a, uint32_t b) {
+        return WorldSegmentComp(world.segments[a], world.segments[b]);
+      }
+    );
+  }
+  return index;
+}
+
+// Seconds from the start of `date`'s service day, which is noon minus 12h local time, to the POSIX
+// time `time`.
+static int64_t serviceDaySeconds(int64_t time, absl::CivilDay date, absl::TimeZone time_zone) {
+  const absl::Time noon = absl::FromCivil(absl::CivilSecond(date.year(), date.month(), date.day(), 12), time_zone);
+  return time - absl::ToUnixSeconds(noon - absl::Hours(12));
+}
+
+// Whether the times in `stop_times` never go backwards, so that every segment has a duration.
+static bool timesInOrder(const std::vector<WorldTripStopTimes>& stop_times) {
+  unsigned int latest = 0;
+  for (const WorldTripStopTimes& stop_time : stop_times) {
+    for (const std::optional<WorldTime>& time : {stop_time.arrival_time, stop_time.departure_time}) {
+      if (time.has_value()) {
+        if (time->seconds < latest) {
+          return false;
+        }
+        latest = time->seconds;
       }
+    }
+  }
+  return true;
+}
 
-      std::string origin_stop_id = prev->stop_id;
-      std::string destination_stop_id = stop_time.stop_id;
-      if (!prev->departure_time.has_value()) {
-        return absl::StrCat("No departure time on trip ", entry.first);
+// The stop times of `scheduled` with `update` applied, or nullopt if that goes wrong.
+// `update_stops[i]` is the root stop of `update.stop_time_updates[i]`.
+static std::optional<std::vector<WorldTripStopTimes>> updatedStopTimes(
+  const RealtimeTripUpdate& update,
+  const std::vector<WorldStopIndex>& update_stops,
+  WorldTripStopTimesView scheduled,
+  absl::CivilDay date,
+  absl::TimeZone time_zone
+) {
+  int64_t delay = update.delay.value_or(0);
+  // Sets `time` from `event`, or from the schedule and the delay so far if `event` has nothing to
+  // say. Returns false if the time would be before the service day.
+  auto update_time = [&](const RealtimeStopTimeEvent* event, std::optional<WorldTime>& time) {
+    int64_t seconds;
+    if (event != nullptr && event->time.has_value()) {
+      seconds = serviceDaySeconds(*event->time, date, time_zone);
+      if (time.has_value()) {
+        delay = seconds - time->seconds;
       }
-      WorldTime departure_time = prev->departure_time.value();
-      if (!prev->arrival_time.has_value()) {
-        return absl::StrCat("No arrival time on trip ", entry.first);
+    } else if (time.has_value()) {
+      if (event != nullptr && event->delay.has_value()) {
+        delay = *event->delay;
       }
-      WorldTime arrival_time = stop_time.arrival_time.value();
-      WorldDuration duration = WorldDuration(arrival_time.seconds - departure_time.seconds);
-      world.segments.push_back(WorldSegment{
-        .departure_time = departure_time,
-        .duration = duration,
-        .origin_stop_id = origin_stop_id,
-        .destination_stop_id = destination_stop_id,
-        .route_id = trip.route_id,
-        .trip_id = entry.first,
-      });
+      seconds = time->seconds + delay;
+    } else {
+      return true;
+    }
+    if (seconds < 0) {
+      return false;
+    }
+    time = WorldTime(seconds);
+    return true;
+  };
 
-      prev = stop_time;
+  std::vector<WorldTripStopTimes> result;
+  size_t next_update = 0;
+  for (WorldTripStopTimes stop_time : scheduled) {
+    // Stop time updates are in stop order, so each is looked for after the last one found.
+    const RealtimeStopTimeUpdate* stop_update = nullptr;
+    for (size_t i = next_update; i < update_stops.size(); ++i) {
+      if (update_stops[i] == stop_time.stop) {
+        stop_update = &update.stop_time_updates[i];
+        next_update = i + 1;
+        break;
+      }
+    }
+    using Relationship = RealtimeStopTimeUpdate::Relationship;
+    if (stop_update != nullptr && stop_update->schedule_relationship == Relationship::kSkipped) {
+      continue;
+    }
+    if (stop_update != nullptr && stop_update->schedule_relationship == Relationship::kNoData) {
+      // No prediction for this stop, so it is back on schedule until the next update.
+      delay = 0;
+      stop_update = nullptr;
     }
+    if (!update_time(stop_update != nullptr ? &stop_update->arrival : nullptr, stop_time.arrival_time) ||
+        !update_time(stop_update != nullptr ? &stop_update->departure : nullptr, stop_time.departure_time)) {
+      return std::nullopt;
+    }
+    result.push_back(stop_time);
   }
-  std::sort(world.segments.begin(), world.segments.end(), [](const WorldSegment& a, const WorldSegment& b) {
-    if (a.departure_time.seconds == b.departure_time.seconds) {
-      return a.duration.seconds < b.duration.seconds;
+  if (!timesInOrder(result)) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+// The stop times of an added trip, which are all in `update`, or nullopt if that goes wrong.
+static std::optional<std::vector<WorldTripStopTimes>> addedStopTimes(
+  const RealtimeTripUpdate& update,
+  const std::vector<WorldStopIndex>& update_stops,
+  absl::CivilDay date,
+  absl::TimeZone time_zone
+) {
+  std::vector<WorldTripStopTimes> result;
+  for (size_t i = 0; i < update.stop_time_updates.size(); ++i) {
+    const RealtimeStopTimeUpdate& stop_update = update.stop_time_updates[i];
+    if (stop_update.schedule_relationship == RealtimeStopTimeUpdate::Relationship::kSkipped) {
+      continue;
+    }
+    std::optional<int64_t> arrival = stop_update.arrival.time;
+    std::optional<int64_t> departure = stop_update.departure.time;
+    if (update_stops[i] == kNoWorldIndex || (!arrival.has_value() && !departure.has_value())) {
+      return std::nullopt;
     }
-    return a.departure_time.seconds < b.departure_time.seconds;
+    // A stop with just one of the times arrives and departs at once.
+    arrival = arrival.value_or(*departure);
+    departure = departure.value_or(*arrival);
+    const int64_t arrival_seconds = serviceDaySeconds(*arrival, date, time_zone);
+    const int64_t departure_seconds = serviceDaySeconds(*departure, date, time_zone);
+    if (arrival_seconds < 0 || departure_seconds < 0) {
+      return std::nullopt;
+    }
+    result.push_back(WorldTripStopTimes{
+      .stop = update_stops[i],
+      .arrival_time = WorldTime(arrival_seconds),
+      .departure_time = WorldTime(departure_seconds),
+      .timepoint = true,
+    });
+  }
+  if (!timesInOrder(result)) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+// Replaces the segments of the trips in `changes` in `world.segments` and
+// `world.repeating_segments`, and rebuilds `world.departures`.
+static void patchSegments(std::span<const WorldTripChange> changes, World& world) {
+  absl::flat_hash_set<WorldTripIndex> changed_trips;
+  for (const WorldTripChange& change : changes) {
+    changed_trips.insert(change.trip);
+  }
+  std::erase_if(world.segments, [&changed_trips](const WorldSegment& segment) {
+    return changed_trips.contains(segment.trip);
   });
-  
-  return std::nullopt;
+
+  // Repeating segments that a changed trip is part of are expanded back into ordinary segments for
+  // the other trips. Their runs are left in `world.repeating_segment_runs`, unused.
+  std::vector<WorldSegment> added;
+  std::erase_if(world.repeating_segments, [&](const WorldRepeatingSegment& repeating) {
+    bool touched = false;
+    ForEachDeparture(repeating, world.repeating_segment_runs, [&](const WorldSegment& segment, const WorldTripRun&) {
+      touched = touched || changed_trips.contains(segment.trip);
+    });
+    if (!touched) {
+      return false;
+    }
+    ForEachDeparture(repeating, world.repeating_segment_runs, [&](const WorldSegment& segment, const WorldTripRun&) {
+      if (!changed_trips.contains(segment.trip)) {
+        added.push_back(segment);
+      }
+    });
+    return true;
+  });
+
+  for (const WorldTripChange& change : changes) {
+    added.insert(added.end(), change.new_segments.begin(), change.new_segments.end());
+  }
+  std::stable_sort(added.begin(), added.end(), WorldSegmentComp);
+  std::vector<WorldSegment> merged;
+  merged.reserve(world.segments.size() + added.size());
+  std::merge(
+    world.segments.begin(), world.segments.end(), added.begin(), added.end(), std::back_inserter(merged), WorldSegmentComp
+  );
+  world.segments = std::move(merged);
+  world.departures = BuildDepartureIndex(world);
+}
+
+void ApplyTripUpdates(
+  const std::vector<RealtimeTripUpdate>& updates,
+  const std::string& id_prefix,
+  absl::CivilDay date,
+  absl::TimeZone time_zone,
+  World& world,
+  std::vector<WorldTripChange>& changes
+) {
+  using Relationship = RealtimeTripUpdate::Relationship;
+  const std::string start_date = absl::StrFormat("%04d%02d%02d", date.year(), date.month(), date.day());
+  const size_t first_change = changes.size();
+  // Where each trip's change is in `changes`, so that a trip updated twice ends up with one change.
+  absl::flat_hash_map<WorldTripIndex, size_t> change_of_trip;
+  std::vector<WorldStopIndex> update_stops;
+  for (const RealtimeTripUpdate& update : updates) {
+    if (update.trip_id.empty() || (!update.start_date.empty() && update.start_date != start_date)) {
+      continue;
+    }
+    update_stops.clear();
+    for (const RealtimeStopTimeUpdate& stop_update : update.stop_time_updates) {
+      WorldStopIndex stop = stop_update.stop_id.empty()
+        ? kNoWorldIndex
+        : world.stops.ids.Find(absl::StrCat(id_prefix, stop_update.stop_id)).value_or(kNoWorldIndex);
+      while (stop != kNoWorldIndex && world.stops.parent_stations[stop] != kNoWorldIndex) {
+        stop = world.stops.parent_stations[stop];
+      }
+      update_stops.push_back(stop);
+    }
+
+    const std::string trip_id = absl::StrCat(id_prefix, update.trip_id);
+    std::optional<WorldTripIndex> trip = world.trips.ids.Find(trip_id);
+    std::optional<std::vector<WorldTripStopTimes>> stop_times;
+    if (update.schedule_relationship == Relationship::kAdded) {
+      stop_times = addedStopTimes(update, update_stops, date, time_zone);
+      if (!stop_times.has_value()) {
+        continue;
+      }
+      if (!trip.has_value()) {
+        const std::optional<WorldRouteIndex> route = world.routes.ids.Find(absl::StrCat(id_prefix, update.route_id));
+        if (!route.has_value()) {
+          continue;
+        }
+        trip = world.trips.GetOrAdd(trip_id);
+        world.trips.routes[*trip] = *route;
+        const ServiceIndex service =
+          world.calendar.GetOrAdd(absl::StrCat(id_prefix, "realtime-added-", start_date));
+        world.calendar.SetActive(service, date, true);
+        world.trips.services[*trip] = service;
+      }
+    } else if (!trip.has_value()) {
+      continue;
+    }
+    if (!world.trips.frequencies[*trip].empty() ||
+        world.trips.services[*trip] == kNoWorldIndex ||
+        !world.calendar.IsActive(world.trips.services[*trip], date)) {
+      continue;
+    }
+    if (update.schedule_relationship == Relationship::kCanceled ||
+        update.schedule_relationship == Relationship::kDeleted) {
+      stop_times.emplace();
+    } else if (update.schedule_relationship == Relationship::kScheduled) {
+      stop_times = updatedStopTimes(update, update_stops, world.trips.ScheduledStopTimes(*trip), date, time_zone);
+    }
+    if (!stop_times.has_value()) {
+      continue;
+    }
+
+    auto [change, inserted] = change_of_trip.try_emplace(*trip, changes.size());
+    if (inserted) {
+      SegmentBuffers old_segments;
+      segmentTrip(*trip, world, old_segments);
+      changes.push_back(WorldTripChange{.trip = *trip, .old_segments = std::move(old_segments.segments)});
+    }
+    world.trips.ReplaceStopTimes(*trip, *stop_times);
+    SegmentBuffers new_segments;
+    segmentTrip(*trip, world, new_segments);
+    changes[change->second].new_segments = std::move(new_segments.segments);
+  }
+
+  if (changes.size() > first_change) {
+    patchSegments(std::span<const WorldTripChange>(changes).subspan(first_change), world);
+  }
 }
 
 void World::prettyRoutes(std::string& result) const {
-  for (const auto& entry: routes) {
-    const auto& route = entry.second;
-    absl::StrAppend(&result, entry.first, ": ", route.name, "\n");
+  std::vector<WorldRouteIndex> routes_by_id;
+  for (WorldRouteIndex route = 0; route < routes.size(); ++route) {
+    routes_by_id.push_back(route);
+  }
+  std::sort(routes_by_id.begin(), routes_by_id.end(), [this](WorldRouteIndex a, WorldRouteIndex b) {
+    return routes.ids.Get(a) < routes.ids.Get(b);
+  });
+  for (const WorldRouteIndex route : routes_by_id) {
+    absl::StrAppend(&result, routes.ids.Get(route), ": ", routes.names[route], "\n");
   }
 }
 
 void World::prettyDepartureTable(const std::string& stop_id, const std::optional<std::string>& line_name, std::string& result) const {
+  const WorldStopIndex stop = stops.ids.Find(stop_id).value();
   constexpr const char* table_format = "%-10s %-15s %-40s %s\n";
-  absl::StrAppend(&result, "Departure table for ", stops.at(stop_id).name, "\n");
+  absl::StrAppend(&result, "Departure table for ", stops.names[stop], "\n");
   absl::StrAppendFormat(&result, table_format, "Time", "Line", "Next Stop", "Next Stop Time");
-  for (const auto& segment : segments) {
-    if (segment.origin_stop_id != stop_id || (line_name.has_value() && routes.at(segment.route_id).name != line_name)) {
+  for (const auto& segment : departures.At(*this, stop)) {
+    if (line_name.has_value() && routes.names[segment.route] != line_name) {
       continue;
     }
     absl::StrAppendFormat(
       &result,
       table_format,
       absl::StrCat(segment.departure_time, ""), // TODO: Figure out how to use formatter.
-      routes.at(segment.route_id).name,
-      stops.at(segment.destination_stop_id).name,
+      routes.names[segment.route],
+      stops.names[segment.destination_stop],
       absl::StrCat(WorldTime(segment.departure_time.seconds + segment.duration.seconds), "") // TODO: Figure out how to use formatter.
     );
   }
 }
 
-void AddWalkingSegments(World& world) {
+void MergeWorld(World&& src, World& dest) {
+  std::vector<World> srcs;
+  srcs.push_back(std::move(src));
+  MergeWorlds(std::move(srcs), dest);
+}
+
+// Moves the rows of `src` that are not already in `dest` into `dest`. Returns the index in `dest` of
+// every row of `src`.
+static std::vector<WorldRouteIndex> mergeRoutes(WorldRoutes&& src, WorldRoutes& dest) {
+  std::vector<WorldRouteIndex> remap(src.size());
+  for (WorldRouteIndex route = 0; route < src.size(); ++route) {
+    const size_t dest_size = dest.size();
+    remap[route] = dest.GetOrAdd(src.ids.Get(route));
+    if (remap[route] == dest_size) {
+      dest.names[remap[route]] = std::move(src.names[route]);
+    }
+  }
+  return remap;
+}
+
+static std::vector<WorldStopIndex> mergeStops(WorldStops&& src, WorldStops& dest) {
+  std::vector<WorldStopIndex> remap(src.size());
+  std::vector<bool> added(src.size());
+  for (WorldStopIndex stop = 0; stop < src.size(); ++stop) {
+    const size_t dest_size = dest.size();
+    remap[stop] = dest.GetOrAdd(src.ids.Get(stop));
+    added[stop] = remap[stop] == dest_size;
+    if (added[stop]) {
+      dest.names[remap[stop]] = std::move(src.names[stop]);
+      dest.lats[remap[stop]] = std::move(src.lats[stop]);
+      dest.lons[remap[stop]] = std::move(src.lons[stop]);
+      dest.meters_x[remap[stop]] = src.meters_x[stop];
+      dest.meters_y[remap[stop]] = src.meters_y[stop];
+      dest.is_segment_stop[remap[stop]] = src.is_segment_stop[stop];
+    }
+  }
+  for (WorldStopIndex stop = 0; stop < src.size(); ++stop) {
+    if (added[stop] && src.parent_stations[stop] != kNoWorldIndex) {
+      dest.parent_stations[remap[stop]] = remap[src.parent_stations[stop]];
+    }
+  }
+  return remap;
+}
+
+static std::vector<WorldTripIndex> mergeTrips(
+  WorldTrips&& src,
+  const std::vector<WorldRouteIndex>& route_remap,
+  const std::vector<ServiceIndex>& service_remap,
+  const std::vector<WorldStopIndex>& stop_remap,
+  WorldTrips& dest
+) {
+  // The patterns and times of `src` are appended as they are, and its trips point into them.
+  const WorldPatternIndex pattern_offset = dest.num_patterns();
+  const uint32_t pattern_stop_offset = dest.pattern_stops.size();
+  const uint32_t time_offset = dest.arrival_times.size();
+  for (size_t pattern = 1; pattern < src.pattern_offsets.size(); ++pattern) {
+    dest.pattern_offsets.push_back(src.pattern_offsets[pattern] + pattern_stop_offset);
+  }
+  for (const WorldStopIndex stop : src.pattern_stops) {
+    dest.pattern_stops.push_back(stop_remap[stop]);
+  }
+  dest.arrival_times.insert(dest.arrival_times.end(), src.arrival_times.begin(), src.arrival_times.end());
+  dest.departure_times.insert(dest.departure_times.end(), src.departure_times.begin(), src.departure_times.end());
+
+  std::vector<WorldTripIndex> remap(src.size());
+  for (WorldTripIndex trip = 0; trip < src.size(); ++trip) {
+    const size_t dest_size = dest.size();
+    remap[trip] = dest.GetOrAdd(src.ids.Get(trip));
+    if (remap[trip] == dest_size) {
+      dest.routes[remap[trip]] = src.routes[trip] == kNoWorldIndex ? kNoWorldIndex : route_remap[src.routes[trip]];
+      dest.services[remap[trip]] = src.services[trip] == kNoWorldIndex ? kNoWorldIndex : service_remap[src.services[trip]];
+      dest.frequencies[remap[trip]] = std::move(src.frequencies[trip]);
+      if (src.patterns[trip] != kNoWorldIndex) {
+        dest.patterns[remap[trip]] = src.patterns[trip] + pattern_offset;
+        dest.time_offsets[remap[trip]] = src.time_offsets[trip] + time_offset;
+      }
+    }
+  }
+  return remap;
+}
+
+void MergeWorlds(std::vector<World>&& srcs, World& dest) {
+  // The sorted runs to merge: `dest.segments` first, then each of `srcs`.
+  std::vector<std::vector<WorldSegment>> runs;
+  runs.reserve(srcs.size() + 1);
+  runs.push_back(std::move(dest.segments));
+  size_t total_segments = runs.back().size();
+  for (World& src : srcs) {
+    const std::vector<WorldRouteIndex> route_remap = mergeRoutes(std::move(src.routes), dest.routes);
+    const std::vector<WorldStopIndex> stop_remap = mergeStops(std::move(src.stops), dest.stops);
+    const std::vector<ServiceIndex> service_remap = dest.calendar.Merge(src.calendar);
+    const std::vector<WorldTripIndex> trip_remap = mergeTrips(std::move(src.trips), route_remap, service_remap, stop_remap, dest.trips);
+    for (WorldSegment& segment : src.segments) {
+      segment.origin_stop = stop_remap[segment.origin_stop];
+      segment.destination_stop = stop_remap[segment.destination_stop];
+      segment.route = route_remap[segment.route];
+      segment.trip = trip_remap[segment.trip];
+    }
+    const uint32_t run_offset = dest.repeating_segment_runs.size();
+    for (WorldRepeatingSegment& segment : src.repeating_segments) {
+      segment.origin_stop = stop_remap[segment.origin_stop];
+      segment.destination_stop = stop_remap[segment.destination_stop];
+      segment.route = route_remap[segment.route];
+      segment.first_run += run_offset;
+      dest.repeating_segments.push_back(segment);
+    }
+    for (WorldTripRun& run : src.repeating_segment_runs) {
+      run.trip = trip_remap[run.trip];
+      dest.repeating_segment_runs.push_back(run);
+    }
+    for (WorldAnytimeConnection& connection : src.anytime_connections) {
+      connection.origin_stop = stop_remap[connection.origin_stop];
+      connection.destination_stop = stop_remap[connection.destination_stop];
+      dest.anytime_connections.push_back(connection);
+    }
+    total_segments += src.segments.size();
+    runs.push_back(std::move(src.segments));
+  }
+
+  struct RunHead {
+    size_t run;
+    size_t pos;
+  };
+  auto after = [&runs](const RunHead& a, const RunHead& b) {
+    const WorldSegment& seg_a = runs[a.run][a.pos];
+    const WorldSegment& seg_b = runs[b.run][b.pos];
+    if (WorldSegmentComp(seg_b, seg_a)) {
+      return true;
+    }
+    if (WorldSegmentComp(seg_a, seg_b)) {
+      return false;
+    }
+    return a.run > b.run;
+  };
+  std::priority_queue<RunHead, std::vector<RunHead>, decltype(after)> heads(after);
+  for (size_t run = 0; run < runs.size(); ++run) {
+    if (!runs[run].empty()) {
+      heads.push({run, 0});
+    }
+  }
+
+  dest.segments.clear();
+  dest.segments.reserve(total_segments);
+  while (!heads.empty()) {
+    RunHead head = heads.top();
+    heads.pop();
+    dest.segments.push_back(std::move(runs[head.run][head.pos]));
+    if (++head.pos < runs[head.run].size()) {
+      heads.push(head);
+    }
+  }
+  dest.departures = BuildDepartureIndex(dest);
+}
+
+void AddWalkingSegments(World& world, const WalkingOptions& options) {
   // We only do this for "root" (parentless) stops, because all our segments go through the roots.
-  std::vector<std::string> root_stops;
-  for (const auto& entry : world.stops) {
-    const auto& stop_id = entry.first;
-    const auto& stop = entry.second;
-    if (!stop.parent_station_id.has_value()) {
-      root_stops.push_back(stop_id);
+  std::vector<WorldStopIndex> root_stops;
+  for (WorldStopIndex stop = 0; stop < world.stops.size(); ++stop) {
+    if (world.stops.parent_stations[stop] == kNoWorldIndex) {
+      root_stops.push_back(stop);
     }
   }
-  std::cout << "Num root stops: " << root_stops.size() << "\n";
+  const std::vector<double>& meters_x = world.stops.meters_x;
+  const std::vector<double>& meters_y = world.stops.meters_y;
+  const StopGrid grid(meters_x, meters_y, root_stops, options.max_meters);
 
-  std::sort(root_stops.begin(), root_stops.end(), [&world](const std::string& a, const std::string& b) {
-    return world.stops.at(a).meters_x < world.stops.at(b).meters_x;
+  // Workers take chunks of root stops and write each chunk's connections to its own vector, so the
+  // result is in the same order no matter how the chunks were scheduled.
+  constexpr size_t kChunkSize = 256;
+  const size_t num_chunks = (root_stops.size() + kChunkSize - 1) / kChunkSize;
+  std::vector<std::vector<WorldAnytimeConnection>> chunk_connections(num_chunks);
+  ParallelFor(num_chunks, [&](size_t chunk) {
+    const size_t end = std::min(root_stops.size(), (chunk + 1) * kChunkSize);
+    for (size_t i = chunk * kChunkSize; i < end; ++i) {
+      const WorldStopIndex stop_i = root_stops[i];
+      grid.ForEachWithin(meters_x[stop_i], meters_y[stop_i], options.max_meters, [&](WorldStopIndex stop_j, double dist) {
+        if (stop_j == stop_i) {
+          return;
+        }
+        chunk_connections[chunk].push_back(WorldAnytimeConnection{
+          .origin_stop = stop_i,
+          .destination_stop = stop_j,
+          .duration = WorldDuration(dist / options.meters_per_second)
+        });
+      });
+    }
   });
 
-  const double MAX_WALK_METERS = 500;
-  const double WALK_METERS_PER_SECOND = 1;
+  for (const std::vector<WorldAnytimeConnection>& connections : chunk_connections) {
+    world.anytime_connections.insert(world.anytime_connections.end(), connections.begin(), connections.end());
+  }
+}
+
+// The words of a stop name that say which station it is, lowercased. Words that many names have
+// without saying anything about the station are left out.
+static absl::flat_hash_set<std::string> stationNameWords(absl::string_view name) {
+  static const absl::flat_hash_set<absl::string_view> kIgnored = {"station", "stn", "platform", "the"};
+  absl::flat_hash_set<std::string> words;
+  std::string word;
+  for (size_t i = 0; i <= name.size(); ++i) {
+    const unsigned char c = i < name.size() ? name[i] : ' ';
+    if (std::isalnum(c)) {
+      word.push_back(std::tolower(c));
+      continue;
+    }
+    if (!word.empty() && !kIgnored.contains(word)) {
+      words.insert(word);
+    }
+    word.clear();
+  }
+  return words;
+}
+
+// The fraction of the words of the name with fewer words that the other name also has.
+static double stationNameSimilarity(
+  const absl::flat_hash_set<std::string>& a, const absl::flat_hash_set<std::string>& b
+) {
+  const absl::flat_hash_set<std::string>& fewer = a.size() <= b.size() ? a : b;
+  const absl::flat_hash_set<std::string>& more = a.size() <= b.size() ? b : a;
+  if (fewer.empty()) {
+    return 0;
+  }
+  size_t common = 0;
+  for (const std::string& word : fewer) {
+    common += more.contains(word);
+  }
+  return static_cast<double>(common) / fewer.size();
+}
 
-  int i = 0;
-  int jmin = 0;
-  int jmax = 0;
-  while (i < root_stops.size()) {
-    if (i % 1000 == 0) {
-      std::cout << i << "\n";
+std::optional<std::string> UnifyStations(
+  const std::vector<std::string>& feed_prefixes,
+  const StationUnificationOptions& options,
+  World& world,
+  std::unordered_map<std::string, std::string>& unified
+) {
+  WorldStops& stops = world.stops;
+  auto root_of = [&stops](WorldStopIndex stop) {
+    while (stops.parent_stations[stop] != kNoWorldIndex) {
+      stop = stops.parent_stations[stop];
     }
+    return stop;
+  };
+  auto find_root_stop = [&](const std::string& id) -> std::optional<WorldStopIndex> {
+    const std::optional<WorldStopIndex> stop = stops.ids.Find(id);
+    if (!stop.has_value()) {
+      return std::nullopt;
+    }
+    return root_of(*stop);
+  };
 
-    const WorldStop& stop_i = world.stops.at(root_stops[i]);
-    while (world.stops.at(root_stops[jmin]).meters_x < stop_i.meters_x - MAX_WALK_METERS) {
-      jmin += 1;
+  // Groups are kept as a union-find forest whose roots are the groups' first stops.
+  std::vector<WorldStopIndex> group(stops.size());
+  for (WorldStopIndex stop = 0; stop < stops.size(); ++stop) {
+    group[stop] = stop;
+  }
+  auto find = [&group](WorldStopIndex stop) {
+    while (group[stop] != stop) {
+      group[stop] = group[group[stop]];
+      stop = group[stop];
     }
-    while (jmax < root_stops.size() && world.stops.at(root_stops[jmax]).meters_x < stop_i.meters_x + MAX_WALK_METERS) {
-      jmax += 1;
+    return stop;
+  };
+  auto join = [&](WorldStopIndex a, WorldStopIndex b) {
+    a = find(a);
+    b = find(b);
+    if (a != b) {
+      group[std::max(a, b)] = std::min(a, b);
     }
-    for (int j = jmin; j < jmax; ++j) {
-      if (j == i) {
+  };
+
+  std::string error_message;
+  for (const std::vector<std::string>& ids : options.merge) {
+    std::optional<WorldStopIndex> first;
+    for (const std::string& id : ids) {
+      const std::optional<WorldStopIndex> stop = find_root_stop(id);
+      if (!stop.has_value()) {
+        absl::StrAppend(&error_message, "  Stop to merge not found: ", id, "\n");
         continue;
       }
-      const WorldStop& stop_j = world.stops.at(root_stops[j]);
-      const double xDist = stop_i.meters_x - stop_j.meters_x;
-      const double yDist = stop_i.meters_y - stop_j.meters_y;
-      const double dist = sqrt(xDist * xDist + yDist * yDist);
-      // std::cout << stop_i.name << " " << stop_j.name << " " << dist << "\n";
-      if (dist < MAX_WALK_METERS * MAX_WALK_METERS) {
-        world.anytime_connections.push_back(WorldAnytimeConnection{
-          .origin_stop_id = root_stops[i],
-          .destination_stop_id = root_stops[j],
-          .duration = WorldDuration(dist / WALK_METERS_PER_SECOND)
-        });
+      if (first.has_value()) {
+        join(*first, *stop);
+      } else {
+        first = stop;
       }
     }
-    i += 1;
-  }
-}
-
-// Some leftover code from when I was using MultiSegments.
-
-// static std::string humanRange(const Range& range) {
-//   if (range.interval == 0) {
-//     return minutesToHuman(range.start);
-//   }
-//   return minutesToHuman(range.start) + " to " + minutesToHuman(range.finish) + " every " + std::to_string(range.interval) + " minutes";
-// }
-
-// // Returns a vector of segments representing the same segments as the input, but hopefully merged into fewer segments.
-// // Preconditions:
-// // - All the input segments are singular (they have only one departure each).
-// // - The origin and destination of all segments are the same.
-// // - The duration of all segments is the same.
-// static std::vector<WorldSegment> mergeSegments(const std::vector<WorldSegment>& segments) {
-//   std::vector<WorldSegment> sorted = segments;
-//   std::sort(sorted.begin(), sorted.end(), [](const WorldSegment& a, const WorldSegment& b) {
-//     return a.departures.start < b.departures.start;
-//   });
-//   if (sorted.size() <= 1) {
-//     return sorted;
-//   }
-
-//   std::vector<WorldSegment> result;
-//   unsigned int interval = sorted[1].departures.start - sorted[0].departures.start;
-//   unsigned int latest_on_interval_start = sorted[0].departures.start;
-//   for (unsigned int i = 1; i < sorted.size(); ++i) {
-//     auto segment = sorted[i];
-//     if (segment.departures.start == latest_on_interval_start + interval) {
-//       latest_on_interval_start = segment.departures.start;
-//     } else {
-//       result.push_back(segment);
-//     }
-//   }
-//   result = mergeSegments(result);
-//   result.insert(
-//     result.begin(),
-//     WorldSegment{
-//       Range(sorted[0].departures.start, latest_on_interval_start, interval),
-//       sorted[0].duration,
-//       sorted[0].origin_stop_id,
-//       sorted[0].destination_stop_id,
-//       sorted[0].route_id
-//     }
-//   );
-
-//   return result;
-// }
+  }
+  std::vector<std::pair<WorldStopIndex, WorldStopIndex>> separate;
+  for (const auto& [a_id, b_id] : options.separate) {
+    const std::optional<WorldStopIndex> a = find_root_stop(a_id);
+    const std::optional<WorldStopIndex> b = find_root_stop(b_id);
+    for (const auto& [id, stop] : {std::make_pair(a_id, a), std::make_pair(b_id, b)}) {
+      if (!stop.has_value()) {
+        absl::StrAppend(&error_message, "  Stop to keep separate not found: ", id, "\n");
+      }
+    }
+    if (a.has_value() && b.has_value()) {
+      separate.emplace_back(*a, *b);
+    }
+  }
+  if (!error_message.empty()) {
+    return "Problems unifying stations:\n" + error_message;
+  }
+
+  if (options.max_meters > 0) {
+    // A stop belongs to the feed with the longest prefix of its id, so that nested prefixes work.
+    std::vector<WorldStopIndex> root_stops;
+    std::vector<size_t> feeds(stops.size(), feed_prefixes.size());
+    std::vector<absl::flat_hash_set<std::string>> words(stops.size());
+    for (WorldStopIndex stop = 0; stop < stops.size(); ++stop) {
+      if (stops.parent_stations[stop] != kNoWorldIndex) {
+        continue;
+      }
+      root_stops.push_back(stop);
+      size_t longest = 0;
+      for (size_t feed = 0; feed < feed_prefixes.size(); ++feed) {
+        const std::string& prefix = feed_prefixes[feed];
+        if (absl::StartsWith(stops.ids.Get(stop), prefix) && prefix.size() >= longest) {
+          feeds[stop] = feed;
+          longest = prefix.size();
+        }
+      }
+      words[stop] = stationNameWords(stops.names[stop]);
+    }
+
+    // Joining the groups of `a` and `b` must not put a pair of `separate` stops in one group.
+    auto kept_separate = [&](WorldStopIndex a, WorldStopIndex b) {
+      a = find(a);
+      b = find(b);
+      for (const auto& [x, y] : separate) {
+        const WorldStopIndex x_group = find(x);
+        const WorldStopIndex y_group = find(y);
+        if ((x_group == a && y_group == b) || (x_group == b && y_group == a)) {
+          return true;
+        }
+      }
+      return false;
+    };
+
+    const StopGrid grid(stops.meters_x, stops.meters_y, root_stops, options.max_meters);
+    for (const WorldStopIndex stop_i : root_stops) {
+      grid.ForEachWithin(stops.meters_x[stop_i], stops.meters_y[stop_i], options.max_meters, [&](WorldStopIndex stop_j, double) {
+        if (stop_j <= stop_i ||
+            feeds[stop_j] == feeds[stop_i] ||
+            stationNameSimilarity(words[stop_i], words[stop_j]) < options.min_name_similarity ||
+            kept_separate(stop_i, stop_j)) {
+          return;
+        }
+        join(stop_i, stop_j);
+      });
+    }
+  }
+
+  // Every stop of a group becomes a child of the group's first stop.
+  std::vector<WorldStopIndex> remap(stops.size());
+  for (WorldStopIndex stop = 0; stop < stops.size(); ++stop) {
+    remap[stop] = find(stop);
+    if (remap[stop] == stop) {
+      continue;
+    }
+    stops.parent_stations[stop] = remap[stop];
+    if (stops.is_segment_stop[stop]) {
+      stops.is_segment_stop[remap[stop]] = true;
+    }
+    unified[stops.ids.Get(stop)] = stops.ids.Get(remap[stop]);
+  }
+
+  for (WorldStopIndex& stop : world.trips.pattern_stops) {
+    stop = remap[stop];
+  }
+
+  // Segments between stops of the same group are just the trip dwelling there. Dropping them keeps
+  // `world.segments` sorted.
+  for (WorldSegment& segment : world.segments) {
+    segment.origin_stop = remap[segment.origin_stop];
+    segment.destination_stop = remap[segment.destination_stop];
+  }
+  std::erase_if(world.segments, [](const WorldSegment& segment) {
+    return segment.origin_stop == segment.destination_stop;
+  });
+  for (WorldRepeatingSegment& segment : world.repeating_segments) {
+    segment.origin_stop = remap[segment.origin_stop];
+    segment.destination_stop = remap[segment.destination_stop];
+  }
+  std::erase_if(world.repeating_segments, [](const WorldRepeatingSegment& segment) {
+    return segment.origin_stop == segment.destination_stop;
+  });
+
+  // Connections that now join the same stops are collapsed into the fastest one.
+  std::vector<WorldAnytimeConnection> connections;
+  absl::flat_hash_map<std::pair<WorldStopIndex, WorldStopIndex>, size_t> connection_index;
+  for (WorldAnytimeConnection connection : world.anytime_connections) {
+    connection.origin_stop = remap[connection.origin_stop];
+    connection.destination_stop = remap[connection.destination_stop];
+    if (connection.origin_stop == connection.destination_stop) {
+      continue;
+    }
+    auto [it, inserted] = connection_index.try_emplace(
+      std::make_pair(connection.origin_stop, connection.destination_stop), connections.size()
+    );
+    if (inserted) {
+      connections.push_back(connection);
+    } else if (connection.duration.seconds < connections[it->second].duration.seconds) {
+      connections[it->second].duration = connection.duration;
+    }
+  }
+  world.anytime_connections = std::move(connections);
+
+  world.departures = BuildDepartureIndex(world);
+  return std::nullopt;
+}
@@ -1,17 +1,29 @@
 #pragma once
 
 #include <algorithm>
-#include <map>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <unordered_map>
 #include <unordered_set>
 #include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
+#include "absl/functional/function_ref.h"
 #include "absl/strings/str_format.h"
 #include "absl/time/civil_time.h"
+#include "absl/time/time.h"
 
 #include "cereal/cereal.hpp"
 
+#include "GTFSRealtime.h"
+#include "MultiSegment.h"
+#include "ServiceCalendar.h"
+#include "StringInterner.h"
+
 struct WorldTime {
   // Seconds since beginning of service day.
   unsigned int seconds;
@@ -57,58 +69,270 @@ struct WorldDuration {
   }
 };
 
-struct WorldRoute {
-  std::string name;
+// Dense indices into the World tables below. Ingest interns every GTFS id, so that the rest of
+// the World (and everything built from it) works with these instead of strings.
+using WorldRouteIndex = uint32_t;
+using WorldStopIndex = uint32_t;
+using WorldTripIndex = uint32_t;
+
+// Marks a missing index, e.g. the parent station of a root stop.
+constexpr uint32_t kNoWorldIndex = std::numeric_limits<uint32_t>::max();
+
+// Routes, as a struct of arrays indexed by WorldRouteIndex.
+struct WorldRoutes {
+  // GTFS route ids (with the feed prefix).
+  StringInterner ids;
+  std::vector<std::string> names;
+
+  size_t size() const { return ids.size(); }
+
+  // Returns the index of the route with id `id`, adding a row for it if it is new.
+  WorldRouteIndex GetOrAdd(absl::string_view id);
 };
 
-struct WorldStop {
-  std::string name;
-  std::optional<std::string> parent_station_id;
-  std::string lat;
-  std::string lon;
+// Stops, as a struct of arrays indexed by WorldStopIndex.
+struct WorldStops {
+  // GTFS stop ids (with the feed prefix).
+  StringInterner ids;
+  std::vector<std::string> names;
+  // kNoWorldIndex for root stops.
+  std::vector<WorldStopIndex> parent_stations;
+  std::vector<std::string> lats;
+  std::vector<std::string> lons;
 
   // Position in meters on an approximate flattening of the whole area.
-  double meters_x;
-  double meters_y;
+  std::vector<double> meters_x;
+  std::vector<double> meters_y;
+
+  // Whether trips are segmented at this stop. See `segment_stop_ids` in `readGTFSToWorld`.
+  std::vector<bool> is_segment_stop;
+
+  size_t size() const { return ids.size(); }
+
+  // Returns the index of the stop with id `id`, adding a row for it if it is new.
+  WorldStopIndex GetOrAdd(absl::string_view id);
 };
 
 struct WorldSegment {
   WorldTime departure_time;
   WorldDuration duration;
 
-  std::string origin_stop_id;
-  std::string destination_stop_id;
-  std::string route_id;
-  std::string trip_id;
+  WorldStopIndex origin_stop;
+  WorldStopIndex destination_stop;
+  WorldRouteIndex route;
+  WorldTripIndex trip;
+};
+
+// One run of a trip: the trip itself for ordinary trips, or one of the runs of a frequency-based
+// trip (see `WorldTrips::frequencies`).
+struct WorldTripRun {
+  WorldTripIndex trip;
+  // When the run leaves its first stop. Only set for frequency-based trips, because an ordinary
+  // trip has only one run.
+  WorldTime start;
+};
+
+// A segment that repeats at a regular interval, standing in for one WorldSegment per departure.
+struct WorldRepeatingSegment {
+  Range departures;
+  WorldDuration duration;
+
+  WorldStopIndex origin_stop;
+  WorldStopIndex destination_stop;
+  WorldRouteIndex route;
+  // The run making departure `i` is `World::repeating_segment_runs[first_run + i]`.
+  uint32_t first_run;
 };
 
 struct WorldTripStopTimes {
-  std::string stop_id;
+  WorldStopIndex stop;
   std::optional<WorldTime> arrival_time;
   std::optional<WorldTime> departure_time;
   bool timepoint;
 
   bool operator==(const WorldTripStopTimes& other) const {
-    return stop_id == other.stop_id && arrival_time == other.arrival_time && departure_time == other.departure_time;
+    return stop == other.stop && arrival_time == other.arrival_time && departure_time == other.departure_time;
+  }
+};
+
+// Index of a stop pattern in WorldTrips.
+using WorldPatternIndex = uint32_t;
+
+// Marks a missing time in `WorldTrips::arrival_times` and `WorldTrips::departure_times`.
+constexpr uint32_t kNoWorldTime = std::numeric_limits<uint32_t>::max();
+
+// The stop times of one trip, viewed in place in WorldTrips. Reads like a
+// `const std::vector<WorldTripStopTimes>`, except that the elements are put together when they are
+// read, so they are returned by value.
+class WorldTripStopTimesView {
+public:
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = WorldTripStopTimes;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = WorldTripStopTimes;
+
+    iterator() = default;
+
+    WorldTripStopTimes operator*() const { return Get(stop_, arrival_time_, departure_time_); }
+    iterator& operator++() {
+      ++stop_;
+      ++arrival_time_;
+      ++departure_time_;
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator old = *this;
+      ++*this;
+      return old;
+    }
+    bool operator==(const iterator& other) const { return stop_ == other.stop_; }
+
+  private:
+    friend class WorldTripStopTimesView;
+    iterator(const WorldStopIndex* stop, const uint32_t* arrival_time, const uint32_t* departure_time)
+      : stop_(stop), arrival_time_(arrival_time), departure_time_(departure_time) {}
+
+    const WorldStopIndex* stop_ = nullptr;
+    const uint32_t* arrival_time_ = nullptr;
+    const uint32_t* departure_time_ = nullptr;
+  };
+  using const_iterator = iterator;
+  using value_type = WorldTripStopTimes;
+
+  WorldTripStopTimesView() = default;
+  WorldTripStopTimesView(std::span<const WorldStopIndex> stops, const uint32_t* arrival_times, const uint32_t* departure_times)
+    : stops_(stops), arrival_times_(arrival_times), departure_times_(departure_times) {}
+
+  size_t size() const { return stops_.size(); }
+  bool empty() const { return stops_.empty(); }
+  WorldTripStopTimes operator[](size_t i) const { return Get(&stops_[i], &arrival_times_[i], &departure_times_[i]); }
+  WorldTripStopTimes front() const { return (*this)[0]; }
+  WorldTripStopTimes back() const { return (*this)[size() - 1]; }
+
+  iterator begin() const { return iterator(stops_.data(), arrival_times_, departure_times_); }
+  iterator end() const {
+    return iterator(stops_.data() + size(), arrival_times_ + size(), departure_times_ + size());
+  }
+
+  bool operator==(const WorldTripStopTimesView& other) const {
+    return std::equal(begin(), end(), other.begin(), other.end());
   }
+
+private:
+  static WorldTripStopTimes Get(const WorldStopIndex* stop, const uint32_t* arrival_time, const uint32_t* departure_time) {
+    auto time = [](uint32_t seconds) {
+      return seconds == kNoWorldTime ? std::nullopt : std::optional<WorldTime>(WorldTime(seconds));
+    };
+    return WorldTripStopTimes{*stop, time(*arrival_time), time(*departure_time), true};
+  }
+
+  std::span<const WorldStopIndex> stops_;
+  const uint32_t* arrival_times_ = nullptr;
+  const uint32_t* departure_times_ = nullptr;
 };
 
-struct WorldTrip {
-  std::string route_id;
-  std::vector<WorldTripStopTimes> stop_times;
+// Trips, as a struct of arrays indexed by WorldTripIndex.
+//
+// Most trips of a line make exactly the same stops as many other trips, so stop times are stored
+// like RAPTOR's route patterns: each distinct sequence of stops is a pattern that is stored once,
+// and a trip is its pattern plus its times at the pattern's stops.
+struct WorldTrips {
+  // GTFS trip ids (with the feed prefix).
+  StringInterner ids;
+  std::vector<WorldRouteIndex> routes;
+  // Indices into `World::calendar`.
+  std::vector<ServiceIndex> services;
+  // Start times of the runs of trips from frequencies.txt; empty for ordinary trips. The stop times
+  // of a frequency-based trip are a template: each run is shifted so that it leaves its first stop
+  // at the run's start time.
+  std::vector<std::vector<Range>> frequencies;
+
+  // The stops of pattern `p` are `pattern_stops[pattern_offsets[p]]` up to
+  // `pattern_stops[pattern_offsets[p + 1]]`.
+  std::vector<uint32_t> pattern_offsets = {0};
+  std::vector<WorldStopIndex> pattern_stops;
+  // The pattern of each trip, or kNoWorldIndex for a trip without stop times.
+  std::vector<WorldPatternIndex> patterns;
+  // The times of trip `t` at the stops of its pattern start at `arrival_times[time_offsets[t]]` and
+  // `departure_times[time_offsets[t]]`. The trips of a pattern are next to each other, in order of
+  // departure, so that they can be scanned together, except for trips that `ReplaceStopTimes` has
+  // moved to a new pattern.
+  std::vector<uint32_t> time_offsets;
+  std::vector<uint32_t> arrival_times;
+  std::vector<uint32_t> departure_times;
+
+  size_t size() const { return ids.size(); }
+  size_t num_patterns() const { return pattern_offsets.size() - 1; }
+
+  // Returns the index of the trip with id `id`, adding a row for it if it is new.
+  WorldTripIndex GetOrAdd(absl::string_view id);
+
+  std::span<const WorldStopIndex> PatternStops(WorldPatternIndex pattern) const;
+  WorldTripStopTimesView StopTimes(WorldTripIndex trip) const;
+
+  // Sets the stop times of trips `first_trip`, `first_trip + 1`, ... to `stop_times`. The trips must
+  // not have stop times yet. Trips in `stop_times` that make the same stops share a pattern.
+  void SetStopTimes(WorldTripIndex first_trip, std::vector<std::vector<WorldTripStopTimes>>&& stop_times);
+
+  // The scheduled stop times of trips whose stop times `ReplaceStopTimes` has replaced, as (pattern,
+  // time offset), so that realtime updates can always be applied relative to the schedule. Not kept
+  // by `MergeWorlds` or by snapshots.
+  std::unordered_map<WorldTripIndex, std::pair<WorldPatternIndex, uint32_t>> scheduled_stop_times;
+
+  // The stop times of `trip` before any `ReplaceStopTimes`.
+  WorldTripStopTimesView ScheduledStopTimes(WorldTripIndex trip) const;
+
+  // Replaces the stop times of `trip`, which may already have some, remembering its scheduled ones.
+  // The first replacement appends the new times, giving the trip a pattern of its own if it makes
+  // different stops. Later replacements that make the same stops overwrite their times in place.
+  void ReplaceStopTimes(WorldTripIndex trip, const std::vector<WorldTripStopTimes>& stop_times);
 };
 
 struct WorldAnytimeConnection {
-  std::string origin_stop_id;
-  std::string destination_stop_id;
+  WorldStopIndex origin_stop;
+  WorldStopIndex destination_stop;
   WorldDuration duration;
 };
 
+struct World;
+
+// The segments and repeating segments of a World, grouped by origin stop.
+struct WorldDepartureIndex {
+  // The segments leaving stop `s` are `world.segments[segments[i]]` for `i` from
+  // `segment_offsets[s]` up to `segment_offsets[s + 1]`, sorted by WorldSegmentComp.
+  std::vector<uint32_t> segment_offsets;
+  std::vector<uint32_t> segments;
+  // The repeating segments leaving stop `s` are `world.repeating_segments[repeating_segments[i]]`
+  // for `i` from `repeating_offsets[s]` up to `repeating_offsets[s + 1]`.
+  std::vector<uint32_t> repeating_offsets;
+  std::vector<uint32_t> repeating_segments;
+
+  // The departures from `stop`, sorted by WorldSegmentComp.
+  std::vector<WorldSegment> At(const World& world, WorldStopIndex stop) const;
+
+  // The departures from `stop` that leave in [from, to], sorted by WorldSegmentComp. Only the
+  // departures of repeating segments that fall in the window are expanded.
+  std::vector<WorldSegment> Between(const World& world, WorldStopIndex stop, WorldTime from, WorldTime to) const;
+};
+
 struct World {
-  std::map<std::string, WorldRoute> routes;
-  std::map<std::string, WorldStop> stops;
-  std::map<std::string, WorldTrip> trips;
+  WorldRoutes routes;
+  WorldStops stops;
+  WorldTrips trips;
+  // The days that each trip's service runs on.
+  ServiceCalendar calendar;
+  // The segments of the trips that run on one day. See `SegmentWorld`.
   std::vector<WorldSegment> segments;
+  // More segments of the same day, compressed into regular departures. All runs of frequency-based
+  // trips end up here, as do ordinary trips that happen to depart at a regular headway.
+  std::vector<WorldRepeatingSegment> repeating_segments;
+  std::vector<WorldTripRun> repeating_segment_runs;
+  // Index of `segments` and `repeating_segments`, kept up to date by `SegmentWorld` and
+  // `MergeWorlds`.
+  WorldDepartureIndex departures;
   std::vector<WorldAnytimeConnection> anytime_connections;
 
   void prettyRoutes(std::string& result) const;
@@ -122,7 +346,37 @@ std::optional<std::string> readServiceIds(
   std::unordered_set<std::string>& service_ids
 );
 
-// Adds the GTFS data at `directory` to `world`.
+// Parts of a feed to leave out while reading it, so that they never take up space in the World or
+// in anything built from it.
+struct WorldFilter {
+  // If set, a trip's stop times are kept only if the trip arrives at or departs from the stop within
+  // [earliest, latest]. Frequency-based trips are not filtered by time.
+  std::optional<WorldTime> earliest;
+  std::optional<WorldTime> latest;
+
+  // Route and agency ids, with the feed prefix. When an include list is non-empty, the routes (or
+  // the routes of agencies) that are not on it are left out. Routes without an agency_id pass the
+  // agency filters.
+  std::unordered_set<std::string> include_routes;
+  std::unordered_set<std::string> exclude_routes;
+  std::unordered_set<std::string> include_agencies;
+  std::unordered_set<std::string> exclude_agencies;
+
+  // If set, stops whose root station is outside of the box are dropped from trips. A trip that
+  // leaves the box and comes back makes one segment across the part outside it.
+  struct BoundingBox {
+    double min_lat;
+    double min_lon;
+    double max_lat;
+    double max_lon;
+  };
+  std::optional<BoundingBox> bounding_box;
+};
+
+// Adds the GTFS data at `directory` to `world`, with the trips that run on at least one of `dates`.
+// Does not touch `world.segments`; see `SegmentWorld`.
+//
+// `directory` can also be a .zip archive of the feed, which is read without unpacking it.
 //
 // All GTFS IDs are prefixed with `id_prefix`.
 //
@@ -132,7 +386,24 @@ std::optional<std::string> readServiceIds(
 //
 // Trips are always interpreted as stopping at the root ancestor of the stop specified in the trip.
 //
+// Whatever `filter` leaves out is dropped as the files are read.
+//
+// Uses at most `num_threads` threads, counting the calling thread, or one per core if it is 0.
+// Callers that read several feeds at once should split the cores between them.
+//
 // Returns an error message if something went wrong, otherwise returns nullopt.
+std::optional<std::string> readGTFSToWorldForDates(
+  const std::string& directory,
+  const std::string& id_prefix,
+  const std::vector<absl::CivilDay>& dates,
+  const std::unordered_set<std::string>* segment_stop_ids,
+  const WorldFilter& filter,
+  World& world,
+  unsigned int num_threads = 0
+);
+
+// Like `readGTFSToWorldForDates` with just `date` and no filter, and then adds the segments of the
+// feed's trips to `world.segments`.
 std::optional<std::string> readGTFSToWorld(
   const std::string& directory,
   const std::string& id_prefix,
@@ -141,4 +412,155 @@ std::optional<std::string> readGTFSToWorld(
   World& world
 );
 
-void AddWalkingSegments(World& world);
+// Replaces `world.segments` and `world.repeating_segments` with the segments of the trips in
+// `world` that run on `date`.
+//
+// This is cheap compared to reading the feeds, so a World read for several dates can be segmented
+// for each of them in turn.
+//
+// Uses at most `num_threads` threads, counting the calling thread, or one per core if it is 0.
+void SegmentWorld(absl::CivilDay date, World& world, unsigned int num_threads = 0);
+
+// Calls `sink(segment, run)` for each segment of the trips in `world` that run on `date`, trip by
+// trip in id order, without keeping the segments anywhere. These are the segments that
+// `SegmentWorld(date, world)` would make, before regular departures are compressed. Trips are
+// segmented in parallel a batch at a time, so only a batch's worth of segments exists at once.
+//
+// Ignores `world.segments` and `world.repeating_segments`, so `world` does not need to have been
+// segmented.
+void StreamSegments(
+  absl::CivilDay date,
+  const World& world,
+  absl::FunctionRef<void(const WorldSegment&, const WorldTripRun&)> sink
+);
+
+// The order that `World::segments` is kept in: by departure time, with ties broken by duration.
+bool WorldSegmentComp(const WorldSegment& a, const WorldSegment& b);
+
+// Returns an index of the departures in `world.segments` and `world.repeating_segments`.
+WorldDepartureIndex BuildDepartureIndex(const World& world);
+
+// Calls `f(segment, run)` for each departure of `repeating`, whose runs start at
+// `runs[repeating.first_run]`.
+template <typename F>
+void ForEachDeparture(const WorldRepeatingSegment& repeating, const std::vector<WorldTripRun>& runs, F&& f) {
+  uint32_t run = repeating.first_run;
+  for (const unsigned int departure : repeating.departures) {
+    const WorldTripRun& trip_run = runs[run++];
+    f(
+      WorldSegment{
+        .departure_time = WorldTime(departure),
+        .duration = repeating.duration,
+        .origin_stop = repeating.origin_stop,
+        .destination_stop = repeating.destination_stop,
+        .route = repeating.route,
+        .trip = trip_run.trip,
+      },
+      trip_run
+    );
+  }
+}
+
+// Calls `f(segment, run)` for every segment in `world.segments` and every departure of
+// `world.repeating_segments`, in no particular order.
+template <typename F>
+void ForEachSegment(const World& world, F f) {
+  for (const WorldSegment& segment : world.segments) {
+    f(segment, WorldTripRun{segment.trip, WorldTime()});
+  }
+  for (const WorldRepeatingSegment& repeating : world.repeating_segments) {
+    ForEachDeparture(repeating, world.repeating_segment_runs, f);
+  }
+}
+
+// Moves everything in `src` into `dest`, keeping `dest.segments` sorted.
+//
+// The ids in `src` and `dest` must be disjoint, e.g. because they were read with different
+// `id_prefix`es.
+void MergeWorld(World&& src, World& dest);
+
+// Moves everything in all of `srcs` into `dest`, keeping `dest.segments` sorted.
+//
+// Like `MergeWorld`, but the segments are combined with a single k-way merge. Segments that compare
+// equal are ordered by where they came from (`dest` first, then `srcs` in order), so the result
+// only depends on the inputs, not on the order they were produced in.
+void MergeWorlds(std::vector<World>&& srcs, World& dest);
+
+// What `ApplyTripUpdates` did to one trip.
+struct WorldTripChange {
+  WorldTripIndex trip;
+  // The trip's segments on the updated date, before and after the update.
+  std::vector<WorldSegment> old_segments;
+  std::vector<WorldSegment> new_segments;
+};
+
+// Applies the realtime `updates` of the feed read with `id_prefix` to the trips in `world` that run
+// on `date`, which must be the date that `world` is segmented for. Only the updated trips are
+// re-segmented: their segments in `world.segments` and `world.repeating_segments` are replaced, and
+// `world.departures` is rebuilt. Appends what happened to each updated trip to `changes`, for
+// `ApplyTripChanges` to patch a Problem with.
+//
+// - Delays are relative to the trip's scheduled stop times, even if an earlier call has already
+//   updated it, and propagate down the trip until a later stop time update says otherwise. Skipped
+//   stops are dropped from the trip. Stop time updates are matched to the trip's stops by stop_id; ones
+//   with only a stop_sequence are ignored, because the World does not keep stop sequences.
+// - Canceled and deleted trips lose their stop times.
+// - Added trips get the stops and times of their stop time updates, and a service that runs on just
+//   `date`. Their route must already be in `world`.
+// - Absolute times are converted to service day times in `time_zone`, the feed's agency timezone.
+//
+// Updates for frequency-based trips, for trips or routes that `world` does not have, for trips that
+// do not run on `date`, for other dates, and with other schedule relationships are skipped. So are
+// updates that leave a trip's times out of order. Trips that a later feed no longer mentions keep
+// their last update.
+void ApplyTripUpdates(
+  const std::vector<RealtimeTripUpdate>& updates,
+  const std::string& id_prefix,
+  absl::CivilDay date,
+  absl::TimeZone time_zone,
+  World& world,
+  std::vector<WorldTripChange>& changes
+);
+
+struct WalkingOptions {
+  // Stops at most this far apart, in a straight line, get walking connections.
+  double max_meters = 500;
+  double meters_per_second = 1;
+};
+
+// Adds anytime connections between the root stops within walking distance of each other.
+void AddWalkingSegments(World& world, const WalkingOptions& options = {});
+
+struct StationUnificationOptions {
+  // Root stops of different feeds are unified if they are at most this far apart, in a straight
+  // line, and their names are similar enough. 0 turns this off, leaving just `merge`.
+  double max_meters = 150;
+  // How much of the shorter name has to be in the longer one, as the fraction of its words that are
+  // in both. Case, punctuation and words like "station" are ignored, so "Millbrae" and "Millbrae
+  // (Caltrain Transfer Platform)" are 1.
+  double min_name_similarity = 1;
+
+  // Groups of stop ids (with the feed prefix) that are always unified, wherever they are.
+  std::vector<std::vector<std::string>> merge;
+  // Pairs of stop ids (with the feed prefix) that are never unified automatically.
+  std::vector<std::pair<std::string, std::string>> separate;
+};
+
+// Collapses root stops that are really one station, e.g. a station that is in two feeds, into one
+// root stop, so that everything built from `world` has one vertex for it instead of several joined
+// by free transfers.
+//
+// Every stop of a group becomes a child of the group's first stop (in `world.stops` order), which
+// takes over all of their segments and anytime connections. `feed_prefixes` are the `id_prefix`es
+// that the feeds were read with: stops of the same feed are only unified by `options.merge`.
+//
+// Adds the id of each stop that was unified into another stop to `unified`, mapped to the id of
+// that stop.
+//
+// Returns an error message if something went wrong, otherwise returns nullopt.
+std::optional<std::string> UnifyStations(
+  const std::vector<std::string>& feed_prefixes,
+  const StationUnificationOptions& options,
+  World& world,
+  std::unordered_map<std::string, std::string>& unified
+);
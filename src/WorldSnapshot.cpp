@@ -0,0 +1,642 @@
+#include "WorldSnapshot.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+
+#include "GTFSCsv.h"
+#include "MappedFile.h"
+
+namespace {
+
+// Bump this whenever the encoding below or the meaning of anything in World changes, so that old
+// snapshots are rebuilt instead of misread.
+constexpr uint32_t kSnapshotVersion = 6;
+constexpr char kSnapshotMagic[8] = {'V', 'A', 'T', 'S', 'W', 'R', 'L', 'D'};
+
+// Days are stored relative to this.
+constexpr absl::CivilDay kEpoch(1970, 1, 1);
+
+// Marks a missing time in the encoding.
+constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+// The GTFS files that `readGTFSToWorld` reads. A snapshot is stale if any of them change.
+constexpr const char* kSourceFiles[] = {
+  "calendar.txt",
+  "calendar_dates.txt",
+  "routes.txt",
+  "stops.txt",
+  "trips.txt",
+  "stop_times.txt",
+  "frequencies.txt",
+};
+
+struct SourceFingerprint {
+  std::string file;
+  // -1 if the file does not exist.
+  int64_t size;
+  int64_t mtime;
+  // Hash of the file's contents. Only computed when needed, because it means reading the whole file.
+  std::optional<uint64_t> content_hash;
+};
+
+// The path of `file`, one of the files that a snapshot of the feed at `directory` was compiled from.
+// A feed in a zip archive has just one source file, the archive itself.
+std::string sourcePath(const std::string& directory, const std::string& file) {
+  return isGTFSArchive(directory) ? directory : directory + "/" + file;
+}
+
+std::vector<SourceFingerprint> fingerprintSources(const std::string& directory) {
+  std::vector<SourceFingerprint> result;
+  std::vector<std::string> files(std::begin(kSourceFiles), std::end(kSourceFiles));
+  if (isGTFSArchive(directory)) {
+    files = {std::filesystem::path(directory).filename().string()};
+  }
+  for (const std::string& file : files) {
+    const std::filesystem::path path = sourcePath(directory, file);
+    std::error_code size_ec, mtime_ec;
+    const uintmax_t size = std::filesystem::file_size(path, size_ec);
+    const auto mtime = std::filesystem::last_write_time(path, mtime_ec);
+    if (size_ec || mtime_ec) {
+      result.push_back({file, -1, 0, 0});
+    } else {
+      result.push_back({file, static_cast<int64_t>(size), mtime.time_since_epoch().count(), std::nullopt});
+    }
+  }
+  return result;
+}
+
+// A hash of `contents` that is stable across runs and builds. Mixes a word at a time, so that
+// hashing a feed is cheap next to parsing it.
+uint64_t contentHash(absl::string_view contents) {
+  constexpr uint64_t kMul = 0x9E3779B97F4A7C15ull;
+  uint64_t hash = contents.size() * kMul;
+  size_t i = 0;
+  for (; i + 8 <= contents.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, contents.data() + i, sizeof(word));
+    hash = (hash ^ word) * kMul;
+    hash ^= hash >> 29;
+  }
+  uint64_t tail = 0;
+  std::memcpy(&tail, contents.data() + i, contents.size() - i);
+  hash = (hash ^ tail) * kMul;
+  return hash ^ (hash >> 32);
+}
+
+// Fills in `source.content_hash` from the file in `directory`.
+void hashSource(const std::string& directory, SourceFingerprint& source) {
+  if (source.content_hash.has_value()) {
+    return;
+  }
+  MappedFile mapped;
+  if (source.size <= 0 || mapped.Open(sourcePath(directory, source.file)).has_value()) {
+    source.content_hash = 0;
+    return;
+  }
+  source.content_hash = contentHash(mapped.contents());
+}
+
+std::string snapshotKey(
+  const std::string& directory,
+  const std::string& id_prefix,
+  const std::vector<absl::CivilDay>& dates,
+  const std::unordered_set<std::string>* segment_stop_ids,
+  const WorldFilter& filter
+) {
+  std::error_code ec;
+  std::filesystem::path absolute_directory = std::filesystem::absolute(directory, ec);
+  std::vector<absl::CivilDay> sorted_dates = dates;
+  std::sort(sorted_dates.begin(), sorted_dates.end());
+  sorted_dates.erase(std::unique(sorted_dates.begin(), sorted_dates.end()), sorted_dates.end());
+  std::string key = absl::StrCat(
+    ec ? directory : absolute_directory.lexically_normal().string(), "\n",
+    id_prefix, "\n",
+    absl::StrJoin(sorted_dates, ",", [](std::string* out, absl::CivilDay date) {
+      absl::StrAppend(out, absl::FormatCivilTime(date));
+    }), "\n"
+  );
+  if (segment_stop_ids == nullptr) {
+    absl::StrAppend(&key, "*");
+  } else {
+    std::vector<std::string> sorted(segment_stop_ids->begin(), segment_stop_ids->end());
+    std::sort(sorted.begin(), sorted.end());
+    absl::StrAppend(&key, absl::StrJoin(sorted, ","));
+  }
+
+  // The filter changes what is in the World, so it is part of the key.
+  auto optional_time = [](const std::optional<WorldTime>& time) {
+    return time.has_value() ? absl::StrCat(time->seconds) : std::string("*");
+  };
+  absl::StrAppend(&key, "\n", optional_time(filter.earliest), "-", optional_time(filter.latest));
+  for (const std::unordered_set<std::string>* ids : {
+    &filter.include_routes, &filter.exclude_routes, &filter.include_agencies, &filter.exclude_agencies,
+  }) {
+    std::vector<std::string> sorted(ids->begin(), ids->end());
+    std::sort(sorted.begin(), sorted.end());
+    absl::StrAppend(&key, "\n", absl::StrJoin(sorted, ","));
+  }
+  if (filter.bounding_box.has_value()) {
+    const WorldFilter::BoundingBox& box = *filter.bounding_box;
+    // StrCat keeps only 6 significant digits, which would give nearby boxes the same key.
+    absl::StrAppendFormat(&key, "\n%.17g,%.17g,%.17g,%.17g", box.min_lat, box.min_lon, box.max_lat, box.max_lon);
+  }
+  return key;
+}
+
+// FNV-1a. Stable across runs and builds, unlike absl::Hash, so it is usable in file names.
+uint64_t fingerprintHash(absl::string_view s) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : s) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string snapshotPath(const std::string& cache_dir, const std::string& id_prefix, const std::string& key) {
+  return absl::StrFormat("%s/%s%016x.world", cache_dir, id_prefix, fingerprintHash(key));
+}
+
+// === Encoding ===
+//
+// A snapshot is a header (magic, version, key, source fingerprints) followed by a table of all
+// distinct strings in the World and then the World's tables, with every string replaced by its
+// u32 index in the string table. References between tables are the World's own indices, which is
+// why tables are written in index order. Stop times, which are the bulk of a snapshot, are
+// fixed-size records. Integers are stored in native byte order; snapshots are a local cache, not an
+// interchange format.
+//
+// Only what `readGTFSToWorldForDates` fills in is stored. It never segments trips or adds anytime
+// connections, so a feed's World has neither, and callers derive them from the decoded World.
+
+class SnapshotWriter {
+public:
+  void PutU8(uint8_t x) { buf_.push_back(static_cast<char>(x)); }
+  void PutU32(uint32_t x) { Put(&x, sizeof(x)); }
+  void PutU64(uint64_t x) { Put(&x, sizeof(x)); }
+  void PutI64(int64_t x) { Put(&x, sizeof(x)); }
+  void PutF64(double x) { Put(&x, sizeof(x)); }
+  void PutString(absl::string_view s) {
+    PutU32(s.size());
+    buf_.append(s.data(), s.size());
+  }
+  void PutBytes(absl::string_view s) { buf_.append(s.data(), s.size()); }
+
+  std::string& buf() { return buf_; }
+
+private:
+  void Put(const void* x, size_t n) { buf_.append(static_cast<const char*>(x), n); }
+
+  std::string buf_;
+};
+
+class StringTable {
+public:
+  uint32_t Add(const std::string& s) {
+    auto [it, inserted] = indices_.try_emplace(s, strings_.size());
+    if (inserted) {
+      strings_.push_back(&it->first);
+    }
+    return it->second;
+  }
+
+  void Write(SnapshotWriter& writer) const {
+    writer.PutU32(strings_.size());
+    for (const std::string* s : strings_) {
+      writer.PutString(*s);
+    }
+  }
+
+private:
+  std::unordered_map<std::string, uint32_t> indices_;
+  std::vector<const std::string*> strings_;
+};
+
+uint32_t encodeTime(const std::optional<WorldTime>& time) {
+  return time.has_value() ? time->seconds : kNone;
+}
+
+void encodeSnapshotHeader(const std::string& key, const std::vector<SourceFingerprint>& sources, SnapshotWriter& header) {
+  header.PutBytes(absl::string_view(kSnapshotMagic, sizeof(kSnapshotMagic)));
+  header.PutU32(kSnapshotVersion);
+  header.PutString(key);
+  header.PutU32(sources.size());
+  for (const SourceFingerprint& source : sources) {
+    header.PutString(source.file);
+    header.PutI64(source.size);
+    header.PutI64(source.mtime);
+    header.PutU64(source.content_hash.value_or(0));
+  }
+}
+
+std::string encodeSnapshot(
+  const std::string& key,
+  const std::vector<SourceFingerprint>& sources,
+  const World& world
+) {
+  StringTable strings;
+  SnapshotWriter body;
+
+  body.PutU32(world.routes.size());
+  for (WorldRouteIndex route = 0; route < world.routes.size(); ++route) {
+    body.PutU32(strings.Add(world.routes.ids.Get(route)));
+    body.PutU32(strings.Add(world.routes.names[route]));
+  }
+
+  body.PutU32(world.stops.size());
+  for (WorldStopIndex stop = 0; stop < world.stops.size(); ++stop) {
+    body.PutU32(strings.Add(world.stops.ids.Get(stop)));
+    body.PutU32(strings.Add(world.stops.names[stop]));
+    body.PutU32(world.stops.parent_stations[stop]);
+    body.PutU32(strings.Add(world.stops.lats[stop]));
+    body.PutU32(strings.Add(world.stops.lons[stop]));
+    body.PutF64(world.stops.meters_x[stop]);
+    body.PutF64(world.stops.meters_y[stop]);
+    body.PutU8(world.stops.is_segment_stop[stop]);
+  }
+
+  const ServiceCalendar& calendar = world.calendar;
+  body.PutI64(calendar.first_day() - kEpoch);
+  body.PutI64(calendar.num_days());
+  body.PutU32(calendar.size());
+  for (ServiceIndex service = 0; service < calendar.size(); ++service) {
+    body.PutU32(strings.Add(calendar.service_ids().Get(service)));
+    for (size_t w = 0; w < calendar.words_per_service(); ++w) {
+      body.PutU64(calendar.service_days(service)[w]);
+    }
+  }
+
+  body.PutU32(world.trips.size());
+  for (WorldTripIndex trip = 0; trip < world.trips.size(); ++trip) {
+    body.PutU32(strings.Add(world.trips.ids.Get(trip)));
+    body.PutU32(world.trips.routes[trip]);
+    body.PutU32(world.trips.services[trip]);
+    const WorldTripStopTimesView stop_times = world.trips.StopTimes(trip);
+    body.PutU32(stop_times.size());
+    for (const WorldTripStopTimes stop_time : stop_times) {
+      body.PutU32(stop_time.stop);
+      body.PutU32(encodeTime(stop_time.arrival_time));
+      body.PutU32(encodeTime(stop_time.departure_time));
+      body.PutU8(stop_time.timepoint);
+    }
+    body.PutU32(world.trips.frequencies[trip].size());
+    for (const Range& starts : world.trips.frequencies[trip]) {
+      body.PutU32(starts.start);
+      body.PutU32(starts.finish);
+      body.PutU32(starts.interval);
+    }
+  }
+
+  SnapshotWriter header;
+  encodeSnapshotHeader(key, sources, header);
+  strings.Write(header);
+  header.PutBytes(body.buf());
+  return std::move(header.buf());
+}
+
+// === Decoding ===
+
+// Reads values out of a mapped snapshot. Running off the end sets `ok` to false and returns
+// zeros, so callers can decode a whole section and check `ok` once afterwards.
+class SnapshotReader {
+public:
+  explicit SnapshotReader(absl::string_view contents)
+    : p_(contents.data()), end_(contents.data() + contents.size()) {}
+
+  bool ok() const { return ok_; }
+  const char* position() const { return p_; }
+
+  uint8_t GetU8() { uint8_t x = 0; Get(&x, sizeof(x)); return x; }
+  uint32_t GetU32() { uint32_t x = 0; Get(&x, sizeof(x)); return x; }
+  uint64_t GetU64() { uint64_t x = 0; Get(&x, sizeof(x)); return x; }
+  int64_t GetI64() { int64_t x = 0; Get(&x, sizeof(x)); return x; }
+  double GetF64() { double x = 0; Get(&x, sizeof(x)); return x; }
+  absl::string_view GetBytes(size_t n) {
+    if (!Has(n)) {
+      return "";
+    }
+    absl::string_view result(p_, n);
+    p_ += n;
+    return result;
+  }
+  absl::string_view GetString() { return GetBytes(GetU32()); }
+
+  bool Has(size_t n) {
+    if (!ok_ || static_cast<size_t>(end_ - p_) < n) {
+      ok_ = false;
+    }
+    return ok_;
+  }
+
+private:
+  void Get(void* x, size_t n) {
+    if (Has(n)) {
+      std::memcpy(x, p_, n);
+      p_ += n;
+    }
+  }
+
+  const char* p_;
+  const char* end_;
+  bool ok_ = true;
+};
+
+std::optional<std::string> decodeSnapshot(
+  absl::string_view contents,
+  const std::string& key,
+  const std::string& directory,
+  std::vector<SourceFingerprint>& sources,
+  World& world,
+  size_t& header_size,
+  bool& sources_touched
+) {
+  sources_touched = false;
+  SnapshotReader reader(contents);
+  if (reader.GetBytes(sizeof(kSnapshotMagic)) != absl::string_view(kSnapshotMagic, sizeof(kSnapshotMagic))) {
+    return "bad magic";
+  }
+  if (reader.GetU32() != kSnapshotVersion) {
+    return "old version";
+  }
+  if (reader.GetString() != key) {
+    return "key mismatch";
+  }
+  const uint32_t num_sources = reader.GetU32();
+  if (num_sources != sources.size()) {
+    return "source files changed";
+  }
+  for (SourceFingerprint& source : sources) {
+    const absl::string_view file = reader.GetString();
+    const int64_t size = reader.GetI64();
+    const int64_t mtime = reader.GetI64();
+    const uint64_t content_hash = reader.GetU64();
+    if (file != source.file || size != source.size) {
+      return absl::StrCat(source.file, " changed");
+    }
+    if (mtime == source.mtime) {
+      source.content_hash = content_hash;
+      continue;
+    }
+    // Feeds are often re-downloaded unchanged, which only touches the modification time.
+    hashSource(directory, source);
+    if (*source.content_hash != content_hash) {
+      return absl::StrCat(source.file, " changed");
+    }
+    sources_touched = true;
+  }
+  header_size = reader.position() - contents.data();
+
+  const uint32_t num_strings = reader.GetU32();
+  if (!reader.Has(static_cast<size_t>(num_strings) * sizeof(uint32_t))) {
+    return "truncated";
+  }
+  std::vector<std::string> strings;
+  strings.reserve(num_strings);
+  for (uint32_t i = 0; i < num_strings; ++i) {
+    strings.emplace_back(reader.GetString());
+  }
+  bool bad_index = false;
+  auto string_at = [&strings, &bad_index](uint32_t index) -> const std::string& {
+    static const std::string empty;
+    if (index >= strings.size()) {
+      bad_index = true;
+      return empty;
+    }
+    return strings[index];
+  };
+  // Checks a reference into one of the World's tables, which all have `size` rows by the time
+  // anything refers to them.
+  auto table_index = [&bad_index](uint32_t index, size_t size) -> uint32_t {
+    if (index >= size) {
+      bad_index = true;
+      return 0;
+    }
+    return index;
+  };
+  auto decode_time = [](uint32_t seconds) -> std::optional<WorldTime> {
+    if (seconds == kNone) {
+      return std::nullopt;
+    }
+    return WorldTime(seconds);
+  };
+
+  // Everything is decoded into a scratch World first so that a corrupt snapshot never leaves
+  // `world` half-filled.
+  World decoded;
+
+  // Every table is written in index order, so re-interning the ids must give back the same
+  // indices. If it does not, the ids were not distinct and the snapshot is corrupt.
+  bool duplicate_id = false;
+
+  const uint32_t num_routes = reader.GetU32();
+  for (uint32_t i = 0; i < num_routes && reader.ok(); ++i) {
+    const WorldRouteIndex route = decoded.routes.GetOrAdd(string_at(reader.GetU32()));
+    duplicate_id |= route != i;
+    decoded.routes.names[route] = string_at(reader.GetU32());
+  }
+
+  const uint32_t num_stops = reader.GetU32();
+  std::vector<uint32_t> parent_stations;
+  for (uint32_t i = 0; i < num_stops && reader.ok(); ++i) {
+    const WorldStopIndex stop = decoded.stops.GetOrAdd(string_at(reader.GetU32()));
+    duplicate_id |= stop != i;
+    decoded.stops.names[stop] = string_at(reader.GetU32());
+    parent_stations.push_back(reader.GetU32());
+    decoded.stops.lats[stop] = string_at(reader.GetU32());
+    decoded.stops.lons[stop] = string_at(reader.GetU32());
+    decoded.stops.meters_x[stop] = reader.GetF64();
+    decoded.stops.meters_y[stop] = reader.GetF64();
+    decoded.stops.is_segment_stop[stop] = reader.GetU8() != 0;
+  }
+  if (duplicate_id) {
+    return "duplicate id";
+  }
+  for (WorldStopIndex stop = 0; stop < parent_stations.size(); ++stop) {
+    if (parent_stations[stop] != kNoWorldIndex) {
+      decoded.stops.parent_stations[stop] = table_index(parent_stations[stop], decoded.stops.size());
+    }
+  }
+
+  const int64_t calendar_first_day = reader.GetI64();
+  const int64_t calendar_num_days = reader.GetI64();
+  if (calendar_num_days < 0 || calendar_num_days > std::numeric_limits<uint32_t>::max()) {
+    return "bad calendar";
+  }
+  if (calendar_num_days > 0) {
+    decoded.calendar = ServiceCalendar(kEpoch + calendar_first_day, kEpoch + (calendar_first_day + calendar_num_days - 1));
+  }
+  const uint32_t num_services = reader.GetU32();
+  for (uint32_t i = 0; i < num_services && reader.ok(); ++i) {
+    const ServiceIndex service = decoded.calendar.GetOrAdd(string_at(reader.GetU32()));
+    duplicate_id |= service != i;
+    if (!reader.Has(decoded.calendar.words_per_service() * sizeof(uint64_t))) {
+      break;
+    }
+    for (size_t w = 0; w < decoded.calendar.words_per_service(); ++w) {
+      decoded.calendar.mutable_service_days(service)[w] = reader.GetU64();
+    }
+  }
+  if (duplicate_id) {
+    return "duplicate id";
+  }
+
+  const uint32_t num_trips = reader.GetU32();
+  // Stop times are decoded trip by trip and then packed into patterns all at once.
+  std::vector<std::vector<WorldTripStopTimes>> trip_stop_times;
+  for (uint32_t i = 0; i < num_trips && reader.ok(); ++i) {
+    const WorldTripIndex trip = decoded.trips.GetOrAdd(string_at(reader.GetU32()));
+    duplicate_id |= trip != i;
+    decoded.trips.routes[trip] = table_index(reader.GetU32(), decoded.routes.size());
+    decoded.trips.services[trip] = table_index(reader.GetU32(), decoded.calendar.size());
+    const uint32_t num_stop_times = reader.GetU32();
+    if (!reader.Has(static_cast<size_t>(num_stop_times) * 13)) {
+      break;
+    }
+    std::vector<WorldTripStopTimes>& stop_times = trip_stop_times.emplace_back();
+    stop_times.reserve(num_stop_times);
+    for (uint32_t j = 0; j < num_stop_times; ++j) {
+      WorldTripStopTimes stop_time;
+      stop_time.stop = table_index(reader.GetU32(), decoded.stops.size());
+      stop_time.arrival_time = decode_time(reader.GetU32());
+      stop_time.departure_time = decode_time(reader.GetU32());
+      stop_time.timepoint = reader.GetU8() != 0;
+      stop_times.push_back(stop_time);
+    }
+    const uint32_t num_frequencies = reader.GetU32();
+    if (!reader.Has(static_cast<size_t>(num_frequencies) * 3 * sizeof(uint32_t))) {
+      break;
+    }
+    for (uint32_t j = 0; j < num_frequencies; ++j) {
+      const uint32_t start = reader.GetU32();
+      const uint32_t finish = reader.GetU32();
+      const uint32_t interval = reader.GetU32();
+      // Check everything that the Range constructor asserts.
+      const bool valid = interval == 0
+        ? finish == start
+        : finish > start && (finish - start) % interval == 0;
+      if (!valid) {
+        bad_index = true;
+        break;
+      }
+      decoded.trips.frequencies[trip].push_back(Range(start, finish, interval));
+    }
+  }
+  if (duplicate_id) {
+    return "duplicate id";
+  }
+  decoded.trips.SetStopTimes(0, std::move(trip_stop_times));
+
+  if (!reader.ok()) {
+    return "truncated";
+  }
+  if (bad_index) {
+    return "bad index";
+  }
+  MergeWorld(std::move(decoded), world);
+  return std::nullopt;
+}
+
+std::optional<std::string> writeSnapshotFile(const std::string& path, const std::string& contents) {
+  // Write to a temporary file and rename it into place, so that readers never see a partial
+  // snapshot.
+  const std::string tmp_path = absl::StrCat(path, ".tmp", getpid());
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return absl::StrCat("Could not open ", tmp_path, " for writing");
+    }
+    out.write(contents.data(), contents.size());
+    if (!out.good()) {
+      return absl::StrCat("Could not write ", tmp_path);
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp_path, ec);
+    return absl::StrCat("Could not rename ", tmp_path, " to ", path);
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+std::optional<std::string> readGTFSToWorldCached(
+  const std::string& cache_dir,
+  const std::string& directory,
+  const std::string& id_prefix,
+  const std::vector<absl::CivilDay>& dates,
+  const std::unordered_set<std::string>* segment_stop_ids,
+  const WorldFilter& filter,
+  World& world,
+  bool* used_snapshot,
+  unsigned int num_threads
+) {
+  if (used_snapshot != nullptr) {
+    *used_snapshot = false;
+  }
+
+  const std::string key = snapshotKey(directory, id_prefix, dates, segment_stop_ids, filter);
+  const std::string path = snapshotPath(cache_dir, id_prefix, key);
+
+  std::vector<SourceFingerprint> sources = fingerprintSources(directory);
+  MappedFile mapped;
+  if (!mapped.Open(path).has_value()) {
+    size_t header_size = 0;
+    bool sources_touched = false;
+    const auto stale_reason = decodeSnapshot(mapped.contents(), key, directory, sources, world, header_size, sources_touched);
+    if (!stale_reason.has_value()) {
+      if (used_snapshot != nullptr) {
+        *used_snapshot = true;
+      }
+      if (sources_touched) {
+        // Record the new modification times, so that the files do not have to be hashed again.
+        SnapshotWriter refreshed;
+        encodeSnapshotHeader(key, sources, refreshed);
+        refreshed.PutBytes(mapped.contents().substr(header_size));
+        const auto write_err = writeSnapshotFile(path, refreshed.buf());
+        if (write_err.has_value()) {
+          std::cerr << "Warning: " << *write_err << "\n";
+        }
+      }
+      return std::nullopt;
+    }
+    std::cout << "Rebuilding snapshot " << path << " (" << *stale_reason << ")\n";
+  }
+
+  // Fingerprint before parsing, so that a feed that changes while we parse it is stale next time.
+  sources = fingerprintSources(directory);
+  for (SourceFingerprint& source : sources) {
+    hashSource(directory, source);
+  }
+
+  World feed_world;
+  const auto err_opt = readGTFSToWorldForDates(directory, id_prefix, dates, segment_stop_ids, filter, feed_world, num_threads);
+  if (err_opt.has_value()) {
+    return err_opt;
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(cache_dir, ec);
+  const auto write_err = writeSnapshotFile(path, encodeSnapshot(key, sources, feed_world));
+  if (write_err.has_value()) {
+    std::cerr << "Warning: " << *write_err << "\n";
+  }
+
+  MergeWorld(std::move(feed_world), world);
+  return std::nullopt;
+}
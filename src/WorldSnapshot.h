@@ -0,0 +1,41 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "absl/time/civil_time.h"
+
+#include "World.h"
+
+// Like `readGTFSToWorldForDates`, but goes through a compiled snapshot of the feed in `cache_dir`.
+//
+// Snapshots are keyed by (`directory`, `id_prefix`, `dates`, `segment_stop_ids`, `filter`). If
+// there is an up-to-date snapshot for the key, it is memory-mapped and decoded into `world` instead
+// of parsing the GTFS CSVs. Decoding still builds every table, but from fixed-size records and one
+// copy of each string rather than CSV text. Otherwise the feed is parsed as usual and a snapshot is written for next time. A
+// snapshot is stale when the contents of any of the GTFS files it was compiled from have changed. Files are
+// only hashed when their size is unchanged but their modification time is not, and a snapshot that
+// is still good gets the new modification times, so re-downloading an unchanged feed costs one
+// hash of it rather than a parse.
+//
+// Each feed has its own snapshot, so when one feed of a config changes, only that feed is parsed
+// again.
+//
+// If `used_snapshot` is not null, it is set to whether an existing snapshot was used.
+// `num_threads` is passed on to `readGTFSToWorldForDates` when the feed is parsed.
+//
+// Returns an error message if something went wrong, otherwise returns nullopt. Failing to write a
+// snapshot is not an error.
+std::optional<std::string> readGTFSToWorldCached(
+  const std::string& cache_dir,
+  const std::string& directory,
+  const std::string& id_prefix,
+  const std::vector<absl::CivilDay>& dates,
+  const std::unordered_set<std::string>* segment_stop_ids,
+  const WorldFilter& filter,
+  World& world,
+  bool* used_snapshot = nullptr,
+  unsigned int num_threads = 0
+);
@@ -0,0 +1,205 @@
+#include <filesystem>
+#include <fstream>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "WorldSnapshot.h"
+
+namespace {
+
+std::string PrettyWorld(const World& world) {
+  std::string result;
+  world.prettyRoutes(result);
+  for (WorldStopIndex stop = 0; stop < world.stops.size(); ++stop) {
+    if (world.stops.parent_stations[stop] == kNoWorldIndex) {
+      world.prettyDepartureTable(world.stops.ids.Get(stop), std::nullopt, result);
+    }
+  }
+  return result;
+}
+
+class WorldSnapshotTest : public testing::Test {
+protected:
+  void SetUp() override {
+    cache_dir = (std::filesystem::temp_directory_path() / "WorldSnapshotTest").string();
+    std::filesystem::remove_all(cache_dir);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(cache_dir);
+  }
+
+  std::string cache_dir;
+};
+
+}  // namespace
+
+TEST_F(WorldSnapshotTest, caltrainRoundTrip) {
+  std::unordered_set<std::string> segment_stop_ids = {
+    "caltrain-place_MLBR",
+    "caltrain-sj_diridon",
+    "caltrain-san_francisco",
+  };
+
+  World parsed;
+  ASSERT_EQ(
+    readGTFSToWorld("data/fetched-2024-06-08/caltrain", "caltrain-", absl::CivilDay(2024, 6, 7), &segment_stop_ids, parsed),
+    std::nullopt
+  );
+
+  bool used_snapshot = true;
+  World first;
+  ASSERT_EQ(
+    readGTFSToWorldCached(cache_dir, "data/fetched-2024-06-08/caltrain", "caltrain-", {absl::CivilDay(2024, 6, 7)}, &segment_stop_ids, {}, first, &used_snapshot),
+    std::nullopt
+  );
+  EXPECT_FALSE(used_snapshot);
+
+  World second;
+  ASSERT_EQ(
+    readGTFSToWorldCached(cache_dir, "data/fetched-2024-06-08/caltrain", "caltrain-", {absl::CivilDay(2024, 6, 7)}, &segment_stop_ids, {}, second, &used_snapshot),
+    std::nullopt
+  );
+  EXPECT_TRUE(used_snapshot);
+
+  // Snapshots hold the unsegmented world.
+  EXPECT_TRUE(second.segments.empty());
+  SegmentWorld(absl::CivilDay(2024, 6, 7), first);
+  SegmentWorld(absl::CivilDay(2024, 6, 7), second);
+
+  EXPECT_EQ(second.routes.size(), parsed.routes.size());
+  EXPECT_EQ(second.stops.size(), parsed.stops.size());
+  EXPECT_EQ(second.trips.size(), parsed.trips.size());
+  EXPECT_EQ(second.segments.size(), parsed.segments.size());
+  EXPECT_EQ(PrettyWorld(first), PrettyWorld(parsed));
+  EXPECT_EQ(PrettyWorld(second), PrettyWorld(parsed));
+  for (WorldTripIndex trip = 0; trip < parsed.trips.size(); ++trip) {
+    EXPECT_EQ(second.trips.ids.Get(trip), parsed.trips.ids.Get(trip));
+    EXPECT_EQ(second.trips.routes[trip], parsed.trips.routes[trip]);
+    EXPECT_EQ(
+      second.calendar.service_ids().Get(second.trips.services[trip]),
+      parsed.calendar.service_ids().Get(parsed.trips.services[trip])
+    );
+    EXPECT_EQ(second.trips.StopTimes(trip), parsed.trips.StopTimes(trip));
+  }
+}
+
+TEST_F(WorldSnapshotTest, keyedByDate) {
+  bool used_snapshot = true;
+  World weekday;
+  ASSERT_EQ(
+    readGTFSToWorldCached(cache_dir, "data/fetched-2024-06-08/caltrain", "caltrain-", {absl::CivilDay(2024, 6, 7)}, nullptr, {}, weekday, &used_snapshot),
+    std::nullopt
+  );
+  EXPECT_FALSE(used_snapshot);
+
+  World weekend;
+  ASSERT_EQ(
+    readGTFSToWorldCached(cache_dir, "data/fetched-2024-06-08/caltrain", "caltrain-", {absl::CivilDay(2024, 6, 16)}, nullptr, {}, weekend, &used_snapshot),
+    std::nullopt
+  );
+  EXPECT_FALSE(used_snapshot);
+  EXPECT_NE(weekday.trips.size(), weekend.trips.size());
+}
+
+TEST_F(WorldSnapshotTest, keyedByExactBoundingBox) {
+  // The boxes differ past the 6th significant digit.
+  WorldFilter wide;
+  wide.bounding_box = WorldFilter::BoundingBox{37.0, -122.5, 37.8, -121.8};
+  WorldFilter narrow;
+  narrow.bounding_box = WorldFilter::BoundingBox{37.0, -122.5, 37.8, -121.8000004};
+
+  bool used_snapshot = true;
+  World first;
+  ASSERT_EQ(
+    readGTFSToWorldCached(cache_dir, "data/fetched-2024-06-08/caltrain", "caltrain-", {absl::CivilDay(2024, 6, 7)}, nullptr, wide, first, &used_snapshot),
+    std::nullopt
+  );
+  EXPECT_FALSE(used_snapshot);
+
+  World second;
+  ASSERT_EQ(
+    readGTFSToWorldCached(cache_dir, "data/fetched-2024-06-08/caltrain", "caltrain-", {absl::CivilDay(2024, 6, 7)}, nullptr, narrow, second, &used_snapshot),
+    std::nullopt
+  );
+  EXPECT_FALSE(used_snapshot);
+
+  World third;
+  ASSERT_EQ(
+    readGTFSToWorldCached(cache_dir, "data/fetched-2024-06-08/caltrain", "caltrain-", {absl::CivilDay(2024, 6, 7)}, nullptr, wide, third, &used_snapshot),
+    std::nullopt
+  );
+  EXPECT_TRUE(used_snapshot);
+}
+
+TEST_F(WorldSnapshotTest, corruptSnapshotIsRebuilt) {
+  World first;
+  ASSERT_EQ(
+    readGTFSToWorldCached(cache_dir, "data/fetched-2024-06-08/caltrain", "caltrain-", {absl::CivilDay(2024, 6, 7)}, nullptr, {}, first),
+    std::nullopt
+  );
+
+  // Truncate every snapshot in the cache.
+  for (const auto& entry : std::filesystem::directory_iterator(cache_dir)) {
+    std::filesystem::resize_file(entry.path(), std::filesystem::file_size(entry.path()) / 2);
+  }
+
+  bool used_snapshot = true;
+  World second;
+  ASSERT_EQ(
+    readGTFSToWorldCached(cache_dir, "data/fetched-2024-06-08/caltrain", "caltrain-", {absl::CivilDay(2024, 6, 7)}, nullptr, {}, second, &used_snapshot),
+    std::nullopt
+  );
+  EXPECT_FALSE(used_snapshot);
+  EXPECT_EQ(second.trips.size(), first.trips.size());
+}
+
+TEST_F(WorldSnapshotTest, contentNotModificationTimeMakesStale) {
+  // A copy of the feed, which the test can touch and edit.
+  const std::string feed_dir = cache_dir + "/feed";
+  std::filesystem::create_directories(feed_dir);
+  std::filesystem::copy("data/fetched-2024-06-08/caltrain", feed_dir, std::filesystem::copy_options::recursive);
+  const std::string snapshot_dir = cache_dir + "/snapshots";
+  auto read = [&](bool& used_snapshot) {
+    World world;
+    EXPECT_EQ(
+      readGTFSToWorldCached(snapshot_dir, feed_dir, "caltrain-", {absl::CivilDay(2024, 6, 7)}, nullptr, {}, world, &used_snapshot),
+      std::nullopt
+    );
+    return world;
+  };
+  bool used_snapshot = true;
+  read(used_snapshot);
+  EXPECT_FALSE(used_snapshot);
+
+  // Same contents, new modification time.
+  const std::filesystem::path routes = std::filesystem::path(feed_dir) / "routes.txt";
+  std::filesystem::last_write_time(routes, std::filesystem::last_write_time(routes) + std::chrono::hours(1));
+  read(used_snapshot);
+  EXPECT_TRUE(used_snapshot);
+  read(used_snapshot);
+  EXPECT_TRUE(used_snapshot);
+
+  // Same size, different contents.
+  std::string contents;
+  {
+    std::ifstream in(routes, std::ios::binary);
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  const size_t name = contents.find("Local");
+  ASSERT_NE(name, std::string::npos);
+  contents.replace(name, 5, "LOCAL");
+  {
+    std::ofstream out(routes, std::ios::binary | std::ios::trunc);
+    out << contents;
+  }
+  std::filesystem::last_write_time(routes, std::filesystem::last_write_time(routes) + std::chrono::hours(2));
+  read(used_snapshot);
+  EXPECT_FALSE(used_snapshot);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
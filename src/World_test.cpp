@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <filesystem>
 #include <iterator>
 #include <fstream>
 #include <sstream>
@@ -9,6 +10,7 @@
 #include <gtest/gtest.h>
 #include <rapidcheck/gtest.h>
 
+#include "Problem.h"
 #include "World.h"
 
 TEST(
@@ -200,6 +202,629 @@ TEST(
   EXPECT_EQ(prettyDepartureTable, expected);
 }
 
+TEST(
+  WorldTest,
+  caltrainSeveralDatesSegmentLikeOneDate
+) {
+  std::unordered_set<std::string> segment_stop_ids = {
+    "caltrain-place_MLBR",
+    "caltrain-sj_diridon",
+    "caltrain-san_francisco",
+  };
+  const std::vector<absl::CivilDay> dates = {absl::CivilDay(2024, 6, 7), absl::CivilDay(2024, 6, 16)};
+
+  World both;
+  ASSERT_EQ(
+    readGTFSToWorldForDates("data/fetched-2024-06-08/caltrain", "caltrain-", dates, &segment_stop_ids, {}, both),
+    std::nullopt
+  );
+  for (const absl::CivilDay date : dates) {
+    World one;
+    ASSERT_EQ(
+      readGTFSToWorld("data/fetched-2024-06-08/caltrain", "caltrain-", date, &segment_stop_ids, one),
+      std::nullopt
+    );
+    EXPECT_LT(one.trips.size(), both.trips.size());
+
+    SegmentWorld(date, both);
+    EXPECT_EQ(both.segments.size(), one.segments.size()) << date;
+    std::string both_table, one_table;
+    both.prettyDepartureTable("caltrain-place_MLBR", std::nullopt, both_table);
+    one.prettyDepartureTable("caltrain-place_MLBR", std::nullopt, one_table);
+    EXPECT_EQ(both_table, one_table) << date;
+  }
+}
+
+TEST(
+  WorldTest,
+  stopTimesNotGroupedByTrip
+) {
+  // A copy of the caltrain feed where the first stop time of weekday trip 101 is moved to the end,
+  // and the first stop time of trip 103 into the middle of trip 101, so that neither trip's rows are
+  // all together. Trips 105, 107 and 109 are interleaved as
+  //   105 s1, 107 s1, 105 s2.., 107 s2, 109 s1.., 107 s3..
+  // so that 107 keeps being read while the rows of 105, which is already split, come in between.
+  const std::filesystem::path source = "data/fetched-2024-06-08/caltrain";
+  const std::filesystem::path ungrouped = std::filesystem::temp_directory_path() / "WorldTestUngrouped";
+  std::filesystem::remove_all(ungrouped);
+  std::filesystem::create_directories(ungrouped);
+  for (const auto& entry : std::filesystem::directory_iterator(source)) {
+    if (entry.path().filename() != "stop_times.txt") {
+      std::filesystem::copy_file(entry.path(), ungrouped / entry.path().filename());
+    }
+  }
+  {
+    std::ifstream in(source / "stop_times.txt");
+    std::vector<std::string> lines;
+    std::string header, moved, line, moved_103;
+    std::vector<std::string> interleaved_105, interleaved_107, interleaved_109;
+    std::getline(in, header);
+    while (std::getline(in, line)) {
+      if (line.starts_with("105,")) {
+        interleaved_105.push_back(line);
+      } else if (line.starts_with("107,")) {
+        interleaved_107.push_back(line);
+      } else if (line.starts_with("109,")) {
+        interleaved_109.push_back(line);
+      } else if (moved.empty() && line.starts_with("101,")) {
+        moved = line;
+      } else if (moved_103.empty() && line.starts_with("103,")) {
+        moved_103 = line;
+      } else {
+        lines.push_back(line);
+      }
+    }
+    ASSERT_FALSE(moved.empty());
+    ASSERT_FALSE(moved_103.empty());
+    const auto middle_of_101 = std::find_if(lines.begin(), lines.end(), [](const std::string& x) {
+      return x.starts_with("101,");
+    }) + 10;
+    lines.insert(middle_of_101, moved_103);
+    lines.push_back(moved);
+    ASSERT_GE(interleaved_105.size(), 2);
+    ASSERT_GE(interleaved_107.size(), 3);
+    lines.push_back(interleaved_105[0]);
+    lines.push_back(interleaved_107[0]);
+    lines.insert(lines.end(), interleaved_105.begin() + 1, interleaved_105.end());
+    lines.push_back(interleaved_107[1]);
+    lines.insert(lines.end(), interleaved_109.begin(), interleaved_109.end());
+    lines.insert(lines.end(), interleaved_107.begin() + 2, interleaved_107.end());
+    std::ofstream out(ungrouped / "stop_times.txt");
+    out << header << "\n";
+    for (const std::string& x : lines) {
+      out << x << "\n";
+    }
+  }
+
+  const absl::CivilDay date(2024, 6, 7);
+  World grouped_world;
+  ASSERT_EQ(readGTFSToWorld(source.string(), "caltrain-", date, nullptr, grouped_world), std::nullopt);
+  std::string grouped_table;
+  grouped_world.prettyDepartureTable("caltrain-place_MLBR", std::nullopt, grouped_table);
+  for (const unsigned int num_threads : {1u, 3u}) {
+    World ungrouped_world;
+    ASSERT_EQ(
+      readGTFSToWorldForDates(ungrouped.string(), "caltrain-", {date}, nullptr, {}, ungrouped_world, num_threads),
+      std::nullopt
+    );
+    SegmentWorld(date, ungrouped_world);
+    for (const char* trip_id : {"caltrain-101", "caltrain-103", "caltrain-105", "caltrain-107", "caltrain-109"}) {
+      EXPECT_EQ(
+        ungrouped_world.trips.StopTimes(*ungrouped_world.trips.ids.Find(trip_id)).size(),
+        grouped_world.trips.StopTimes(*grouped_world.trips.ids.Find(trip_id)).size()
+      ) << trip_id << " with " << num_threads << " threads";
+    }
+    std::string ungrouped_table;
+    ungrouped_world.prettyDepartureTable("caltrain-place_MLBR", std::nullopt, ungrouped_table);
+    EXPECT_EQ(ungrouped_table, grouped_table);
+    EXPECT_EQ(ungrouped_world.segments.size(), grouped_world.segments.size());
+    EXPECT_EQ(ungrouped_world.repeating_segments.size(), grouped_world.repeating_segments.size());
+  }
+  std::filesystem::remove_all(ungrouped);
+}
+
+TEST(
+  WorldTest,
+  readingOnOneThreadMatchesManyThreads
+) {
+  const absl::CivilDay date(2024, 6, 7);
+  std::vector<std::string> tables;
+  for (const unsigned int num_threads : {1u, 2u, 0u}) {
+    World world;
+    ASSERT_EQ(
+      readGTFSToWorldForDates("data/fetched-2024-06-08/caltrain", "caltrain-", {date}, nullptr, {}, world, num_threads),
+      std::nullopt
+    );
+    SegmentWorld(date, world, num_threads);
+    world.prettyDepartureTable("caltrain-place_MLBR", std::nullopt, tables.emplace_back());
+  }
+  EXPECT_EQ(tables[0], tables[1]);
+  EXPECT_EQ(tables[0], tables[2]);
+  EXPECT_FALSE(tables[0].empty());
+}
+
+TEST(
+  WorldTest,
+  frequenciesAndRegularTripsAreCompressed
+) {
+  World world;
+  ASSERT_EQ(
+    readGTFSToWorld("data/testdata/frequencies", "f-", absl::CivilDay(2024, 6, 7), nullptr, world),
+    std::nullopt
+  );
+  const WorldTripIndex shuttle = world.trips.ids.Find("f-shuttle").value();
+  EXPECT_THAT(world.trips.frequencies[shuttle], testing::ElementsAre(Range(6 * 3600, 6 * 3600 + 50 * 60, 600)));
+
+  std::vector<std::string> repeating;
+  for (const WorldRepeatingSegment& segment : world.repeating_segments) {
+    repeating.push_back(absl::StrCat(
+      world.stops.ids.Get(segment.origin_stop), "->", world.stops.ids.Get(segment.destination_stop), " ",
+      segment.departures.start, "-", segment.departures.finish, "/", segment.departures.interval, " ",
+      segment.duration.seconds
+    ));
+  }
+  EXPECT_THAT(
+    repeating,
+    testing::UnorderedElementsAre(
+      "f-A->f-B 21600-24600/600 300",
+      "f-B->f-C 21960-24960/600 360",
+      "f-A->f-C 28800-32400/1200 900"
+    )
+  );
+  // Only the irregular trip is left over.
+  ASSERT_EQ(world.segments.size(), 1);
+  EXPECT_EQ(world.trips.ids.Get(world.segments[0].trip), "f-local-5");
+
+  // Every run of the shuttle is a separate trip in the problem.
+  Problem problem = BuildProblem(world);
+  EXPECT_TRUE(problem.trip_id_to_index.contains("f-shuttle@21600"));
+  EXPECT_TRUE(problem.trip_id_to_index.contains("f-shuttle@24600"));
+  EXPECT_TRUE(problem.trip_id_to_index.contains("f-local-3"));
+  const size_t a = problem.stop_id_to_index.at("f-A");
+  const size_t c = problem.stop_id_to_index.at("f-C");
+  EXPECT_EQ(GetOrAddEdge(a, c, problem)->schedule.segments.size(), 5);
+}
+
+TEST(
+  WorldTest,
+  filterPrunesWhileReading
+) {
+  const absl::CivilDay date(2024, 6, 7);
+  auto read = [&date](const WorldFilter& filter, World& world) {
+    ASSERT_EQ(readGTFSToWorldForDates("data/testdata/frequencies", "f-", {date}, nullptr, filter, world), std::nullopt);
+    SegmentWorld(date, world);
+  };
+  auto segment_trips = [](const World& world) {
+    std::vector<std::string> trips;
+    ForEachSegment(world, [&](const WorldSegment& segment, const WorldTripRun&) {
+      trips.push_back(absl::StrCat(
+        world.trips.ids.Get(segment.trip), " ", world.stops.ids.Get(segment.origin_stop), "->",
+        world.stops.ids.Get(segment.destination_stop)
+      ));
+    });
+    std::sort(trips.begin(), trips.end());
+    trips.erase(std::unique(trips.begin(), trips.end()), trips.end());
+    return trips;
+  };
+
+  // The 9:00 local arrives after the window closes, so only its first stop is left. The shuttle
+  // runs on a frequency and is not filtered by time.
+  WorldFilter window;
+  window.earliest = WorldTime(8 * 3600 + 10 * 60);
+  window.latest = WorldTime(9 * 3600 + 10 * 60);
+  World windowed;
+  read(window, windowed);
+  EXPECT_THAT(
+    segment_trips(windowed),
+    testing::ElementsAre("f-local-2 f-A->f-C", "f-local-3 f-A->f-C", "f-shuttle f-A->f-B", "f-shuttle f-B->f-C")
+  );
+  EXPECT_THAT(windowed.trips.StopTimes(windowed.trips.ids.Find("f-local-4").value()), testing::SizeIs(1));
+
+  for (auto set_filter : {
+    +[](WorldFilter& filter) { filter.exclude_routes = {"f-shuttle"}; },
+    +[](WorldFilter& filter) { filter.include_routes = {"f-local"}; },
+    +[](WorldFilter& filter) { filter.include_agencies = {"f-transit"}; },
+    +[](WorldFilter& filter) { filter.exclude_agencies = {"f-shuttles"}; },
+  }) {
+    WorldFilter filter;
+    set_filter(filter);
+    World world;
+    read(filter, world);
+    EXPECT_FALSE(world.trips.ids.Find("f-shuttle").has_value());
+    EXPECT_FALSE(world.routes.ids.Find("f-shuttle").has_value());
+    EXPECT_EQ(world.trips.size(), 5);
+  }
+
+  // C is outside of the box, so the locals never get anywhere.
+  WorldFilter boxed;
+  boxed.bounding_box = WorldFilter::BoundingBox{37.39, -122.11, 37.415, -122.09};
+  World boxed_world;
+  read(boxed, boxed_world);
+  EXPECT_THAT(segment_trips(boxed_world), testing::ElementsAre("f-shuttle f-A->f-B"));
+}
+
+// Everything in the problem, independent of the order that stops and trips were added in.
+static std::vector<std::string> problemContents(const Problem& problem) {
+  std::vector<std::string> result;
+  for (size_t origin = 0; origin < problem.edges.size(); ++origin) {
+    for (const Edge& edge : problem.edges[origin]) {
+      const std::string prefix = absl::StrCat(
+        problem.stop_index_to_id[origin], "->", problem.stop_index_to_id[edge.destination_stop_index]
+      );
+      if (edge.schedule.anytime_duration.has_value()) {
+        result.push_back(absl::StrCat(prefix, " anytime ", edge.schedule.anytime_duration->seconds));
+      }
+      for (const Segment& segment : edge.schedule.segments) {
+        result.push_back(absl::StrCat(
+          prefix, " ", segment.departure_time.seconds, "-", segment.arrival_time.seconds, " ",
+          problem.trip_index_to_id[segment.departure_trip_index]
+        ));
+      }
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+TEST(
+  WorldTest,
+  streamedProblemMatchesSegmentedWorld
+) {
+  const absl::CivilDay date(2024, 6, 7);
+  std::vector<World> feeds(2);
+  ASSERT_EQ(readGTFSToWorldForDates("data/fetched-2024-06-08/caltrain", "caltrain-", {date}, nullptr, {}, feeds[0]), std::nullopt);
+  ASSERT_EQ(readGTFSToWorldForDates("data/testdata/frequencies", "f-", {date}, nullptr, {}, feeds[1]), std::nullopt);
+  World world;
+  MergeWorlds(std::move(feeds), world);
+  AddWalkingSegments(world);
+  ASSERT_TRUE(world.segments.empty());
+
+  const Problem streamed = BuildProblemForDate(world, date);
+  SegmentWorld(date, world);
+  const Problem segmented = BuildProblem(world);
+  EXPECT_EQ(problemContents(streamed), problemContents(segmented));
+  EXPECT_TRUE(streamed.trip_id_to_index.contains("f-shuttle@21600"));
+}
+
+TEST(
+  WorldTest,
+  realtimeTripUpdatesPatchWorldAndProblem
+) {
+  // Every segment in the world, independent of how they are compressed.
+  auto segment_contents = [](const World& world) {
+    std::vector<std::string> result;
+    ForEachSegment(world, [&](const WorldSegment& segment, const WorldTripRun&) {
+      result.push_back(absl::StrCat(
+        world.trips.ids.Get(segment.trip), " ", world.stops.ids.Get(segment.origin_stop), "->",
+        world.stops.ids.Get(segment.destination_stop), " ", segment.departure_time.seconds, "+",
+        segment.duration.seconds
+      ));
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+
+  const absl::CivilDay date(2024, 6, 7);
+  const absl::TimeZone pacific = absl::FixedTimeZone(-7 * 3600);
+  const int64_t midnight = absl::ToUnixSeconds(absl::FromCivil(absl::CivilSecond(2024, 6, 7, 0, 0, 0), pacific));
+  World world;
+  ASSERT_EQ(readGTFSToWorld("data/fetched-2024-06-08/caltrain", "caltrain-", date, nullptr, world), std::nullopt);
+  Problem problem = BuildProblem(world);
+
+  std::vector<RealtimeTripUpdate> updates(3);
+  // 101 is two minutes late from San Jose on.
+  updates[0].trip_id = "101";
+  updates[0].stop_time_updates.push_back({.stop_id = "70261", .arrival = {.delay = 120}});
+  updates[1].trip_id = "103";
+  updates[1].schedule_relationship = RealtimeTripUpdate::Relationship::kCanceled;
+  updates[2].trip_id = "extra";
+  updates[2].route_id = "L1";
+  updates[2].schedule_relationship = RealtimeTripUpdate::Relationship::kAdded;
+  updates[2].stop_time_updates.push_back({.stop_id = "70261", .departure = {.time = midnight + 5 * 3600}});
+  updates[2].stop_time_updates.push_back({.stop_id = "70011", .arrival = {.time = midnight + 6 * 3600}});
+
+  std::vector<WorldTripChange> changes;
+  ApplyTripUpdates(updates, "caltrain-", date, pacific, world, changes);
+  ASSERT_EQ(changes.size(), 3);
+  const WorldTripIndex late = world.trips.ids.Find("caltrain-101").value();
+  EXPECT_EQ(world.trips.StopTimes(late)[0].departure_time, WorldTime(4 * 3600 + 20 * 60));
+  EXPECT_EQ(world.trips.StopTimes(late)[1].arrival_time, WorldTime(4 * 3600 + 28 * 60));
+  EXPECT_EQ(world.trips.StopTimes(late)[2].arrival_time, WorldTime(4 * 3600 + 34 * 60));
+  EXPECT_TRUE(world.trips.StopTimes(world.trips.ids.Find("caltrain-103").value()).empty());
+  const WorldTripIndex extra = world.trips.ids.Find("caltrain-extra").value();
+  EXPECT_THAT(world.trips.StopTimes(extra), testing::SizeIs(2));
+  EXPECT_EQ(world.trips.StopTimes(extra)[0].stop, world.stops.ids.Find("caltrain-sj_diridon").value());
+
+  // The patched world and problem have what they would have had if they were built with the
+  // updated trips.
+  ApplyTripChanges(world, changes, problem);
+  EXPECT_EQ(problemContents(problem), problemContents(BuildProblem(world)));
+  const std::vector<std::string> patched = segment_contents(world);
+  SegmentWorld(date, world);
+  EXPECT_EQ(patched, segment_contents(world));
+
+  // Delays are relative to the schedule, so applying the same feed again changes nothing.
+  changes.clear();
+  ApplyTripUpdates(updates, "caltrain-", date, pacific, world, changes);
+  EXPECT_EQ(world.trips.StopTimes(late)[1].arrival_time, WorldTime(4 * 3600 + 28 * 60));
+  EXPECT_EQ(segment_contents(world), patched);
+}
+
+TEST(
+  WorldTest,
+  realtimeCancellationsDropEmptyEdges
+) {
+  const absl::CivilDay date(2024, 6, 7);
+  World world;
+  ASSERT_EQ(readGTFSToWorld("data/testdata/frequencies", "f-", date, nullptr, world), std::nullopt);
+  Problem problem = BuildProblem(world);
+  const size_t a = problem.stop_id_to_index.at("f-A");
+  const size_t c = problem.stop_id_to_index.at("f-C");
+  ASSERT_THAT(problem.adjacency_list.edges[a], testing::Contains(c));
+
+  // The locals are the only trips from A straight to C.
+  std::vector<RealtimeTripUpdate> updates;
+  for (const char* trip_id : {"local-1", "local-2", "local-3", "local-4", "local-5"}) {
+    updates.push_back({.trip_id = trip_id, .schedule_relationship = RealtimeTripUpdate::Relationship::kCanceled});
+  }
+  const size_t num_stops = problem.edges.size();
+  for (int i = 0; i < 2; ++i) {
+    // The second time, the trips have no segments left to remove, and nothing changes.
+    std::vector<WorldTripChange> changes;
+    ApplyTripUpdates(updates, "f-", date, absl::UTCTimeZone(), world, changes);
+    ApplyTripChanges(world, changes, problem);
+    for (const Edge& edge : problem.edges[a]) {
+      EXPECT_NE(edge.destination_stop_index, c);
+    }
+    EXPECT_THAT(problem.adjacency_list.edges[a], testing::Not(testing::Contains(c)));
+    EXPECT_EQ(problem.edges.size(), num_stops);
+    EXPECT_EQ(problemContents(problem), problemContents(BuildProblem(world)));
+  }
+}
+
+TEST(
+  WorldTest,
+  realtimeTripsWrapIntoPeriodicProblems
+) {
+  const absl::CivilDay date(2024, 6, 7);
+  const int64_t midnight = absl::ToUnixSeconds(absl::FromCivil(absl::CivilSecond(2024, 6, 7, 0, 0, 0), absl::UTCTimeZone()));
+  World world;
+  ASSERT_EQ(readGTFSToWorld("data/testdata/frequencies", "f-", date, nullptr, world), std::nullopt);
+  Problem problem = BuildProblem(world);
+  MakePeriodic(problem);
+
+  // An extra local after midnight, at 24:30, and one at 08:00 that arrives before local-1 does.
+  std::vector<RealtimeTripUpdate> updates(2);
+  updates[0].trip_id = "late";
+  updates[0].route_id = "local";
+  updates[0].schedule_relationship = RealtimeTripUpdate::Relationship::kAdded;
+  updates[0].stop_time_updates.push_back({.stop_id = "A", .departure = {.time = midnight + 24 * 3600 + 30 * 60}});
+  updates[0].stop_time_updates.push_back({.stop_id = "C", .arrival = {.time = midnight + 24 * 3600 + 45 * 60}});
+  updates[1].trip_id = "express";
+  updates[1].route_id = "local";
+  updates[1].schedule_relationship = RealtimeTripUpdate::Relationship::kAdded;
+  updates[1].stop_time_updates.push_back({.stop_id = "A", .departure = {.time = midnight + 8 * 3600}});
+  updates[1].stop_time_updates.push_back({.stop_id = "C", .arrival = {.time = midnight + 8 * 3600 + 10 * 60}});
+  std::vector<WorldTripChange> changes;
+  ApplyTripUpdates(updates, "f-", date, absl::UTCTimeZone(), world, changes);
+  ASSERT_EQ(changes.size(), 2);
+  ApplyTripChanges(world, changes, problem);
+
+  const Edge* edge = GetOrAddEdge(problem.stop_id_to_index.at("f-A"), problem.stop_id_to_index.at("f-C"), problem);
+  const std::vector<Segment>& segments = edge->schedule.segments;
+  EXPECT_TRUE(std::is_sorted(segments.begin(), segments.end(), SegmentComp));
+  for (const Segment& segment : segments) {
+    EXPECT_LT(segment.departure_time.seconds, kSchedulePeriodSeconds);
+  }
+  const uint32_t late = problem.trip_id_to_index.at("f-late");
+  EXPECT_TRUE(std::any_of(segments.begin(), segments.end(), [late](const Segment& segment) {
+    return segment.departure_trip_index == late && segment.departure_time.seconds == 30 * 60 &&
+      segment.arrival_time.seconds == 45 * 60;
+  }));
+  // The express ties with local-1's departure, and goes after it because it arrives first.
+  ASSERT_GE(segments.size(), 3);
+  EXPECT_EQ(segments[2].departure_time.seconds, 8 * 3600);
+  EXPECT_EQ(segments[1].departure_trip_index, problem.trip_id_to_index.at("f-local-1"));
+  EXPECT_EQ(segments[2].departure_trip_index, problem.trip_id_to_index.at("f-express"));
+}
+
+TEST(
+  WorldTest,
+  departureIndexWindow
+) {
+  World world;
+  ASSERT_EQ(
+    readGTFSToWorld("data/testdata/frequencies", "f-", absl::CivilDay(2024, 6, 7), nullptr, world),
+    std::nullopt
+  );
+  const WorldStopIndex a = world.stops.ids.Find("f-A").value();
+  const WorldStopIndex c = world.stops.ids.Find("f-C").value();
+
+  // 6 shuttle runs and 5 locals.
+  const std::vector<WorldSegment> at_a = world.departures.At(world, a);
+  EXPECT_EQ(at_a.size(), 11);
+  EXPECT_TRUE(std::is_sorted(at_a.begin(), at_a.end(), WorldSegmentComp));
+  EXPECT_TRUE(world.departures.At(world, c).empty());
+  // The shuttle stays one repeating segment in the index.
+  EXPECT_EQ(world.departures.segments.size(), world.segments.size());
+  EXPECT_EQ(world.departures.repeating_segments.size(), world.repeating_segments.size());
+
+  std::vector<unsigned int> window;
+  for (const WorldSegment& segment : world.departures.Between(world, a, WorldTime(6 * 3600), WorldTime(6 * 3600 + 20 * 60))) {
+    window.push_back(segment.departure_time.seconds);
+  }
+  EXPECT_THAT(window, testing::ElementsAre(21600, 22200, 22800));
+  // A window starting between two shuttle runs.
+  window.clear();
+  for (const WorldSegment& segment : world.departures.Between(world, a, WorldTime(6 * 3600 + 1), WorldTime(6 * 3600 + 20 * 60))) {
+    window.push_back(segment.departure_time.seconds);
+  }
+  EXPECT_THAT(window, testing::ElementsAre(22200, 22800));
+  EXPECT_TRUE(world.departures.Between(world, a, WorldTime(7 * 3600), WorldTime(7 * 3600 + 59 * 60)).empty());
+  EXPECT_EQ(world.departures.Between(world, a, WorldTime(9 * 3600), WorldTime(24 * 3600)).size(), 2);
+
+  // Every window matches filtering all the departures.
+  for (unsigned int from = 5 * 3600; from < 11 * 3600; from += 7 * 60) {
+    const WorldTime to(from + 45 * 60);
+    std::vector<WorldSegment> expected;
+    std::copy_if(at_a.begin(), at_a.end(), std::back_inserter(expected), [from, to](const WorldSegment& segment) {
+      return segment.departure_time.seconds >= from && segment.departure_time.seconds <= to.seconds;
+    });
+    const std::vector<WorldSegment> between = world.departures.Between(world, a, WorldTime(from), to);
+    ASSERT_EQ(between.size(), expected.size()) << from;
+    for (size_t i = 0; i < between.size(); ++i) {
+      EXPECT_EQ(between[i].departure_time.seconds, expected[i].departure_time.seconds);
+      EXPECT_EQ(between[i].trip, expected[i].trip);
+    }
+  }
+}
+
+TEST(
+  WorldTest,
+  walkingSegmentsWithinRadius
+) {
+  World world;
+  ASSERT_EQ(
+    readGTFSToWorld("data/testdata/frequencies", "f-", absl::CivilDay(2024, 6, 7), nullptr, world),
+    std::nullopt
+  );
+  // The stops are in a line, about 1113m apart.
+  AddWalkingSegments(world, {.max_meters = 1200, .meters_per_second = 2});
+  std::vector<std::string> connections;
+  for (const WorldAnytimeConnection& connection : world.anytime_connections) {
+    connections.push_back(absl::StrCat(
+      world.stops.ids.Get(connection.origin_stop), "->", world.stops.ids.Get(connection.destination_stop), " ",
+      connection.duration.seconds
+    ));
+  }
+  EXPECT_THAT(
+    connections,
+    testing::UnorderedElementsAre("f-A->f-B 556", "f-B->f-A 556", "f-B->f-C 556", "f-C->f-B 556")
+  );
+}
+
+TEST(
+  WorldTest,
+  unifyStationsAcrossFeeds
+) {
+  auto read_world = [](World& world) {
+    const absl::CivilDay date(2024, 6, 7);
+    std::vector<World> feeds(2);
+    ASSERT_EQ(readGTFSToWorldForDates("data/fetched-2024-06-08/caltrain", "caltrain-", {date}, nullptr, {}, feeds[0]), std::nullopt);
+    ASSERT_EQ(readGTFSToWorldForDates("data/testdata/light_rail", "lr-", {date}, nullptr, {}, feeds[1]), std::nullopt);
+    MergeWorlds(std::move(feeds), world);
+    SegmentWorld(date, world);
+    AddWalkingSegments(world);
+  };
+  auto light_rail_segments = [](const World& world) {
+    std::vector<std::string> result;
+    ForEachSegment(world, [&](const WorldSegment& segment, const WorldTripRun&) {
+      if (world.trips.ids.Get(segment.trip).starts_with("lr-")) {
+        result.push_back(absl::StrCat(
+          world.stops.ids.Get(segment.origin_stop), "->", world.stops.ids.Get(segment.destination_stop), " ",
+          segment.departure_time.seconds, "+", segment.duration.seconds
+        ));
+      }
+    });
+    return result;
+  };
+  const std::vector<std::string> prefixes = {"caltrain-", "lr-"};
+
+  {
+    // "Mountain View Station" is about 30m from Caltrain's "Mountain View". Evelyn is about 110m
+    // away, but is some other station, and so are the temporary Caltrain stops, which are in the
+    // same feed anyway.
+    World world;
+    read_world(world);
+    std::unordered_map<std::string, std::string> unified;
+    ASSERT_EQ(UnifyStations(prefixes, {}, world, unified), std::nullopt);
+    EXPECT_THAT(unified, testing::UnorderedElementsAre(testing::Pair("lr-mv", "caltrain-mountain_view")));
+    EXPECT_EQ(*world.stops.ids.Find("caltrain-mountain_view"), world.stops.parent_stations[*world.stops.ids.Find("lr-mv")]);
+    EXPECT_THAT(
+      light_rail_segments(world),
+      testing::UnorderedElementsAre(
+        "lr-downtown->lr-evelyn 28800+1200",
+        "lr-evelyn->caltrain-mountain_view 30060+180",
+        "caltrain-mountain_view->lr-evelyn 32400+180",
+        "lr-evelyn->lr-downtown 32640+1200"
+      )
+    );
+    // Walking to and from the unified station is now walking to and from Caltrain's.
+    for (const WorldAnytimeConnection& connection : world.anytime_connections) {
+      EXPECT_NE(world.stops.ids.Get(connection.origin_stop), "lr-mv");
+      EXPECT_NE(world.stops.ids.Get(connection.destination_stop), "lr-mv");
+      EXPECT_NE(connection.origin_stop, connection.destination_stop);
+    }
+    EXPECT_EQ(world.departures.At(world, *world.stops.ids.Find("lr-mv")).size(), 0);
+  }
+
+  {
+    // Merge rules unify stations regardless of distance and name, and trips dwell where two of
+    // their stops become one.
+    World world;
+    read_world(world);
+    std::unordered_map<std::string, std::string> unified;
+    StationUnificationOptions options;
+    options.merge = {{"caltrain-mountain_view", "lr-evelyn"}};
+    ASSERT_EQ(UnifyStations(prefixes, options, world, unified), std::nullopt);
+    EXPECT_THAT(
+      unified,
+      testing::UnorderedElementsAre(
+        testing::Pair("lr-mv", "caltrain-mountain_view"), testing::Pair("lr-evelyn", "caltrain-mountain_view")
+      )
+    );
+    EXPECT_THAT(
+      light_rail_segments(world),
+      testing::UnorderedElementsAre(
+        "lr-downtown->caltrain-mountain_view 28800+1200", "caltrain-mountain_view->lr-downtown 32640+1200"
+      )
+    );
+    SegmentWorld(absl::CivilDay(2024, 6, 7), world);
+    EXPECT_THAT(
+      light_rail_segments(world),
+      testing::UnorderedElementsAre(
+        "lr-downtown->caltrain-mountain_view 28800+1200", "caltrain-mountain_view->lr-downtown 32640+1200"
+      )
+    );
+  }
+
+  {
+    World world;
+    read_world(world);
+    std::unordered_map<std::string, std::string> unified;
+    StationUnificationOptions options;
+    options.separate = {{"lr-mv", "caltrain-mountain_view"}};
+    ASSERT_EQ(UnifyStations(prefixes, options, world, unified), std::nullopt);
+    EXPECT_TRUE(unified.empty());
+
+    options.merge = {{"lr-nowhere", "lr-mv"}};
+    EXPECT_NE(UnifyStations(prefixes, options, world, unified), std::nullopt);
+  }
+}
+
+TEST(
+  WorldTest,
+  tripsShareStopPatterns
+) {
+  World world;
+  ASSERT_EQ(readGTFSToWorld("data/fetched-2024-06-08/caltrain", "caltrain-", absl::CivilDay(2024, 6, 7), nullptr, world), std::nullopt);
+
+  // Locals, limiteds and express trains each make the same few stop sequences all day.
+  EXPECT_GT(world.trips.num_patterns(), 0);
+  EXPECT_LT(world.trips.num_patterns() * 2, world.trips.size());
+  for (WorldTripIndex trip = 0; trip < world.trips.size(); ++trip) {
+    const WorldTripStopTimesView stop_times = world.trips.StopTimes(trip);
+    if (stop_times.empty()) {
+      continue;
+    }
+    const std::span<const WorldStopIndex> pattern = world.trips.PatternStops(world.trips.patterns[trip]);
+    ASSERT_EQ(stop_times.size(), pattern.size());
+    for (size_t i = 0; i < pattern.size(); ++i) {
+      EXPECT_EQ(stop_times[i].stop, pattern[i]);
+    }
+  }
+}
+
 TEST(
   WorldTest,
   bartSFIADuplicateStopTimeDropped
@@ -214,57 +839,94 @@ TEST(
   );
   ASSERT_EQ(err_opt, std::nullopt);
 
+  const WorldTripIndex bart_1508826 = world.trips.ids.Find("bart-1508826").value();
+  const WorldTripIndex bart_1508916 = world.trips.ids.Find("bart-1508916").value();
   EXPECT_EQ(
-    world.trips["bart-1508826"].stop_times[0],
+    world.trips.StopTimes(bart_1508826)[0],
     (WorldTripStopTimes{
-      .stop_id = "bart-place_MLBR",
+      .stop = world.stops.ids.Find("bart-place_MLBR").value(),
       .arrival_time = WorldTime(6 * 3600 + 13 * 60),
       .departure_time = WorldTime(6 * 3600 + 13 * 60)
     })
   );
   EXPECT_EQ(
-    world.trips["bart-1508826"].stop_times[1],
+    world.trips.StopTimes(bart_1508826)[1],
     (WorldTripStopTimes{
-      .stop_id = "bart-place_SFIA",
+      .stop = world.stops.ids.Find("bart-place_SFIA").value(),
       .arrival_time = WorldTime(6 * 3600 + 17 * 60),
       .departure_time = WorldTime(6 * 3600 + 19 * 60)
     })
   );
   EXPECT_EQ(
-    world.trips["bart-1508826"].stop_times[2],
+    world.trips.StopTimes(bart_1508826)[2],
     (WorldTripStopTimes{
-      .stop_id = "bart-place_SBRN",
+      .stop = world.stops.ids.Find("bart-place_SBRN").value(),
       .arrival_time = WorldTime(6 * 3600 + 23 * 60),
       .departure_time = WorldTime(6 * 3600 + 23 * 60)
     })
   );
 
   EXPECT_EQ(
-    world.trips["bart-1508916"].stop_times[21],
+    world.trips.StopTimes(bart_1508916)[21],
     (WorldTripStopTimes{
-      .stop_id = "bart-place_SBRN",
+      .stop = world.stops.ids.Find("bart-place_SBRN").value(),
       .arrival_time = WorldTime(6 * 3600 + 38 * 60),
       .departure_time = WorldTime(6 * 3600 + 39 * 60)
     })
   );
   EXPECT_EQ(
-    world.trips["bart-1508916"].stop_times[22],
+    world.trips.StopTimes(bart_1508916)[22],
     (WorldTripStopTimes{
-      .stop_id = "bart-place_SFIA",
+      .stop = world.stops.ids.Find("bart-place_SFIA").value(),
       .arrival_time = WorldTime(6 * 3600 + 43 * 60),
       .departure_time = WorldTime(6 * 3600 + 46 * 60)
     })
   );
   EXPECT_EQ(
-    world.trips["bart-1508916"].stop_times[23],
+    world.trips.StopTimes(bart_1508916)[23],
     (WorldTripStopTimes{
-      .stop_id = "bart-place_MLBR",
+      .stop = world.stops.ids.Find("bart-place_MLBR").value(),
       .arrival_time = WorldTime(6 * 3600 + 50 * 60),
       .departure_time = WorldTime(6 * 3600 + 50 * 60)
     })
   );
 }
 
+TEST(
+  WorldTest,
+  mergeWorldsKeepsSegmentsSorted
+) {
+  std::vector<World> feeds(2);
+  ASSERT_EQ(
+    readGTFSToWorld("data/fetched-2024-06-08/caltrain", "a-", absl::CivilDay(2024, 6, 7), nullptr, feeds[0]),
+    std::nullopt
+  );
+  ASSERT_EQ(
+    readGTFSToWorld("data/fetched-2024-06-08/caltrain", "b-", absl::CivilDay(2024, 6, 16), nullptr, feeds[1]),
+    std::nullopt
+  );
+  const size_t num_stops = feeds[0].stops.size() + feeds[1].stops.size();
+  const size_t num_segments = feeds[0].segments.size() + feeds[1].segments.size();
+
+  World world;
+  MergeWorlds(std::move(feeds), world);
+  EXPECT_EQ(world.stops.size(), num_stops);
+  ASSERT_EQ(world.segments.size(), num_segments);
+  EXPECT_TRUE(std::is_sorted(world.segments.begin(), world.segments.end(), WorldSegmentComp));
+
+  // Ties are broken by feed order.
+  for (size_t i = 1; i < world.segments.size(); ++i) {
+    const WorldSegment& prev = world.segments[i - 1];
+    const WorldSegment& cur = world.segments[i];
+    const std::string& prev_trip_id = world.trips.ids.Get(prev.trip);
+    const std::string& cur_trip_id = world.trips.ids.Get(cur.trip);
+    if (!WorldSegmentComp(prev, cur) && prev_trip_id[0] != cur_trip_id[0]) {
+      EXPECT_EQ(prev_trip_id[0], 'a');
+      EXPECT_EQ(cur_trip_id[0], 'b');
+    }
+  }
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,216 @@
+#include "ZipArchive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <zlib.h>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+
+namespace {
+
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr uint32_t kCentralHeaderSignature = 0x02014b50;
+constexpr uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+
+constexpr size_t kLocalHeaderSize = 30;
+constexpr size_t kCentralHeaderSize = 46;
+constexpr size_t kEndOfCentralDirectorySize = 22;
+
+// Stands in for a size or offset that is in the zip64 extra field instead.
+constexpr uint32_t kZip64Sentinel = std::numeric_limits<uint32_t>::max();
+constexpr uint16_t kZip64ExtraId = 0x0001;
+
+constexpr uint16_t kMethodStored = 0;
+constexpr uint16_t kMethodDeflated = 8;
+
+// Zip archives are little-endian.
+uint16_t getU16(const char* p) {
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+  return u[0] | (u[1] << 8);
+}
+
+uint32_t getU32(const char* p) {
+  return getU16(p) | (static_cast<uint32_t>(getU16(p + 2)) << 16);
+}
+
+uint64_t getU64(const char* p) {
+  return getU32(p) | (static_cast<uint64_t>(getU32(p + 4)) << 32);
+}
+
+}  // namespace
+
+std::optional<std::string> ZipArchive::Open(const std::string& path) {
+  members_.clear();
+  auto err = file_.Open(path);
+  if (err.has_value()) {
+    return err;
+  }
+  const char* begin = file_.data();
+  const size_t size = file_.size();
+
+  // The end of central directory record is at the very end, before a comment of up to 64KiB.
+  if (size < kEndOfCentralDirectorySize) {
+    return absl::StrCat(path, " is not a zip archive");
+  }
+  const char* eocd = nullptr;
+  const size_t earliest = size > kEndOfCentralDirectorySize + 0xFFFF ? size - kEndOfCentralDirectorySize - 0xFFFF : 0;
+  for (size_t i = size - kEndOfCentralDirectorySize + 1; i-- > earliest;) {
+    if (getU32(begin + i) == kEndOfCentralDirectorySignature) {
+      eocd = begin + i;
+      break;
+    }
+  }
+  if (eocd == nullptr) {
+    return absl::StrCat(path, " is not a zip archive");
+  }
+  const uint16_t num_members = getU16(eocd + 10);
+  const uint32_t directory_size = getU32(eocd + 12);
+  const uint32_t directory_offset = getU32(eocd + 16);
+  if (directory_offset == kZip64Sentinel || directory_size == kZip64Sentinel) {
+    return absl::StrCat(path, " has a zip64 central directory, which is not supported");
+  }
+  if (static_cast<uint64_t>(directory_offset) + directory_size > size) {
+    return absl::StrCat(path, " has a truncated central directory");
+  }
+
+  const char* p = begin + directory_offset;
+  const char* directory_end = p + directory_size;
+  for (uint16_t i = 0; i < num_members; ++i) {
+    if (directory_end - p < static_cast<ptrdiff_t>(kCentralHeaderSize) || getU32(p) != kCentralHeaderSignature) {
+      return absl::StrCat(path, " has a corrupt central directory");
+    }
+    const uint16_t method = getU16(p + 10);
+    uint64_t compressed_size = getU32(p + 20);
+    uint64_t uncompressed_size = getU32(p + 24);
+    const uint16_t name_size = getU16(p + 28);
+    const uint16_t extra_size = getU16(p + 30);
+    const uint16_t comment_size = getU16(p + 32);
+    uint64_t local_header_offset = getU32(p + 42);
+    if (directory_end - p < static_cast<ptrdiff_t>(kCentralHeaderSize + name_size + extra_size + comment_size)) {
+      return absl::StrCat(path, " has a corrupt central directory");
+    }
+    const std::string name(p + kCentralHeaderSize, name_size);
+
+    // The zip64 extra field has the 64-bit versions of just the fields that are set to the sentinel,
+    // in this order.
+    const char* extra = p + kCentralHeaderSize + name_size;
+    const char* extra_end = extra + extra_size;
+    while (extra_end - extra >= 4) {
+      const uint16_t id = getU16(extra);
+      const uint16_t field_size = getU16(extra + 2);
+      const char* field = extra + 4;
+      const char* field_end = std::min(field + field_size, extra_end);
+      if (id == kZip64ExtraId) {
+        for (uint64_t* value : {&uncompressed_size, &compressed_size, &local_header_offset}) {
+          if (*value == kZip64Sentinel && field_end - field >= 8) {
+            *value = getU64(field);
+            field += 8;
+          }
+        }
+      }
+      extra = field_end;
+    }
+    p += kCentralHeaderSize + name_size + extra_size + comment_size;
+
+    if (name.empty() || name.back() == '/') {
+      // A directory.
+      continue;
+    }
+    if (method != kMethodStored && method != kMethodDeflated) {
+      return absl::StrCat(path, ": ", name, " uses unsupported compression method ", method);
+    }
+
+    // The data follows the local header, whose name and extra field can differ from the central
+    // directory's.
+    if (local_header_offset > size || size - local_header_offset < kLocalHeaderSize ||
+        getU32(begin + local_header_offset) != kLocalHeaderSignature) {
+      return absl::StrCat(path, ": ", name, " has a corrupt local header");
+    }
+    const char* local = begin + local_header_offset;
+    const uint64_t data_offset = local_header_offset + kLocalHeaderSize + getU16(local + 26) + getU16(local + 28);
+    if (data_offset > size || size - data_offset < compressed_size) {
+      return absl::StrCat(path, ": ", name, " is truncated");
+    }
+    members_.push_back(Member{
+      .name = name,
+      .deflated = method == kMethodDeflated,
+      .uncompressed_size = uncompressed_size,
+      .data = absl::string_view(begin + data_offset, compressed_size),
+    });
+  }
+  return std::nullopt;
+}
+
+const ZipArchive::Member* ZipArchive::Find(absl::string_view name) const {
+  const Member* nested = nullptr;
+  for (const Member& member : members_) {
+    if (member.name == name) {
+      return &member;
+    }
+    const absl::string_view member_name = member.name;
+    if (nested == nullptr && member_name.size() > name.size() &&
+        absl::EndsWith(member_name, name) && member_name[member_name.size() - name.size() - 1] == '/') {
+      nested = &member;
+    }
+  }
+  return nested;
+}
+
+struct ZipInflater::State {
+  z_stream stream;
+  // Input not yet handed to `stream`. avail_in is only 32 bits, so a huge member is fed in a piece
+  // at a time.
+  uint64_t remaining_in;
+  bool done = false;
+  // Set if zlib could not be set up.
+  std::optional<std::string> init_error;
+};
+
+ZipInflater::ZipInflater(absl::string_view deflated) : state_(std::make_unique<State>()) {
+  z_stream& stream = state_->stream;
+  std::memset(&stream, 0, sizeof(stream));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(deflated.data()));
+  stream.avail_in = 0;
+  // Zip members are raw deflate streams, without a zlib header.
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+    state_->done = true;
+    state_->init_error = "Could not start inflating zip member";
+  }
+  state_->remaining_in = deflated.size();
+}
+
+ZipInflater::~ZipInflater() {
+  inflateEnd(&state_->stream);
+}
+
+std::optional<std::string> ZipInflater::Read(char* out, size_t size, size_t& written) {
+  written = 0;
+  if (state_->init_error.has_value()) {
+    return state_->init_error;
+  }
+  z_stream& stream = state_->stream;
+  while (!state_->done && written < size) {
+    if (stream.avail_in == 0 && state_->remaining_in > 0) {
+      stream.avail_in = static_cast<uInt>(std::min<uint64_t>(state_->remaining_in, std::numeric_limits<uInt>::max()));
+      state_->remaining_in -= stream.avail_in;
+    }
+    stream.next_out = reinterpret_cast<Bytef*>(out + written);
+    stream.avail_out = static_cast<uInt>(std::min<size_t>(size - written, std::numeric_limits<uInt>::max()));
+    const uInt avail_out = stream.avail_out;
+    const int ret = inflate(&stream, Z_NO_FLUSH);
+    written += avail_out - stream.avail_out;
+    if (ret == Z_STREAM_END) {
+      state_->done = true;
+    } else if (ret == Z_BUF_ERROR && stream.avail_in == 0 && state_->remaining_in == 0) {
+      state_->done = true;
+      return "Zip member is truncated";
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      state_->done = true;
+      return absl::StrCat("Zip member is corrupt: ", stream.msg != nullptr ? stream.msg : "inflate failed");
+    }
+  }
+  return std::nullopt;
+}
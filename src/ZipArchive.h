@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+#include "MappedFile.h"
+
+// A read-only view of a zip archive, with the archive memory-mapped. Members are never extracted:
+// stored members are views into the mapping, and deflated ones are inflated a piece at a time with
+// `ZipInflater`.
+//
+// Supports what GTFS archives use: stored and deflated members, including zip64 member sizes.
+// Archives split over several disks are not supported.
+class ZipArchive {
+public:
+  struct Member {
+    // Path within the archive, e.g. "stop_times.txt" or "feed/stop_times.txt".
+    std::string name;
+    // Whether the data is deflated; otherwise it is stored as is.
+    bool deflated;
+    uint64_t uncompressed_size;
+    // The member's data as it is in the archive.
+    absl::string_view data;
+  };
+
+  // Maps the archive at `path` and reads its central directory.
+  //
+  // Returns an error message if something went wrong, otherwise returns nullopt.
+  std::optional<std::string> Open(const std::string& path);
+
+  // Returns the member named `name`, or a member named `name` in a directory if there is no such
+  // member at the top level, because some feeds are zipped up with their directory. Returns nullptr
+  // if there is neither.
+  const Member* Find(absl::string_view name) const;
+
+private:
+  MappedFile file_;
+  std::vector<Member> members_;
+};
+
+// Inflates a deflated zip member a piece at a time, so that all of it never has to be in memory at
+// once.
+class ZipInflater {
+public:
+  explicit ZipInflater(absl::string_view deflated);
+  ~ZipInflater();
+
+  ZipInflater(const ZipInflater&) = delete;
+  ZipInflater& operator=(const ZipInflater&) = delete;
+
+  // Inflates up to `size` bytes into `out`, and sets `written` to how many there were. Only writes
+  // fewer than `size` bytes at the end of the member, and writes none after that.
+  //
+  // Returns an error message if the data is corrupt, otherwise returns nullopt.
+  std::optional<std::string> Read(char* out, size_t size, size_t& written);
+
+private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
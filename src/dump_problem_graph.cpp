@@ -14,9 +14,15 @@
 #include "cereal/archives/json.hpp"
 
 #include <toml++/toml.h>
+#include <absl/flags/flag.h>
 #include <absl/flags/parse.h>
 #include <nlohmann/json.hpp>
 
+ABSL_FLAG(
+  bool, periodic, false,
+  "Treat the schedule as repeating every day, so that trips after midnight connect with the morning's"
+);
+
 int main(int argc, char* argv[]) {
   std::vector<char*> positional = absl::ParseCommandLine(argc, argv);
   if (positional.size() != 2) {
@@ -27,7 +33,7 @@ int main(int argc, char* argv[]) {
   Config config;
   std::optional<std::string> err_opt = readConfig(
     positional[1],
-    {.IgnoreSegmentStopIds = true},
+    {.IgnoreSegmentStopIds = true, .DeferSegments = true},
     config
   );
   if (err_opt.has_value()) {
@@ -35,12 +41,18 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  AddWalkingSegments(config.world);
+  AddWalkingSegments(config.world, config.walking);
   std::cout << "added walking segments\n";
 
-  Problem problem = BuildProblem(config.world);
+  // The segments go straight from the trips into the problem, so they are never all in the World
+  // as well.
+  Problem problem = BuildProblemForDate(config.world, config.dates[0]);
   std::cout << "built\n";
 
+  if (absl::GetFlag(FLAGS_periodic)) {
+    MakePeriodic(problem);
+  }
+
   problem = SimplifyProblem(problem, config.target_stop_ids);
   std::cout << "simplified\n";
 
@@ -61,13 +73,15 @@ int main(int argc, char* argv[]) {
   nlohmann::json& result_vertices = result["vertices"];
   for (const std::string& stop_id : problem.stop_index_to_id) {
     nlohmann::json& vertex = result_vertices[stop_id];
-    const WorldStop& stop = config.world.stops.at(stop_id);
-    vertex["lat"] = stop.lat;
-    vertex["lon"] = stop.lon;
-    vertex["name"] = stop.name;
-
-    double lat = std::atof(stop.lat.c_str());
-    double lon = std::atof(stop.lon.c_str());
+    const WorldStopIndex stop = config.world.stops.ids.Find(stop_id).value();
+    const std::string& stop_lat = config.world.stops.lats[stop];
+    const std::string& stop_lon = config.world.stops.lons[stop];
+    vertex["lat"] = stop_lat;
+    vertex["lon"] = stop_lon;
+    vertex["name"] = config.world.stops.names[stop];
+
+    double lat = std::atof(stop_lat.c_str());
+    double lon = std::atof(stop_lon.c_str());
     minLat = std::min(minLat, lat);
     maxLat = std::max(maxLat, lat);
     minLon = std::min(minLon, lon);
@@ -98,7 +112,13 @@ int main(int argc, char* argv[]) {
         nlohmann::json& result_segment = result_segments.back();
         result_segment["departure_time"] = absl::StrCat(seg.departure_time);
         result_segment["arrival_time"] = absl::StrCat(seg.arrival_time);
-        for (const size_t trip_index : seg.trip_indices) {
+        std::span<const uint32_t> trips = problem.trip_paths.Get(seg.trip_path);
+        // Without a path, the departure and arrival trips are all that is known.
+        const uint32_t ends[] = {seg.departure_trip_index, seg.arrival_trip_index};
+        if (trips.empty()) {
+          trips = std::span<const uint32_t>(ends, seg.departure_trip_index == seg.arrival_trip_index ? 1 : 2);
+        }
+        for (const uint32_t trip_index : trips) {
           result_segment["trips"].push_back(problem.trip_index_to_id[trip_index]);
         }
       }
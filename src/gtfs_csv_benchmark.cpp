@@ -0,0 +1,168 @@
+// Compares reading stop_times.txt through csv::CSVReader (how World used to read GTFS) against
+// GTFSCsvReader.
+//
+// Usage: gtfs_csv_benchmark [--stop_times=<path>] [--synthetic_rows=<n>]
+//
+// Benchmarks the given stop_times.txt, and then a synthetic one with `synthetic_rows` rows made by
+// repeating its rows under new trip ids.
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <absl/flags/flag.h>
+#include <absl/flags/parse.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+#include <absl/strings/str_split.h>
+
+#include "csv.hpp"
+
+#include "GTFSCsv.h"
+
+ABSL_FLAG(std::string, stop_times, "data/fetched-2024-06-08/caltrain/stop_times.txt", "stop_times.txt to benchmark");
+ABSL_FLAG(size_t, synthetic_rows, 5'000'000, "Rows in the synthetic stop_times.txt (0 to skip)");
+ABSL_FLAG(int, repetitions, 3, "Times to read each file; the fastest is reported");
+
+namespace {
+
+// What both readers compute, so that neither can skip any work.
+struct Checksum {
+  size_t rows = 0;
+  size_t id_bytes = 0;
+  uint64_t seconds = 0;
+
+  bool operator==(const Checksum& other) const {
+    return rows == other.rows && id_bytes == other.id_bytes && seconds == other.seconds;
+  }
+};
+
+// The time parsing that World used before GTFSCsvReader.
+unsigned int parseTimeWithSplit(absl::string_view time) {
+  if (time.empty()) {
+    return 0;
+  }
+  std::vector<absl::string_view> parts = absl::StrSplit(time, ':');
+  unsigned int hours = 0, minutes = 0, seconds = 0;
+  if (parts.size() == 3) {
+    (void)absl::SimpleAtoi(parts[0], &hours);
+    (void)absl::SimpleAtoi(parts[1], &minutes);
+    (void)absl::SimpleAtoi(parts[2], &seconds);
+  }
+  return hours * 3600 + minutes * 60 + seconds;
+}
+
+Checksum readWithCSVParser(const std::string& path) {
+  Checksum checksum;
+  csv::CSVReader reader(path);
+  for (const csv::CSVRow& row : reader) {
+    const std::string trip_id = row["trip_id"].get<>();
+    const std::string stop_id = row["stop_id"].get<>();
+    checksum.rows += 1;
+    checksum.id_bytes += trip_id.size() + stop_id.size();
+    checksum.seconds += parseTimeWithSplit(row["arrival_time"].get<>());
+    checksum.seconds += parseTimeWithSplit(row["departure_time"].get<>());
+  }
+  return checksum;
+}
+
+Checksum readWithGTFSCsv(const std::string& path) {
+  Checksum checksum;
+  GTFSCsvReader reader;
+  size_t trip_id = 0, stop_id = 0, arrival_time = 0, departure_time = 0;
+  auto err = openGTFSCsv(
+    path,
+    {{"trip_id", &trip_id}, {"stop_id", &stop_id}, {"arrival_time", &arrival_time}, {"departure_time", &departure_time}},
+    reader
+  );
+  if (err.has_value()) {
+    std::cerr << *err << "\n";
+    exit(1);
+  }
+  while (reader.Next()) {
+    checksum.rows += 1;
+    checksum.id_bytes += reader.Field(trip_id).size() + reader.Field(stop_id).size();
+    unsigned int seconds = 0;
+    if (parseGTFSTimeSeconds(reader.Field(arrival_time), seconds)) {
+      checksum.seconds += seconds;
+    }
+    if (parseGTFSTimeSeconds(reader.Field(departure_time), seconds)) {
+      checksum.seconds += seconds;
+    }
+  }
+  return checksum;
+}
+
+// Runs `read` on `path` a few times and returns the best rows/sec.
+template <typename Read>
+double rowsPerSecond(const std::string& path, Read read, Checksum& checksum) {
+  double best = 0;
+  for (int i = 0; i < absl::GetFlag(FLAGS_repetitions); ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    checksum = read(path);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::max(best, checksum.rows / elapsed.count());
+  }
+  return best;
+}
+
+void benchmark(const std::string& path) {
+  Checksum csv_parser_checksum, gtfs_csv_checksum;
+  const double csv_parser = rowsPerSecond(path, readWithCSVParser, csv_parser_checksum);
+  const double gtfs_csv = rowsPerSecond(path, readWithGTFSCsv, gtfs_csv_checksum);
+  std::cout << absl::StreamFormat(
+    "%s (%d rows)\n  csv::CSVReader: %12.0f rows/s\n  GTFSCsvReader:  %12.0f rows/s (%.1fx)\n",
+    path, gtfs_csv_checksum.rows, csv_parser, gtfs_csv, gtfs_csv / csv_parser
+  );
+  if (!(csv_parser_checksum == gtfs_csv_checksum)) {
+    std::cout << "  WARNING: readers disagree\n";
+  }
+}
+
+// Writes a stop_times.txt with `num_rows` rows to `path`, by repeating the rows of `source` under
+// new trip ids.
+void writeSyntheticStopTimes(const std::string& source, size_t num_rows, const std::string& path) {
+  std::ifstream in(source);
+  std::string header;
+  std::getline(in, header);
+  std::vector<std::string> rows;
+  for (std::string line; std::getline(in, line);) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      rows.push_back(line);
+    }
+  }
+  if (!header.empty() && header.back() == '\r') {
+    header.pop_back();
+  }
+
+  std::ofstream out(path, std::ios::trunc);
+  out << header << "\r\n";
+  for (size_t i = 0; i < num_rows && !rows.empty(); ++i) {
+    // The trip id is the first column in every feed we have.
+    out << "r" << i / rows.size() << "-" << rows[i % rows.size()] << "\r\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  const std::string stop_times = absl::GetFlag(FLAGS_stop_times);
+  benchmark(stop_times);
+
+  const size_t synthetic_rows = absl::GetFlag(FLAGS_synthetic_rows);
+  if (synthetic_rows > 0) {
+    const std::string synthetic = (std::filesystem::temp_directory_path() / "synthetic_stop_times.txt").string();
+    writeSyntheticStopTimes(stop_times, synthetic_rows, synthetic);
+    benchmark(synthetic);
+    std::filesystem::remove(synthetic);
+  }
+  return 0;
+}
@@ -1,5 +1,6 @@
 
 #include <iostream>
+#include <map>
 #include <optional>
 #include <string>
 #include <set>
@@ -33,19 +34,31 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  std::map<std::string, size_t> segment_count;
-  std::map<std::string, std::set<std::string>> routes;
-  for (const WorldSegment& segment : config.world.segments) {
-    segment_count[segment.origin_stop_id]++;
-    segment_count[segment.destination_stop_id]++;
-    routes[segment.origin_stop_id].insert(segment.route_id);
-    routes[segment.destination_stop_id].insert(segment.route_id);
+  const World& world = config.world;
+  std::vector<size_t> stop_segment_count(world.stops.size());
+  std::vector<std::set<std::string>> stop_routes(world.stops.size());
+  ForEachSegment(world, [&](const WorldSegment& segment, const WorldTripRun&) {
+    stop_segment_count[segment.origin_stop]++;
+    stop_segment_count[segment.destination_stop]++;
+    stop_routes[segment.origin_stop].insert(world.routes.ids.Get(segment.route));
+    stop_routes[segment.destination_stop].insert(world.routes.ids.Get(segment.route));
+  });
+
+  // Stops with segments, in id order.
+  std::map<std::string, WorldStopIndex> segment_stops;
+  for (WorldStopIndex stop = 0; stop < world.stops.size(); ++stop) {
+    if (stop_segment_count[stop] > 0) {
+      segment_stops[world.stops.ids.Get(stop)] = stop;
+    }
   }
-  for (const auto [stop_id, count] : segment_count) {
+
+  for (const auto& [stop_id, stop] : segment_stops) {
+    const size_t count = stop_segment_count[stop];
+    const std::set<std::string>& routes = stop_routes[stop];
     if (route_filter.size() > 0) {
       bool found = false;
       for (const std::string& route_id : route_filter) {
-        if (routes[stop_id].contains(route_id)) {
+        if (routes.contains(route_id)) {
           found = true;
           break;
         }
@@ -55,10 +68,10 @@ int main(int argc, char* argv[]) {
       }
     }
     std::cout << absl::StreamFormat(
-      "%-30s %-40s %d\n", stop_id, config.world.stops.at(stop_id).name, count
+      "%-30s %-40s %d\n", stop_id, world.stops.names[stop], count
     );
     if (absl::GetFlag(FLAGS_show_routes)) {
-      for (const std::string& route_id : routes[stop_id]) {
+      for (const std::string& route_id : routes) {
         std::cout << "  " << route_id << "\n";
       }
     }
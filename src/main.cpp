@@ -14,10 +14,40 @@
 #include "absl/time/civil_time.h"
 
 #include <toml++/toml.h>
+#include <absl/flags/flag.h>
 #include <absl/flags/parse.h>
 
 #include "cereal/archives/json.hpp"
 
+ABSL_FLAG(
+  bool, each_date, false,
+  "Build and solve a problem for each of the config's dates, instead of solving problem.json"
+);
+ABSL_FLAG(
+  bool, periodic, false,
+  "With --each_date, treat each date's schedule as repeating every day, so that trips after midnight connect with the morning's"
+);
+
+// Returns the cost of the best tour of `problem`.
+static unsigned int SolveProblem(Problem& problem) {
+  size_t dummy_stop_id = GetOrAddStop("DUMMY", problem);
+  for (size_t i = 0; i < problem.edges.size(); ++i) {
+    if (i == dummy_stop_id) {
+      continue;
+    }
+
+    Edge* to_dummy = GetOrAddEdge(i, dummy_stop_id, problem);
+    to_dummy->schedule.anytime_duration = WorldDuration(0);
+
+    Edge* from_dummy = GetOrAddEdge(dummy_stop_id, i, problem);
+    from_dummy->schedule.anytime_duration = WorldDuration(0);
+  }
+
+  DenseProblem dense_problem = MakeDenseProblem(problem);
+  CostMatrix initial_cost = MakeInitialCostMatrix(dense_problem);
+  return LittleTSP(initial_cost);
+}
+
 int main(int argc, char* argv[]) {
   std::vector<char*> positional = absl::ParseCommandLine(argc, argv);
   if (positional.size() != 2) {
@@ -36,6 +66,24 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  if (absl::GetFlag(FLAGS_each_date)) {
+    // The feeds were read once for all the dates; only the segments differ between them.
+    AddWalkingSegments(config.world, config.walking);
+    for (const absl::CivilDay date : config.dates) {
+      SegmentWorld(date, config.world);
+      Problem problem = BuildProblem(config.world);
+      if (absl::GetFlag(FLAGS_periodic)) {
+        MakePeriodic(problem);
+      }
+      problem = SimplifyProblem(problem, config.target_stop_ids);
+      std::cout << date << ": " << config.world.segments.size() << " segments, "
+        << config.world.repeating_segments.size() << " repeating segments\n";
+      const unsigned int cost = SolveProblem(problem);
+      std::cout << date << ": best " << cost << "\n";
+    }
+    return 0;
+  }
+
   //  Problem problem = BuildProblem(config.world);
   //  SimplifyProblem(problem, config.target_stop_ids);
 
@@ -46,26 +94,11 @@ int main(int argc, char* argv[]) {
     readproblem(problem);
   }
 
-  size_t dummy_stop_id = GetOrAddStop("DUMMY", problem);
-  for (size_t i = 0; i < problem.edges.size(); ++i) {
-    if (i == dummy_stop_id) {
-      continue;
-    }
-
-    Edge* to_dummy = GetOrAddEdge(i, dummy_stop_id, problem);
-    to_dummy->schedule.anytime_duration = WorldDuration(0);
-
-    Edge* from_dummy = GetOrAddEdge(dummy_stop_id, i, problem);
-    from_dummy->schedule.anytime_duration = WorldDuration(0);
-  }
-
   // size_t num_stops = problem.edges.size();
   // size_t from = problem.stop_id_to_index.at("place_BERY");
   // size_t to = problem.stop_id_to_index.at("place_BERY");
 
-  DenseProblem dense_problem = MakeDenseProblem(problem);
-  CostMatrix initial_cost = MakeInitialCostMatrix(dense_problem);
-  LittleTSP(initial_cost);
+  SolveProblem(problem);
   // CostMatrix cm = MakeInitialCostMatrix(dense_problem);
   // std::cout << ReduceCostMatrix(cm) << "\n";
 
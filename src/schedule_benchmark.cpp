@@ -0,0 +1,277 @@
+// Compares the schedule kernels that the solvers spend their time in (EraseNonMinimal,
+// GetMinimalConnectingSchedule and MergeIntoSchedule) against how they used to be written, on random
+// schedules.
+//
+// Usage: schedule_benchmark [--schedules=<n>] [--segments=<n>] [--repetitions=<n>]
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <absl/flags/flag.h>
+#include <absl/flags/parse.h>
+#include <absl/strings/str_format.h>
+
+#include "Problem.h"
+
+ABSL_FLAG(size_t, schedules, 10'000, "Random schedules to run each kernel on");
+ABSL_FLAG(size_t, segments, 200, "Segments in each random schedule, at most");
+ABSL_FLAG(int, repetitions, 3, "Times to run each kernel; the fastest is reported");
+
+namespace {
+
+// EraseNonMinimal before it compacted in one pass: mark the segments to erase, and then erase them.
+void oldEraseNonMinimal(Schedule& schedule) {
+  unsigned int best_arrival = std::numeric_limits<unsigned int>::max();
+  unsigned int anytime_duration = schedule.anytime_duration_or_big().seconds;
+  for (size_t i = schedule.segments.size(); i > 0; --i) {
+    Segment& seg = schedule.segments[i - 1];
+    if (
+      seg.arrival_time.seconds >= best_arrival ||
+      seg.arrival_time.seconds - seg.departure_time.seconds >= anytime_duration
+    ) {
+      seg.arrival_time.seconds = std::numeric_limits<unsigned int>::max();
+    } else {
+      best_arrival = seg.arrival_time.seconds;
+    }
+  }
+  std::erase_if(schedule.segments, [](const Segment& seg) {
+    return seg.arrival_time.seconds == std::numeric_limits<unsigned int>::max();
+  });
+}
+
+// A copy of Problem.cpp's GetMinimalConnectingSegments, which is private to it and has not changed.
+void connectingSegments(
+  const std::vector<Segment>& a,
+  const std::vector<Segment>& b,
+  unsigned int min_transfer_seconds,
+  std::vector<Segment>& result
+) {
+  auto get_min_transfer_seconds = [&a, &b, min_transfer_seconds](size_t ai, size_t bi) -> unsigned int {
+    return a[ai].arrival_trip_index == b[bi].departure_trip_index ? 0 : min_transfer_seconds;
+  };
+  size_t b_index = 0;
+  for (size_t a_index = 0; a_index < a.size(); ++a_index) {
+    while (
+      b_index < b.size() &&
+      b[b_index].departure_time.seconds < a[a_index].arrival_time.seconds + get_min_transfer_seconds(a_index, b_index)
+    ) {
+      ++b_index;
+    }
+    if (b_index == b.size()) {
+      break;
+    }
+    if (
+      a_index == a.size() - 1 ||
+      a[a_index + 1].arrival_time.seconds + get_min_transfer_seconds(a_index + 1, b_index) > b[b_index].departure_time.seconds
+    ) {
+      result.push_back({
+        a[a_index].departure_time,
+        b[b_index].arrival_time,
+        a[a_index].departure_trip_index,
+        b[b_index].arrival_trip_index
+      });
+    }
+  }
+}
+
+// GetMinimalConnectingSchedule before it merged through a scratch buffer: build the result's three
+// runs in a fresh vector, and then put them together with two std::inplace_merge calls.
+Schedule oldGetMinimalConnectingSchedule(const Schedule& a, const Schedule& b, unsigned int min_transfer_seconds) {
+  Schedule result;
+  if (a.anytime_duration.has_value() && b.anytime_duration.has_value()) {
+    result.anytime_duration = WorldDuration(a.anytime_duration->seconds + b.anytime_duration->seconds);
+  }
+  result.segments.reserve(
+    (a.anytime_duration.has_value() ? b.segments.size() : 0) +
+    (b.anytime_duration.has_value() ? a.segments.size() : 0) +
+    std::min(a.segments.size(), b.segments.size()) +
+    5
+  );
+  if (a.anytime_duration.has_value()) {
+    for (const Segment& segment : b.segments) {
+      result.segments.push_back(Segment{
+        .departure_time = WorldTime(segment.departure_time.seconds - a.anytime_duration->seconds),
+        .arrival_time = segment.arrival_time,
+        .departure_trip_index = 0,
+        .arrival_trip_index = segment.arrival_trip_index,
+      });
+    }
+  }
+  const size_t merge_part_1 = result.segments.size();
+  if (b.anytime_duration.has_value()) {
+    for (const Segment& segment : a.segments) {
+      result.segments.push_back(Segment{
+        .departure_time = segment.departure_time,
+        .arrival_time = WorldTime(segment.arrival_time.seconds + b.anytime_duration->seconds),
+        .departure_trip_index = segment.departure_trip_index,
+        .arrival_trip_index = 0,
+      });
+    }
+  }
+  const size_t merge_part_2 = result.segments.size();
+  connectingSegments(a.segments, b.segments, min_transfer_seconds, result.segments);
+  std::inplace_merge(
+    result.segments.begin(), result.segments.begin() + merge_part_1, result.segments.begin() + merge_part_2, SegmentComp
+  );
+  std::inplace_merge(
+    result.segments.begin(), result.segments.begin() + merge_part_2, result.segments.end(), SegmentComp
+  );
+  oldEraseNonMinimal(result);
+  return result;
+}
+
+// MergeIntoSchedule before it merged from the back: append, and then std::inplace_merge.
+void oldMergeIntoSchedule(const Schedule& src, Schedule& dest) {
+  unsigned int anytime_duration = std::min(src.anytime_duration_or_big().seconds, dest.anytime_duration_or_big().seconds);
+  if (anytime_duration < std::numeric_limits<unsigned int>::max()) {
+    dest.anytime_duration = WorldDuration(anytime_duration);
+  }
+  const size_t merge_part = dest.segments.size();
+  dest.segments.insert(dest.segments.end(), src.segments.begin(), src.segments.end());
+  std::inplace_merge(dest.segments.begin(), dest.segments.begin() + merge_part, dest.segments.end(), SegmentComp);
+  oldEraseNonMinimal(dest);
+}
+
+// A sorted schedule that is not necessarily minimal, like the ones the property tests use, but
+// bigger and spread over a whole day.
+Schedule randomSchedule(std::mt19937& rng) {
+  Schedule result;
+  if (std::bernoulli_distribution(0.5)(rng)) {
+    result.anytime_duration = WorldDuration(std::uniform_int_distribution<unsigned int>(60, 3600)(rng));
+  }
+  // Departing no earlier than the longest anytime duration, so that taking an anytime connection to
+  // a segment never departs before midnight.
+  std::uniform_int_distribution<unsigned int> departure(3600, 86400);
+  std::uniform_int_distribution<unsigned int> duration(0, 3600);
+  const size_t num_segments = std::uniform_int_distribution<size_t>(0, absl::GetFlag(FLAGS_segments))(rng);
+  for (size_t i = 0; i < num_segments; ++i) {
+    const unsigned int departure_time = departure(rng);
+    result.segments.push_back(Segment{
+      .departure_time = WorldTime(departure_time),
+      .arrival_time = WorldTime(departure_time + duration(rng)),
+      .departure_trip_index = static_cast<uint32_t>(i),
+    });
+  }
+  std::sort(result.segments.begin(), result.segments.end(), SegmentComp);
+  return result;
+}
+
+// Segments in all the schedules, so that neither version can skip any work.
+size_t countSegments(const std::vector<Schedule>& schedules) {
+  size_t result = 0;
+  for (const Schedule& schedule : schedules) {
+    result += schedule.segments.size();
+  }
+  return result;
+}
+
+bool sameSchedules(const std::vector<Schedule>& a, const std::vector<Schedule>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].segments != b[i].segments) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Runs `run` a few times and returns the best time in seconds. `run` fills `results`.
+template <typename Run>
+double bestSeconds(Run run, std::vector<Schedule>& results) {
+  double best = std::numeric_limits<double>::max();
+  for (int i = 0; i < absl::GetFlag(FLAGS_repetitions); ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    run(results);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+template <typename Old, typename New>
+void benchmark(const std::string& name, Old run_old, New run_new) {
+  std::vector<Schedule> old_results, new_results;
+  const double old_seconds = bestSeconds(run_old, old_results);
+  const double new_seconds = bestSeconds(run_new, new_results);
+  std::cout << absl::StreamFormat(
+    "%s (%d segments out)\n  old: %9.2f ms\n  new: %9.2f ms (%.2fx)\n",
+    name, countSegments(new_results), old_seconds * 1000, new_seconds * 1000, old_seconds / new_seconds
+  );
+  if (!sameSchedules(old_results, new_results)) {
+    std::cout << "  WARNING: versions disagree\n";
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  std::mt19937 rng(1);
+  std::vector<Schedule> schedules;
+  for (size_t i = 0; i < absl::GetFlag(FLAGS_schedules); ++i) {
+    schedules.push_back(randomSchedule(rng));
+  }
+  // The connecting and merging kernels take minimal schedules, like the ones in a Problem.
+  std::vector<Schedule> minimal = schedules;
+  for (Schedule& schedule : minimal) {
+    EraseNonMinimal(schedule);
+  }
+
+  benchmark(
+    "EraseNonMinimal",
+    [&](std::vector<Schedule>& results) {
+      results = schedules;
+      for (Schedule& schedule : results) {
+        oldEraseNonMinimal(schedule);
+      }
+    },
+    [&](std::vector<Schedule>& results) {
+      results = schedules;
+      for (Schedule& schedule : results) {
+        EraseNonMinimal(schedule);
+      }
+    }
+  );
+
+  benchmark(
+    "GetMinimalConnectingSchedule",
+    [&](std::vector<Schedule>& results) {
+      results.resize(minimal.size());
+      for (size_t i = 0; i < minimal.size(); ++i) {
+        results[i] = oldGetMinimalConnectingSchedule(minimal[i], minimal[(i + 1) % minimal.size()], 60);
+      }
+    },
+    [&](std::vector<Schedule>& results) {
+      // Like the solvers, which keep their buffers from one connection to the next.
+      std::vector<Segment> scratch;
+      results.resize(minimal.size());
+      for (size_t i = 0; i < minimal.size(); ++i) {
+        GetMinimalConnectingSchedule(minimal[i], minimal[(i + 1) % minimal.size()], 60, false, scratch, results[i]);
+      }
+    }
+  );
+
+  benchmark(
+    "MergeIntoSchedule",
+    [&](std::vector<Schedule>& results) {
+      results = minimal;
+      for (size_t i = 0; i < results.size(); ++i) {
+        oldMergeIntoSchedule(minimal[(i + 1) % minimal.size()], results[i]);
+      }
+    },
+    [&](std::vector<Schedule>& results) {
+      results = minimal;
+      for (size_t i = 0; i < results.size(); ++i) {
+        MergeIntoSchedule(minimal[(i + 1) % minimal.size()], results[i]);
+      }
+    }
+  );
+  return 0;
+}